@@ -7,8 +7,8 @@
 //#define STB_DIVIDE_IMPLEMENTATION
 //#include "stb_divide.h"
 
-//#define STB_DXT_IMPLEMENTATION
-//#include "stb_dxt.h"
+#define STB_DXT_IMPLEMENTATION
+#include "stb_dxt.h"
 
 //#include "stb_easy_font.h"
 
@@ -30,7 +30,8 @@
 //#define STB_PERLIN_IMPLEMENTATION
 //#include "stb_perlin.h"
 
-//#include "stb_rect_pack.h"
+#define STB_RECT_PACK_IMPLEMENTATION
+#include "stb_rect_pack.h"
 
 // #define STB_TEXTEDIT_IMPLEMENTATION
 // #include "stb_textedit.h"
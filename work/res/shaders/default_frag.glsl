@@ -1,8 +1,18 @@
 #version 330 core
 
-// uniform data
-uniform mat4 uProjectionMatrix;
-uniform mat4 uModelViewMatrix;
+// per frame camera and light data, shared by every program (see FrameData
+// in frame_data.hpp, which must match)
+layout(std140) uniform FrameData {
+	mat4 uProjectionMatrix;
+	vec3 uLightDirection; // view space
+	vec3 uLightColor;
+	float uAmbient;
+	float uDiffuse;
+	float uSpecular;
+	float uShininess;
+	vec2 uViewportSize; // pixels
+	float uTessEdgePixels; // target length of a tessellated edge on screen
+};
 
 // viewspace data (this must match the output of the fragment shader)
 in VertexData {
@@ -13,22 +23,115 @@ in VertexData {
 // flag for color data
 in vec3 fColor;
 
+#ifdef TEXTURED
+// diffuse texture, multiplies the color
+uniform sampler2D uDiffuseMap;
+in vec2 fTexCoord;
+#endif
+
 // framebuffer output
 out vec4 fb_color;
 
-// directional light data
-uniform vec3 uLightDirection;
+#ifdef SHADOWS
+// cascaded shadow map for the directional light (see cgra::shadow_cascades)
+uniform sampler2DArrayShadow uShadowMap;
+uniform mat4 uShadowMatrices[4]; // view space to shadow map, per cascade
+uniform vec4 uCascadeFar; // view space depth each cascade reaches
+uniform vec4 uShadowTexelSize; // world size of a texel, per cascade
+uniform int uCascadeCount;
+
+// fraction of the directional light reaching the surface
+float shadow(vec3 position, vec3 normal) {
+	float depth = -position.z;
+	int cascade = 0;
+	while (cascade < uCascadeCount - 1 && depth > uCascadeFar[cascade]) cascade++;
+
+	// push the lookup off the surface by about a texel to avoid acne
+	vec3 offset = normal * uShadowTexelSize[cascade] * 1.5;
+	vec4 coord = uShadowMatrices[cascade] * vec4(position + offset, 1);
+
+	// 2x2 filtered taps, each already bilinear filtered by the comparison
+	vec2 texel = 1.0 / vec2(textureSize(uShadowMap, 0).xy);
+	float lit = 0.0;
+	lit += texture(uShadowMap, vec4(coord.xy + vec2(-0.5, -0.5) * texel, cascade, coord.z));
+	lit += texture(uShadowMap, vec4(coord.xy + vec2(0.5, -0.5) * texel, cascade, coord.z));
+	lit += texture(uShadowMap, vec4(coord.xy + vec2(-0.5, 0.5) * texel, cascade, coord.z));
+	lit += texture(uShadowMap, vec4(coord.xy + vec2(0.5, 0.5) * texel, cascade, coord.z));
+	return lit / 4.0;
+}
+#endif
+
+#ifdef CLUSTERED
+// point lights binned into view space clusters (see cgra::light_clusters)
+uniform usamplerBuffer uClusters; // offset and count into uClusterLightIndices per cluster
+uniform usamplerBuffer uClusterLightIndices;
+uniform samplerBuffer uClusterLights; // view space position and radius, then color, per light
+uniform ivec3 uClusterGrid;
+uniform vec2 uClusterTileSize; // pixels
+uniform vec2 uClusterDepth; // slice = log(depth) * x + y
+#endif
 
 // calculate shading
 void main() {
 	vec3 surfaceColor = fColor; // input from color picker
+#ifdef TEXTURED
+	surfaceColor *= texture(uDiffuseMap, fTexCoord).rgb;
+#endif
 
-	// calculate simple directional lighting
 	vec3 normal = normalize(f_in.normal);
 	vec3 lightDir = normalize(-uLightDirection);
-	float light = max(dot(normal, lightDir), 0.0);
+#ifdef SHADOWS
+	float lit = shadow(f_in.position, normal);
+#else
+	float lit = 1.0;
+#endif
+
+#ifdef PHONG
+	// phong model, compiled in with the PHONG define instead of branching
+	vec3 viewDir = normalize(-f_in.position);
+	vec3 ambient = uAmbient * uLightColor;
+	float diff = max(dot(normal, lightDir), 0.0);
+	vec3 diffuse = uDiffuse * diff * uLightColor;
+	vec3 reflectDir = reflect(-lightDir, normal);
+	float spec = pow(max(dot(viewDir, reflectDir), 0.0), uShininess);
+	vec3 specular = uSpecular * spec * uLightColor;
+	vec3 finalColor = (ambient + lit * (diffuse + specular)) * surfaceColor;
+#else
+	// calculate simple directional lighting
+	float light = lit * max(dot(normal, lightDir), 0.0);
 
 	// calculate final color
 	vec3 finalColor = mix(surfaceColor / 4, surfaceColor, light);
+#endif
+
+#ifdef CLUSTERED
+	// only the lights that may reach this fragment's cluster
+	float depth = -f_in.position.z;
+	ivec3 cell = ivec3(ivec2(gl_FragCoord.xy / uClusterTileSize), int(log(depth) * uClusterDepth.x + uClusterDepth.y));
+	cell = clamp(cell, ivec3(0), uClusterGrid - 1);
+	uvec2 cluster = texelFetch(uClusters, (cell.z * uClusterGrid.y + cell.y) * uClusterGrid.x + cell.x).xy;
+	for (uint i = 0u; i < cluster.y; i++) {
+		int index = int(texelFetch(uClusterLightIndices, int(cluster.x + i)).x);
+		vec4 positionRadius = texelFetch(uClusterLights, index * 2);
+		vec3 pointColor = texelFetch(uClusterLights, index * 2 + 1).rgb;
+
+		// smooth falloff to zero at the light's radius
+		vec3 toLight = positionRadius.xyz - f_in.position;
+		float dist = length(toLight);
+		float falloff = clamp(1.0 - (dist * dist) / (positionRadius.w * positionRadius.w), 0.0, 1.0);
+		falloff *= falloff;
+		vec3 pointDir = toLight / max(dist, 1e-4);
+
+		float pointDiff = max(dot(normal, pointDir), 0.0);
+#ifdef PHONG
+		float pointSpec = pow(max(dot(normalize(-f_in.position), reflect(-pointDir, normal)), 0.0), uShininess);
+		vec3 pointLight = vec3(uDiffuse * pointDiff + uSpecular * pointSpec * step(0.0, pointDiff));
+#else
+		vec3 pointLight = vec3(pointDiff);
+#endif
+		finalColor += falloff * pointLight * pointColor * surfaceColor;
+	}
+#endif
+
 	fb_color = vec4(finalColor, 1);
 }
@@ -1,8 +1,23 @@
 #version 330 core
 
-// uniform data
-uniform mat4 uProjectionMatrix;
-uniform mat4 uModelViewMatrix;
+// per frame camera and light data, shared by every program (see FrameData
+// in frame_data.hpp, which must match)
+layout(std140) uniform FrameData {
+	mat4 uProjectionMatrix;
+	vec3 uLightDirection; // view space
+	vec3 uLightColor;
+	float uAmbient;
+	float uDiffuse;
+	float uSpecular;
+	float uShininess;
+	vec2 uViewportSize; // pixels
+	float uTessEdgePixels; // target length of a tessellated edge on screen
+};
+
+// per object data, a slice of cgra::render_queue's uniform buffer ring
+layout(std140) uniform ObjectData {
+	mat4 uModelViewMatrix;
+};
 
 // color data
 uniform vec3 uColor;
@@ -10,6 +25,10 @@ uniform vec3 uColor;
 // mesh data
 layout(location = 0) in vec3 aPosition;
 layout(location = 1) in vec3 aNormal;
+#ifdef TEXTURED
+layout(location = 2) in vec2 aTexCoord;
+out vec2 fTexCoord;
+#endif
 
 // model data (this must match the input of the vertex shader)
 out VertexData {
@@ -30,4 +49,7 @@ void main() {
 
 	// set the color
 	fColor = uColor;
+#ifdef TEXTURED
+	fTexCoord = aTexCoord;
+#endif
 }
\ No newline at end of file
@@ -1,22 +1,22 @@
 #version 330 core
 
-// uniform data
-uniform mat4 uProjectionMatrix;
-uniform mat4 uModelViewMatrix;
+// per frame camera and light data, shared by every program (see FrameData
+// in frame_data.hpp, which must match)
+layout(std140) uniform FrameData {
+	mat4 uProjectionMatrix;
+	vec3 uLightDirection; // view space
+	vec3 uLightColor;
+	float uAmbient;
+	float uDiffuse;
+	float uSpecular;
+	float uShininess;
+	vec2 uViewportSize; // pixels
+	float uTessEdgePixels; // target length of a tessellated edge on screen
+};
 
 // model color (from color picker)
 uniform vec3 uColor;
 
-// directional light data
-uniform vec3 uLightDirection;
-uniform vec3 uLightColor;
-
-// phong model data
-uniform float uAmbient;
-uniform float uDiffuse;
-uniform float uSpecular;
-uniform float uShininess;
-
 // viewspace data (this must match the output of the fragment shader)
 in VertexData {
 	vec3 position;
@@ -1,8 +1,23 @@
 #version 330 core // specify the version of GLSL
 
-// uniform data
-uniform mat4 uProjectionMatrix; // projection matrix
-uniform mat4 uModelViewMatrix;	// model to view matrix
+// per frame camera and light data, shared by every program (see FrameData
+// in frame_data.hpp, which must match)
+layout(std140) uniform FrameData {
+	mat4 uProjectionMatrix;
+	vec3 uLightDirection; // view space
+	vec3 uLightColor;
+	float uAmbient;
+	float uDiffuse;
+	float uSpecular;
+	float uShininess;
+	vec2 uViewportSize; // pixels
+	float uTessEdgePixels; // target length of a tessellated edge on screen
+};
+
+// per object data, a slice of cgra::render_queue's uniform buffer ring
+layout(std140) uniform ObjectData {
+	mat4 uModelViewMatrix;
+};
 
 // mesh data
 layout(location = 0) in vec3 aPosition; // vertex position from Obj
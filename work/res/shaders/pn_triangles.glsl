@@ -0,0 +1,151 @@
+#version 400 core
+
+// curved PN triangles (Vlachos et al. 2001) between default_vert.glsl and
+// default_frag.glsl. Each input triangle becomes a cubic Bezier patch built
+// from its corners' positions and normals, tessellated finer the larger its
+// edges are on screen, so coarse smooth meshes look round up close
+
+// per frame camera and light data, shared by every program (see FrameData
+// in frame_data.hpp, which must match)
+layout(std140) uniform FrameData {
+	mat4 uProjectionMatrix;
+	vec3 uLightDirection; // view space
+	vec3 uLightColor;
+	float uAmbient;
+	float uDiffuse;
+	float uSpecular;
+	float uShininess;
+	vec2 uViewportSize; // pixels
+	float uTessEdgePixels; // target length of a tessellated edge on screen
+};
+
+#ifdef _TESS_CONTROL_
+layout(vertices = 3) out;
+
+// view space corners, from the vertex shader
+in VertexData {
+	vec3 position;
+	vec3 normal;
+} v_in[];
+in vec3 fColor[];
+#ifdef TEXTURED
+in vec2 fTexCoord[];
+out vec2 tcTexCoord[];
+#endif
+
+out VertexData {
+	vec3 position;
+	vec3 normal;
+} tc_out[];
+out vec3 tcColor[];
+
+// the patch's control points other than the corners, bIJK weights the
+// corners I, J, K times, and the quadratic normals' edge midpoints
+patch out vec3 b210, b120, b021, b012, b102, b201, b111;
+patch out vec3 n110, n011, n101;
+
+// how many segments to split the edge p0 p1 into. Only depends on the
+// edge itself, so neighbouring patches agree and leave no cracks
+float edgeLevel(vec3 p0, vec3 p1) {
+	// diameter on screen of the sphere around the edge, w is -z for a
+	// perspective projection and 1 for an orthographic one
+	vec3 center = (p0 + p1) * 0.5;
+	float w = max(center.z * uProjectionMatrix[2][3] + uProjectionMatrix[3][3], 1e-4);
+	float pixels = distance(p0, p1) * uProjectionMatrix[1][1] * 0.5 * uViewportSize.y / w;
+	return clamp(pixels / uTessEdgePixels, 1.0, 64.0);
+}
+
+// the control point a third of the way from pi to pj, projected onto the
+// tangent plane at pi
+vec3 edgePoint(vec3 pi, vec3 pj, vec3 ni) {
+	return (2.0 * pi + pj - dot(pj - pi, ni) * ni) / 3.0;
+}
+
+// the normal half way along the edge, reflected in the plane
+// perpendicular to it
+vec3 edgeNormal(vec3 pi, vec3 pj, vec3 ni, vec3 nj) {
+	vec3 d = pj - pi;
+	float v = 2.0 * dot(d, ni + nj) / max(dot(d, d), 1e-12);
+	return normalize(ni + nj - v * d);
+}
+
+void main() {
+	tc_out[gl_InvocationID].position = v_in[gl_InvocationID].position;
+	tc_out[gl_InvocationID].normal = normalize(v_in[gl_InvocationID].normal);
+	tcColor[gl_InvocationID] = fColor[gl_InvocationID];
+#ifdef TEXTURED
+	tcTexCoord[gl_InvocationID] = fTexCoord[gl_InvocationID];
+#endif
+
+	// the patch outputs are only written once
+	if (gl_InvocationID != 0) return;
+
+	vec3 p0 = v_in[0].position, p1 = v_in[1].position, p2 = v_in[2].position;
+	vec3 n0 = normalize(v_in[0].normal), n1 = normalize(v_in[1].normal), n2 = normalize(v_in[2].normal);
+	b210 = edgePoint(p0, p1, n0);
+	b120 = edgePoint(p1, p0, n1);
+	b021 = edgePoint(p1, p2, n1);
+	b012 = edgePoint(p2, p1, n2);
+	b102 = edgePoint(p2, p0, n2);
+	b201 = edgePoint(p0, p2, n0);
+	vec3 e = (b210 + b120 + b021 + b012 + b102 + b201) / 6.0;
+	vec3 v = (p0 + p1 + p2) / 3.0;
+	b111 = e + (e - v) * 0.5;
+	n110 = edgeNormal(p0, p1, n0, n1);
+	n011 = edgeNormal(p1, p2, n1, n2);
+	n101 = edgeNormal(p2, p0, n2, n0);
+
+	// outer level i is the edge opposite corner i
+	gl_TessLevelOuter[0] = edgeLevel(p1, p2);
+	gl_TessLevelOuter[1] = edgeLevel(p2, p0);
+	gl_TessLevelOuter[2] = edgeLevel(p0, p1);
+	gl_TessLevelInner[0] = max(gl_TessLevelOuter[0], max(gl_TessLevelOuter[1], gl_TessLevelOuter[2]));
+}
+#endif
+
+#ifdef _TESS_EVALUATION_
+layout(triangles, fractional_odd_spacing, ccw) in;
+
+in VertexData {
+	vec3 position;
+	vec3 normal;
+} tc_in[];
+in vec3 tcColor[];
+#ifdef TEXTURED
+in vec2 tcTexCoord[];
+out vec2 fTexCoord;
+#endif
+
+patch in vec3 b210, b120, b021, b012, b102, b201, b111;
+patch in vec3 n110, n011, n101;
+
+// same as the vertex shader's output, for the fragment shader
+out VertexData {
+	vec3 position;
+	vec3 normal;
+} v_out;
+out vec3 fColor;
+
+void main() {
+	// barycentric weights of corners 0, 1 and 2
+	float u = gl_TessCoord.x, v = gl_TessCoord.y, w = gl_TessCoord.z;
+	vec3 p0 = tc_in[0].position, p1 = tc_in[1].position, p2 = tc_in[2].position;
+
+	// cubic position and quadratic normal
+	vec3 position = p0 * u * u * u + p1 * v * v * v + p2 * w * w * w
+		+ b210 * 3.0 * u * u * v + b120 * 3.0 * u * v * v
+		+ b021 * 3.0 * v * v * w + b012 * 3.0 * v * w * w
+		+ b102 * 3.0 * w * w * u + b201 * 3.0 * w * u * u
+		+ b111 * 6.0 * u * v * w;
+	vec3 normal = tc_in[0].normal * u * u + tc_in[1].normal * v * v + tc_in[2].normal * w * w
+		+ n110 * u * v + n011 * v * w + n101 * w * u;
+
+	v_out.position = position;
+	v_out.normal = normalize(normal);
+	gl_Position = uProjectionMatrix * vec4(position, 1);
+	fColor = u * tcColor[0] + v * tcColor[1] + w * tcColor[2];
+#ifdef TEXTURED
+	fTexCoord = u * tcTexCoord[0] + v * tcTexCoord[1] + w * tcTexCoord[2];
+#endif
+}
+#endif
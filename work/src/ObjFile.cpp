@@ -1,9 +1,14 @@
 // objfile.cpp
 #include "objfile.h"
+#include "cgra/cgra_profiler.hpp"
+#include "cgra/cgra_trace.hpp"
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <algorithm> // Add this include for std::min
+#include <cstddef>
+#include <functional>
+#include <limits>
 
 using namespace std;
 using namespace glm; // OpenGL Mathematics, for vec3 
@@ -15,14 +20,23 @@ using namespace glm; // OpenGL Mathematics, for vec3
 * in application.cpp -> renderGUI() -> InputText() is taking the file name as input
 */
 bool ObjFile::loadOBJ(const std::string& filepath) { // const for read-only
+	CGRA_TRACE_SCOPE("ObjFile::loadOBJ");
 	// clear existing data
 	vertices.clear();
 	normals.clear();
+	texCoords.clear();
 	indices.clear();
 	textureIndices.clear();
 	normalIndices.clear();
 	drawIndices.clear();
 	meshVertices.clear();
+	materials.clear();
+	faceMaterials.clear();
+	currentMaterial = -1;
+
+	// mtl files and textures are relative to the obj
+	size_t slash = filepath.find_last_of("/\\");
+	string directory = slash == string::npos ? "" : filepath.substr(0, slash + 1);
 
 	// open the file
 	ifstream fsIn;
@@ -54,9 +68,27 @@ bool ObjFile::loadOBJ(const std::string& filepath) { // const for read-only
 			ss >> n.x >> n.y >> n.z;
 			normals.push_back(n);
 		}
+		else if (type == "vt") { // texture coordinate
+			vec2 t;
+			ss >> t.x >> t.y;
+			texCoords.push_back(t);
+		}
 		else if (type == "f") { // face
 			parseFace(ss);
 		}
+		else if (type == "mtllib") { // material library
+			string name;
+			getline(ss >> ws, name);
+			loadMTL(directory + name);
+		}
+		else if (type == "usemtl") { // material for the following faces
+			string name;
+			ss >> name;
+			currentMaterial = -1;
+			for (size_t i = 0; i < materials.size(); i++) {
+				if (materials[i].name == name) currentMaterial = int(i);
+			}
+		}
 		// ignore other line types
 	}
 	// close the file
@@ -68,15 +100,52 @@ bool ObjFile::loadOBJ(const std::string& filepath) { // const for read-only
 // helper function to parse faces, only expecting triangles!!
 // read the three vertex and parse them
 void ObjFile::parseFace(std::istringstream& ss) {
+	CGRA_TRACE_SCOPE("ObjFile::parseFace");
 	string v1, v2, v3;
 	ss >> v1 >> v2 >> v3;
 	parseVertex(v1);
 	parseVertex(v2);
 	parseVertex(v3);
+	faceMaterials.push_back(currentMaterial);
+}
+
+// helper function to read the materials of an mtl file
+// only the diffuse color and texture are kept
+void ObjFile::loadMTL(const std::string& filepath) {
+	ifstream fsIn(filepath);
+	if (!fsIn.is_open()) {
+		cerr << "Warning: Unable to open material file " << filepath << endl;
+		return;
+	}
+	size_t slash = filepath.find_last_of("/\\");
+	string directory = slash == string::npos ? "" : filepath.substr(0, slash + 1);
+
+	string line;
+	while (getline(fsIn, line)) {
+		istringstream ss(line);
+		string type;
+		ss >> type;
+		if (type == "newmtl") {
+			materials.emplace_back();
+			ss >> materials.back().name;
+		}
+		else if (materials.empty()) {
+			continue; // nothing to apply it to
+		}
+		else if (type == "Kd") {
+			vec3& kd = materials.back().diffuse;
+			ss >> kd.x >> kd.y >> kd.z;
+		}
+		else if (type == "map_Kd") {
+			// the file name is last, after any options
+			string name, word;
+			while (ss >> word) name = word;
+			if (!name.empty()) materials.back().diffuseMap = directory + name;
+		}
+	}
 }
 
 // helper function to parse vertex data
-// texture indices are only collected for printing, not used in the mesh
 void ObjFile::parseVertex(const std::string& vertex) {
 	// format is "v/vt/vn"
 	stringstream ss(vertex);
@@ -91,6 +160,10 @@ void ObjFile::parseVertex(const std::string& vertex) {
 	if (!vt.empty()) {
 		textureIndices.push_back(stoi(vt) - 1);
 	}
+	else if (!v.empty()) {
+		// no texture coordinate ("v//vn"), keeps textureIndices lined up with indices
+		textureIndices.push_back(numeric_limits<unsigned int>::max());
+	}
 	if (!vn.empty()) {
 		normalIndices.push_back(stoi(vn) - 1);
 	}
@@ -102,8 +175,20 @@ void ObjFile::parseVertex(const std::string& vertex) {
 */
 void ObjFile::build() {
 	if (vao != 0) return; // already built
+	CGRA_TRACE_SCOPE("ObjFile::build");
+	buildMesh();
+	upload();
+}
+
+/*
+* CPU half of build(), creates the mesh data from the raw data
+* does not touch OpenGL, so it can run on any thread
+*/
+void ObjFile::buildMesh() {
+	if (!meshVertices.empty()) return; // already built
+	CGRA_TRACE_SCOPE("ObjFile::buildMesh");
 	// Create triangles from the original indices (Each triangle has 3 vertices, but possibly with different normals)
-	for (auto i = 0; i < indices.size(); i++) {
+	for (size_t i = 0; i < indices.size(); i++) {
 		Vertex vertex;
 		// Get the current vertex index (to tell which vertex to use)
 		unsigned int vertexIndex = indices[i];
@@ -116,14 +201,43 @@ void ObjFile::build() {
 			normalIndex = vertexIndex;
 		}
 		vertex.normal = normals[normalIndex]; // Set the vertex normal
+		if (i < textureIndices.size() && textureIndices[i] < texCoords.size()) {
+			vertex.uv = texCoords[textureIndices[i]];
+		}
 		meshVertices.push_back(vertex); // Add the vertex to mesh
 	}
 	// Create a list of indices for drawing
 	drawIndices.resize(meshVertices.size());
-	for (auto i = 0; i < meshVertices.size(); i++) {
+	for (size_t i = 0; i < meshVertices.size(); i++) {
 		drawIndices[i] = i;
 	}
 
+	// split into chunks and pick occluders for CPU culling
+	buildCulling();
+}
+
+/*
+* move the texture coordinates of a material's triangles, the mesh is a
+* triangle soup so no vertex is shared with another material
+*/
+void ObjFile::remapTexCoords(int material, const glm::vec2& offset, const glm::vec2& scale) {
+	for (const MeshChunk& chunk : chunks) {
+		if (chunk.material != material) continue;
+		for (unsigned int i = chunk.first; i < chunk.first + chunk.count; i++) {
+			Vertex& vertex = meshVertices[drawIndices[i]];
+			vertex.uv = offset + vertex.uv * scale;
+		}
+	}
+}
+
+/*
+* GPU half of build(), stores the mesh data in the GPU
+* must be called on the thread with the GL context, after buildMesh()
+*/
+void ObjFile::upload() {
+	if (vao != 0) return; // already uploaded
+	CGRA_TRACE_SCOPE("ObjFile::upload");
+
 	// Generate buffers
 	glGenVertexArrays(1, &vao);
 	glGenBuffers(1, &vbo);
@@ -141,6 +255,8 @@ void ObjFile::build() {
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), nullptr);
 	glEnableVertexAttribArray(1);
 	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(sizeof(glm::vec3))); // offset by the size of the position
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(offsetof(Vertex, uv)));
 
 	// bind the EBO
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
@@ -150,16 +266,106 @@ void ObjFile::build() {
 	glBindVertexArray(0);
 }
 
+/*
+* split the triangles into chunks with bounding boxes and pick the largest
+* triangles as a simplified occluder set for the occlusion culler
+* triangles are kept in file order, which tends to be spatially coherent
+* a chunk never spans two materials
+*/
+void ObjFile::buildCulling() {
+	CGRA_TRACE_SCOPE("ObjFile::buildCulling");
+	const unsigned int trianglesPerChunk = 256;
+	const size_t maxOccluders = 2048;
+
+	chunks.clear();
+	chunkBounds.clear();
+	occluderTriangles.clear();
+	meshBounds = { vec3(0), vec3(0) };
+	if (meshVertices.empty()) return;
+
+	// chunk bounds and whole mesh bounds
+	meshBounds = { meshVertices[0].position, meshVertices[0].position };
+	const auto materialOf = [&](size_t index) { return index / 3 < faceMaterials.size() ? faceMaterials[index / 3] : -1; };
+	for (size_t first = 0; first < drawIndices.size();) {
+		MeshChunk chunk;
+		chunk.first = unsigned(first);
+		chunk.material = materialOf(first);
+		size_t end = std::min<size_t>(first + trianglesPerChunk * 3, drawIndices.size());
+		for (size_t i = first + 3; i < end; i += 3) {
+			if (materialOf(i) != chunk.material) end = i;
+		}
+		chunk.count = unsigned(end - first);
+		cgra::aabb box = { meshVertices[first].position, meshVertices[first].position };
+		for (size_t i = first; i < first + chunk.count; i++) {
+			box.min = glm::min(box.min, meshVertices[i].position);
+			box.max = glm::max(box.max, meshVertices[i].position);
+		}
+		meshBounds.min = glm::min(meshBounds.min, box.min);
+		meshBounds.max = glm::max(meshBounds.max, box.max);
+		chunks.push_back(chunk);
+		chunkBounds.push_back(box);
+		first = end;
+	}
+
+	// occluders are real triangles so they are always conservative,
+	// the largest ones cover the most screen for the least work
+	const size_t triangleCount = meshVertices.size() / 3;
+	vector<pair<float, size_t>> areas(triangleCount);
+	for (size_t t = 0; t < triangleCount; t++) {
+		const vec3& p0 = meshVertices[t * 3].position;
+		vec3 n = cross(meshVertices[t * 3 + 1].position - p0, meshVertices[t * 3 + 2].position - p0);
+		areas[t] = { dot(n, n), t };
+	}
+	const size_t occluderCount = std::min(maxOccluders, triangleCount);
+	partial_sort(areas.begin(), areas.begin() + occluderCount, areas.end(), greater<pair<float, size_t>>());
+	for (size_t i = 0; i < occluderCount; i++) {
+		for (size_t v = 0; v < 3; v++) {
+			occluderTriangles.push_back(meshVertices[areas[i].second * 3 + v].position);
+		}
+	}
+}
+
 /*
 * draw the mesh data, must be called after the build() function
 */
 void ObjFile::draw() {
 	if (vao == 0) return;
+	cgra::profiler::scope scope("ObjFile::draw");
 	glBindVertexArray(vao); // bind our VAO which sets up all our buffers and data for us
 	glDrawElements(GL_TRIANGLES, drawIndices.size(), GL_UNSIGNED_INT, 0); // tell opengl to draw our VAO using the draw mode and how many verticies to render
 	glBindVertexArray(0); // unbind the VAO
 }
 
+/*
+* draw only the visible chunks, neighbouring chunks are merged into one range
+* and all ranges are submitted with a single glMultiDrawElements call
+*/
+void ObjFile::draw(const std::vector<char>& visibleChunks) {
+	if (vao == 0) return;
+	drawCounts.clear();
+	drawOffsets.clear();
+	bool previousVisible = false;
+	for (size_t i = 0; i < chunks.size() && i < visibleChunks.size(); i++) {
+		if (!visibleChunks[i]) {
+			previousVisible = false;
+			continue;
+		}
+		if (previousVisible) {
+			drawCounts.back() += chunks[i].count; // extend the current range
+		}
+		else {
+			drawCounts.push_back(chunks[i].count);
+			drawOffsets.push_back((const GLvoid*)(sizeof(unsigned int) * chunks[i].first));
+		}
+		previousVisible = true;
+	}
+	if (drawCounts.empty()) return;
+	cgra::profiler::scope scope("ObjFile::draw");
+	glBindVertexArray(vao);
+	glMultiDrawElements(GL_TRIANGLES, drawCounts.data(), GL_UNSIGNED_INT, drawOffsets.data(), GLsizei(drawCounts.size()));
+	glBindVertexArray(0);
+}
+
 // clear the mesh geometry data
 void ObjFile::destroy() {
 	if (vao == 0) return; // nothing to destroy
@@ -174,11 +380,17 @@ void ObjFile::destroy() {
 	// clear the CPU-side data (may not nessesary?)
 	vertices.clear();
 	normals.clear();
+	texCoords.clear();
+	materials.clear();
+	faceMaterials.clear();
 	indices.clear();
 	textureIndices.clear();
 	normalIndices.clear();
 	drawIndices.clear();
 	meshVertices.clear();
+	chunks.clear();
+	chunkBounds.clear();
+	occluderTriangles.clear();
 }
 
 /*
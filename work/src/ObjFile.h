@@ -8,11 +8,27 @@
 #include <glm/glm.hpp>
 // project
 #include "opengl.hpp"
+#include "cgra/cgra_occlusion.hpp"
 
 // store combined vertex data
 struct Vertex {
 	glm::vec3 position;
 	glm::vec3 normal;
+	glm::vec2 uv = glm::vec2(0); // zero if the file has no texture coordinates
+};
+
+// contiguous range of triangles in the draw buffer, used for culling
+struct MeshChunk {
+	unsigned int first; // first index in drawIndices
+	unsigned int count; // number of indices
+	int material = -1; // index into getMaterials(), -1 for none
+};
+
+// the parts of an mtl material we draw with
+struct ObjMaterial {
+	std::string name;
+	glm::vec3 diffuse = glm::vec3(1); // Kd
+	std::string diffuseMap; // map_Kd, relative to the working directory, empty for none
 };
 
 class ObjFile {
@@ -20,12 +36,28 @@ private:
 	// CPU-side data
 	std::vector<glm::vec3> vertices; // vertex positions
 	std::vector<glm::vec3> normals; // vertex normals
+	std::vector<glm::vec2> texCoords; // vertex texture coordinates
 	std::vector<unsigned int> indices; // indices for drawing triangles
 	std::vector<unsigned int> textureIndices; // indices for texture coordinates
 	std::vector<unsigned int> normalIndices; // indices for normals
 	std::vector<unsigned int> drawIndices;  // indices for OpenGL drawing
 	std::vector<Vertex> meshVertices; // processed vertices with aligned position and normal
 
+	// materials from the mtl files, and the one used by each triangle
+	std::vector<ObjMaterial> materials;
+	std::vector<int> faceMaterials;
+	int currentMaterial = -1; // while parsing
+
+	// culling data, built with the mesh
+	cgra::aabb meshBounds; // bounds of the whole mesh
+	std::vector<MeshChunk> chunks; // triangle ranges, in draw order
+	std::vector<cgra::aabb> chunkBounds; // bounds of each chunk
+	std::vector<glm::vec3> occluderTriangles; // simplified occluder, three positions per triangle
+
+	// scratch buffers for drawing visible chunks
+	std::vector<GLsizei> drawCounts;
+	std::vector<const GLvoid*> drawOffsets;
+
 	// GPU-side data
 	GLuint vao = 0; // vertex array object, stores information about how the buffers are set up
 	GLuint vbo = 0; // vertex buffer object, stores the vertex data
@@ -34,6 +66,8 @@ private:
 	// helper function to parse face data
 	void parseFace(std::istringstream& ss);
 	void parseVertex(const std::string& vertex);
+	void loadMTL(const std::string& filepath);
+	void buildCulling();
 
 public:
 	// constructor & destructor
@@ -46,9 +80,36 @@ public:
 	// set up mesh geometry data on the OpenGL side
 	void build();
 
+	// the two halves of build(), buildMesh() is CPU only and thread safe
+	// upload() needs the GL context
+	void buildMesh();
+	void upload();
+
 	// draw the mesh
 	void draw();
 
+	// draw only the chunks marked visible (one flag per chunk)
+	void draw(const std::vector<char>& visibleChunks);
+
+	// triangle soup (three vertices per triangle), empty until buildMesh() is called
+	const std::vector<Vertex>& getMeshVertices() const { return meshVertices; }
+
+	// move a material's texture coordinates to offset + uv * scale (eg. onto
+	// an atlas page), between buildMesh() and upload()
+	void remapTexCoords(int material, const glm::vec2& offset, const glm::vec2& scale);
+
+	// culling data, empty until build() is called
+	const cgra::aabb& bounds() const { return meshBounds; }
+	const std::vector<cgra::aabb>& getChunkBounds() const { return chunkBounds; }
+	const std::vector<MeshChunk>& getChunks() const { return chunks; }
+
+	// materials the chunks refer to, empty if the file has none
+	const std::vector<ObjMaterial>& getMaterials() const { return materials; }
+	const std::vector<glm::vec3>& getOccluders() const { return occluderTriangles; }
+
+	// vertex array for drawing chunks directly (eg. through a render queue), 0 until uploaded
+	GLuint getVAO() const { return vao; }
+
 	// clear the mesh geometry data
 	void destroy();
 
@@ -1,8 +1,13 @@
 
 // std
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <iostream>
+#include <random>
 #include <string>
 #include <chrono>
+#include <cstring>
 
 // glm
 #include <glm/gtc/constants.hpp>
@@ -11,8 +16,11 @@
 
 // project
 #include "application.hpp"
+#include "frame_data.hpp"
 #include "cgra/cgra_gui.hpp"
+#include "cgra/cgra_profiler.hpp"
 #include "cgra/cgra_shader.hpp"
+#include "cgra/cgra_trace.hpp"
 
 
 using namespace std;
@@ -22,20 +30,152 @@ using namespace glm;
 
 // constructor & build the shader 
 Application::Application(GLFWwindow *window) : m_window(window) {
-	// build the shader
-	shader_builder color_sb;
-	color_sb.set_shader(GL_VERTEX_SHADER, CGRA_SRCDIR + std::string("//res//shaders//default_vert.glsl")); 
-	color_sb.set_shader(GL_FRAGMENT_SHADER, CGRA_SRCDIR + std::string("//res//shaders//default_frag.glsl"));
-	m_shader = color_sb.build();
+	// camera, light and transforms come from uniform blocks at fixed bindings
+	FrameData::setBlockBindings();
+
+	// build the shader, variants are compiled the first time they're used
+	m_shaders.set_shader(GL_VERTEX_SHADER, CGRA_SRCDIR + std::string("//res//shaders//default_vert.glsl"));
+	m_shaders.set_shader(GL_FRAGMENT_SHADER, CGRA_SRCDIR + std::string("//res//shaders//default_frag.glsl"));
+	m_phongFeature = m_shaders.add_feature("PHONG");
+	m_clusteredFeature = m_shaders.add_feature("CLUSTERED");
+	m_shadowFeature = m_shaders.add_feature("SHADOWS");
+	m_texturedFeature = m_shaders.add_feature("TEXTURED");
+	m_shaders.prefetch(0);
+	m_shaders.prefetch(m_phongFeature);
+	m_shaderReloader.add(m_shaders, "default");
+
+	// the same variants drawn as PN triangle patches, with the same feature
+	// bits. pn_triangles.glsl is #version 400, so this needs a GL 4.0
+	// context (ARB_tessellation_shader alone can't compile it)
+	m_tessellationSupported = GLEW_VERSION_4_0;
+	if (m_tessellationSupported) {
+		m_tessShaders.set_shader(GL_VERTEX_SHADER, CGRA_SRCDIR + std::string("//res//shaders//default_vert.glsl"));
+		m_tessShaders.set_shader(GL_TESS_CONTROL_SHADER, CGRA_SRCDIR + std::string("//res//shaders//pn_triangles.glsl"));
+		m_tessShaders.set_shader(GL_TESS_EVALUATION_SHADER, CGRA_SRCDIR + std::string("//res//shaders//pn_triangles.glsl"));
+		m_tessShaders.set_shader(GL_FRAGMENT_SHADER, CGRA_SRCDIR + std::string("//res//shaders//default_frag.glsl"));
+		m_tessShaders.add_feature("PHONG");
+		m_tessShaders.add_feature("CLUSTERED");
+		m_tessShaders.add_feature("SHADOWS");
+		m_tessShaders.add_feature("TEXTURED");
+		m_shaderReloader.add(m_tessShaders, "tessellated");
+	}
+
+	// tiny flat shaded program to draw with while the variants compile
+	shader_builder fallback;
+	fallback.set_shader_source(GL_VERTEX_SHADER, R"(
+		#version 330 core
+		layout(std140) uniform FrameData { mat4 uProjectionMatrix; }; // the start of it
+		layout(std140) uniform ObjectData { mat4 uModelViewMatrix; };
+		layout(location = 0) in vec3 aPosition;
+		void main() { gl_Position = uProjectionMatrix * uModelViewMatrix * vec4(aPosition, 1); }
+	)");
+	fallback.set_shader_source(GL_FRAGMENT_SHADER, R"(
+		#version 330 core
+		uniform vec3 uColor;
+		out vec4 fb_color;
+		void main() { fb_color = vec4(uColor * 0.5, 1); }
+	)");
+	m_fallbackShader = fallback.build();
+}
+
+Application::~Application() {
+	glDeleteProgram(m_fallbackShader);
+	glDeleteFramebuffers(1, &m_presentFramebuffer);
+	glDeleteTextures(1, &m_presentTexture);
+}
+
+// load a model from an obj file and upload it
+bool Application::loadModel(const std::string &filename) {
+	CGRA_TRACE_SCOPE("Application::loadModel");
+	m_model.destroy();
+	if (!m_model.loadOBJ(filename)) {
+		cout << "Error: Unable to load model" << endl;
+		return false;
+	}
+	m_model.buildMesh();
+
+	// start decoding the textures, they stream in while we draw
+	m_textures.clear();
+	const vector<ObjMaterial> &materials = m_model.getMaterials();
+	m_materialTextures.assign(materials.size(), 0);
+
+	// small textures whose coordinates don't wrap go on atlas pages, and
+	// their materials' coordinates onto the page
+	if (m_textureAtlas) {
+		vector<string> filenames;
+		for (const ObjMaterial &material : materials) filenames.push_back(material.diffuseMap);
+		const vector<Vertex> &vertices = m_model.getMeshVertices();
+		for (const MeshChunk &chunk : m_model.getChunks()) {
+			if (chunk.material < 0) continue;
+			for (unsigned i = chunk.first; i < chunk.first + chunk.count; i++) { // draw indices are in order
+				if (any(lessThan(vertices[i].uv, vec2(-1e-3f))) || any(greaterThan(vertices[i].uv, vec2(1 + 1e-3f)))) {
+					filenames[chunk.material].clear();
+					break;
+				}
+			}
+		}
+
+		texture_atlas atlas;
+		vector<texture_atlas::placement> placements = atlas.pack(filenames);
+		vector<GLuint> pages;
+		for (const texture_atlas::page &page : atlas.pages()) pages.push_back(m_textures.load(page));
+		for (size_t m = 0; m < materials.size(); m++) {
+			if (placements[m].page < 0) continue;
+			m_model.remapTexCoords(int(m), placements[m].offset, placements[m].scale);
+			m_materialTextures[m] = pages[placements[m].page];
+		}
+	}
+	for (size_t m = 0; m < materials.size(); m++) {
+		if (!m_materialTextures[m] && !materials[m].diffuseMap.empty()) m_materialTextures[m] = m_textures.load(materials[m].diffuseMap);
+	}
+	m_model.upload();
+
+	// materials with the same color and texture draw as one
+	m_sharedMaterials.clear();
+	for (size_t m = 0; m < materials.size(); m++) {
+		size_t same = 0;
+		while (materials[same].diffuse != materials[m].diffuse || m_materialTextures[same] != m_materialTextures[m]) same++;
+		m_sharedMaterials.push_back(int(same));
+	}
+
+	m_rayCastMeshDirty = true;
+	m_modelVersion++;
+	m_dirty = true;
+	return true;
+}
+
+// true if any part of the box may be inside the view frustum, ie. its
+// corners aren't all outside the same clip plane
+static bool inFrustum(const mat4 &mvp, const aabb &box) {
+	int outside[6] = { };
+	for (int i = 0; i < 8; i++) {
+		vec4 c = mvp * vec4(i & 1 ? box.max.x : box.min.x, i & 2 ? box.max.y : box.min.y, i & 4 ? box.max.z : box.min.z, 1);
+		outside[0] += c.x < -c.w;
+		outside[1] += c.x > c.w;
+		outside[2] += c.y < -c.w;
+		outside[3] += c.y > c.w;
+		outside[4] += c.z < -c.w;
+		outside[5] += c.z > c.w;
+	}
+	for (int plane = 0; plane < 6; plane++) {
+		if (outside[plane] == 8) return false;
+	}
+	return true;
 }
 
 // draw the model
 void Application::render() {
+	CGRA_TRACE_SCOPE("Application::render");
+	m_dirty = false;
+
+	// pick up edited shaders, the old program stays bound if they fail
+	m_shaderReloader.update();
+
+	// stream in a few more mip levels of any loading textures
+	m_textures.update();
 	
-	// retrieve the window hieght
-	int width, height;
-	glfwGetFramebufferSize(m_window, &width, &height); 
-	m_windowsize = vec2(width, height); // update window size
+	// window size, kept up to date by framebufferSizeCallback
+	int width = int(m_windowsize.x), height = int(m_windowsize.y);
 	glViewport(0, 0, width, height); // set the viewport to draw to the entire window
 
 	// clear the back-buffer
@@ -50,27 +190,351 @@ void Application::render() {
 	mat4 proj = perspective(1.f, float(width) / height, 0.1f, 1000.f);
 	mat4 view = translate(mat4(1), vec3(0, -5, -20));
 
-	// set shader and upload variables
-	glUseProgram(m_shader);
-	glUniformMatrix4fv(glGetUniformLocation(m_shader, "uProjectionMatrix"), 1, false, value_ptr(proj));
-	glUniformMatrix4fv(glGetUniformLocation(m_shader, "uModelViewMatrix"), 1, false, value_ptr(view));
-
-	// set the model color
-	glUniform3fv(glGetUniformLocation(m_shader, "uColor"), 1, value_ptr(m_modelColor));
-	/*
-	* note for me:
-	* glUniform3fv(location, count, value)
-	* location: the location of the uniform variable to be modified -> color
-	* count: the number of vec3 -> single color -> 1
-	* value: pointer to the first element -> m_modelColor
-	*/
-	
-	// set the directional light properties
-	vec3 normalLightDir = normalize(m_lightDirection);
-	glUniform3fv(glGetUniformLocation(m_shader, "uLightDirection"), 1, value_ptr(normalLightDir));
+	// ray cast the model on the CPU, a few tiles more each frame
+	if (m_rayCasting) {
+		renderRayCast(proj, view, width, height);
+		return;
+	}
+	if (m_rayCastTilesShown >= 0) {
+		m_rayCaster.cancel();
+		m_rayCastTilesShown = -1; // restart when turned back on
+	}
+
+	// draw the model on the CPU and blit the result
+	if (m_softwareRendering) {
+		renderSoftware(proj, view, width, height);
+		return;
+	}
+
+	// copies of the model go in a grid, every other row using the other
+	// lighting model so there is state worth sorting
+	const vector<MeshChunk> &chunks = m_model.getChunks();
+	const vector<aabb> &chunkBounds = m_model.getChunkBounds();
+	const aabb &bounds = m_model.bounds();
+	const vec3 size = chunks.empty() ? vec3(1) : bounds.max - bounds.min;
+	const float spacing = std::max(size.x, size.z) * 1.3f;
+	const int side = int(std::ceil(std::sqrt(float(m_instances))));
+	const auto instanceOffset = [&](int n) { return vec3((n % side - (side - 1) * 0.5f) * spacing, 0, -(n / side) * spacing); };
+
+	// the window, or quadrants looking at the whole grid of copies
+	aabb scene = chunks.empty() ? aabb{ vec3(-1), vec3(1) } : bounds;
+	scene.min += instanceOffset(side * ((m_instances - 1) / side));
+	scene.max += instanceOffset(side - 1);
+	const vector<View> views = m_quadView ? quadViews(proj, view, scene, width, height) : vector<View>{ { proj, view, ivec4(0, 0, width, height), 1000.f } };
+	const View &camera = views[0]; // the perspective view
+	if (m_quadView) {
+		glClearColor(0.15f, 0.15f, 0.2f, 1.0f); // shows between the views
+		glClear(GL_COLOR_BUFFER_BIT);
+		glClearColor(0.3f, 0.3f, 0.4f, 1.0f);
+		glEnable(GL_SCISSOR_TEST);
+		for (const View &v : views) {
+			glScissor(v.viewport.x, v.viewport.y, v.viewport.z, v.viewport.w);
+			glClear(GL_COLOR_BUFFER_BIT);
+		}
+		glDisable(GL_SCISSOR_TEST);
+	}
 
-	// draw the model
-	m_model.draw();
+	// pick the shader variant, uniforms the fallback lacks are ignored.
+	// Shadows and point lights are binned for the perspective view, the
+	// others draw without them
+	uint64_t features = m_phong ? m_phongFeature : 0;
+	if (!m_pointLights.empty()) features |= m_clusteredFeature;
+	bool shadows = m_shadows && !chunkBounds.empty();
+	if (shadows) features |= m_shadowFeature;
+	GLuint shader = shaderVariant(features);
+
+	// bin the point lights for this view, only the CLUSTERED variant reads them
+	if (!m_pointLights.empty() && shader != m_fallbackShader) {
+		m_lightClusters.assign(m_pointLights, camera.view, camera.proj);
+		m_lightClusters.upload();
+	}
+
+	// update the shadow maps, cascades whose view of the light didn't change are reused
+	if (shadows && shader != m_fallbackShader) {
+		m_shadowCascades.update(camera.view, 1.f, float(camera.viewport.z) / camera.viewport.w, 0.1f, m_model.bounds(), m_lightDirection, m_modelVersion, [&]() { m_model.draw(); });
+	}
+
+	// queue every chunk of every instance in every view, the queue sorts
+	// them by view (its pass), state then front to back. Each pass sets its
+	// viewport and camera, each program its frame uniforms when it switches
+	m_renderQueue.clear();
+	m_renderQueue.set_sorting(m_sortDraws);
+
+	// camera and light of every view in one go, each pass binds its own
+	if (!m_frameData) {
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &m_uniformAlignment);
+		m_frameData = make_unique<stream_buffer>(GL_UNIFORM_BUFFER, 4 * 1024);
+	}
+	const GLsizeiptr frameStride = (GLsizeiptr(sizeof(FrameData)) + m_uniformAlignment - 1) / m_uniformAlignment * m_uniformAlignment;
+	stream_buffer::allocation frame = m_frameData->allocate(views.size() * frameStride, m_uniformAlignment);
+	for (size_t v = 0; v < views.size(); v++) {
+		FrameData frameData(shadingParams(views[v].proj, views[v].view));
+		frameData.viewportSize = vec2(views[v].viewport.z, views[v].viewport.w);
+		frameData.tessEdgePixels = m_tessEdgePixels;
+		memcpy(static_cast<char *>(frame.data) + v * frameStride, &frameData, sizeof(FrameData));
+		const ivec4 viewport = views[v].viewport;
+		const GLuint buffer = m_frameData->buffer();
+		const GLintptr offset = frame.offset + v * frameStride;
+		m_renderQueue.set_pass(unsigned(v), [viewport, buffer, offset](GLuint) {
+			glViewport(viewport.x, viewport.y, viewport.z, viewport.w);
+			glBindBufferRange(GL_UNIFORM_BUFFER, FrameData::binding, buffer, offset, sizeof(FrameData));
+		});
+	}
+	m_frameData->flush(frame);
+
+	const auto material = [this](const vec3 &color, GLuint texture) {
+		return [this, color, texture](GLuint program) {
+			/*
+			* note for me:
+			* glUniform3fv(location, count, value)
+			* location: the location of the uniform variable to be modified -> color
+			* count: the number of vec3 -> single color -> 1
+			* value: pointer to the first element -> color
+			*/
+			glUniform3fv(glGetUniformLocation(program, "uColor"), 1, value_ptr(color));
+			if (!texture) return;
+			m_frameTextureBinds++;
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, texture);
+			glUniform1i(glGetUniformLocation(program, "uDiffuseMap"), 0);
+		};
+	};
+	const vector<ObjMaterial> &modelMaterials = m_model.getMaterials();
+	const uint32_t vao = m_renderQueue.add_vertex_array(m_model.getVAO());
+
+	// chunks with a diffuse texture use the TEXTURED variant of the shader
+	const auto textured = [&](const MeshChunk &chunk) { return chunk.material >= 0 && m_materialTextures[chunk.material] != 0; };
+	bool anyTextured = std::any_of(chunks.begin(), chunks.end(), textured);
+
+	// programs and the primitives they draw for [view][row % 2][textured],
+	// patches for the PN triangle variants once they have built
+	vector<array<array<uint32_t, 2>, 2>> programs(views.size());
+	vector<array<array<GLenum, 2>, 2>> modes(views.size());
+	for (size_t v = 0; v < views.size(); v++) {
+		uint64_t viewFeatures = v == 0 ? features : features & ~(m_clusteredFeature | m_shadowFeature);
+		render_queue::program_setup setup;
+		if (v == 0) setup = [=](GLuint program) { setupShader(program, camera.view, camera.viewport.z, camera.viewport.w); };
+		for (int row = 0; row < std::min(m_instances, 2); row++) {
+			uint64_t rowFeatures = row == 0 ? viewFeatures : viewFeatures ^ m_phongFeature;
+			for (int tex = 0; tex < 2; tex++) {
+				uint64_t variant = tex && anyTextured ? rowFeatures | m_texturedFeature : rowFeatures;
+				GLuint tessellated = tessellatedVariant(variant);
+				programs[v][row][tex] = m_renderQueue.add_program(tessellated ? tessellated : shaderVariant(variant), setup);
+				modes[v][row][tex] = tessellated ? GL_PATCHES : GL_TRIANGLES;
+			}
+		}
+	}
+	if (m_tessellation && m_tessellationSupported) glPatchParameteri(GL_PATCH_VERTICES, 3);
+
+	// queue materials for a base color, one per model material plus one
+	// (first) for chunks without. Chunks draw with the first material that
+	// looks the same as theirs, so they can batch together. Copies cycle
+	// through a palette
+	const auto materialOffset = [&](const MeshChunk &chunk) { return chunk.material < 0 ? 0 : uint32_t(m_sharedMaterials[chunk.material] + 1); };
+	const vec3 palette[8] = { m_modelColor, vec3(0.9f, 0.3f, 0.3f), vec3(0.3f, 0.8f, 0.3f), vec3(0.3f, 0.4f, 0.9f), vec3(0.9f, 0.8f, 0.3f), vec3(0.8f, 0.4f, 0.9f), vec3(0.3f, 0.8f, 0.9f), vec3(0.9f, 0.6f, 0.3f) };
+	uint32_t materials[8];
+	for (int m = 0; m < std::min(m_instances, 8); m++) {
+		materials[m] = m_renderQueue.add_material(material(palette[m], 0));
+		for (size_t i = 0; i < modelMaterials.size(); i++) m_renderQueue.add_material(material(palette[m] * modelMaterials[i].diffuse, m_materialTextures[i]));
+	}
+
+	if (m_instances <= 1 && views.size() == 1) {
+		uint32_t transform = m_renderQueue.add_transform(view);
+
+		// cull chunks hidden behind the model's own occluders
+		if (m_occlusionCulling && !chunkBounds.empty()) {
+			mat4 mvp = proj * view;
+			m_culler.clear();
+			m_culler.render_occluders(mvp, m_model.getOccluders());
+			m_visibleChunkCount = m_culler.test(mvp, chunkBounds, m_visibleChunks);
+		}
+		else {
+			m_visibleChunks.assign(chunks.size(), 1);
+			m_visibleChunkCount = int(chunks.size());
+		}
+		for (size_t i = 0; i < chunks.size(); i++) {
+			if (!m_visibleChunks[i]) continue;
+			float depth = -(view * vec4((chunkBounds[i].min + chunkBounds[i].max) * 0.5f, 1)).z / camera.farPlane;
+			m_renderQueue.add(0, programs[0][0][textured(chunks[i])], materials[0] + materialOffset(chunks[i]), vao, modes[0][0][textured(chunks[i])], chunks[i].count, chunks[i].first, transform, depth);
+		}
+	}
+	else {
+		// frustum culling, transforms and sort keys for every copy in every
+		// view on the workers, each filling in its own slots of the queue
+		const size_t copies = views.size() * m_instances;
+		const size_t firstSlot = m_renderQueue.allocate(chunks.size() * copies);
+		const size_t firstTransform = m_renderQueue.allocate_transforms(copies);
+		atomic<int> visible{ 0 };
+		m_pool.parallel_for(0, copies, 16, [&](size_t first, size_t last) {
+			int visibleHere = 0;
+			for (size_t c = first; c < last; c++) {
+				const size_t v = c / m_instances;
+				const int n = int(c % m_instances), row = n / side;
+				mat4 modelView = views[v].view * translate(mat4(1), instanceOffset(n));
+				mat4 mvp = views[v].proj * modelView;
+				m_renderQueue.set_transform(firstTransform + c, modelView);
+				for (size_t i = 0; i < chunks.size(); i++) {
+					size_t slot = firstSlot + c * chunks.size() + i;
+					float depth = -(modelView * vec4((chunkBounds[i].min + chunkBounds[i].max) * 0.5f, 1)).z / views[v].farPlane;
+					GLsizei count = inFrustum(mvp, chunkBounds[i]) ? GLsizei(chunks[i].count) : 0;
+					m_renderQueue.set(slot, unsigned(v), programs[v][row % 2][textured(chunks[i])], materials[n % 8] + materialOffset(chunks[i]), vao, modes[v][row % 2][textured(chunks[i])], count, chunks[i].first, uint32_t(firstTransform + c), depth);
+					visibleHere += count > 0;
+				}
+			}
+			visible += visibleHere;
+		});
+		m_visibleChunkCount = visible.load();
+	}
+	m_frameTextureBinds = 0;
+	m_renderQueue.submit();
+	m_frameData->end_frame();
+	m_textureBinds = m_frameTextureBinds;
+	glViewport(0, 0, width, height);
+}
+
+// the perspective camera in the bottom left quadrant (where gl_FragCoord,
+// which point lights are binned by, starts at its corner), with top, front
+// and side orthographic views of the scene around it
+vector<Application::View> Application::quadViews(const mat4 &proj, const mat4 &view, const aabb &scene, int width, int height) const {
+	const int gap = 2; // pixels between the views
+	const int w = std::max((width - gap) / 2, 1), h = std::max((height - gap) / 2, 1);
+	const vec3 center = (scene.min + scene.max) * 0.5f;
+	const float radius = std::max(length(scene.max - scene.min) * 0.5f, 1e-3f);
+	const float aspect = float(w) / h;
+	const mat4 orthographic = ortho(-radius * aspect, radius * aspect, -radius, radius, radius, 3 * radius);
+	const auto side = [&](const vec3 &direction, const vec3 &up, int x, int y) {
+		return View{ orthographic, lookAt(center + direction * 2.f * radius, center, up), ivec4(x, y, w, h), 3 * radius };
+	};
+	return {
+		View{ proj, view, ivec4(0, 0, w, h), 1000.f },
+		side(vec3(0, 1, 0), vec3(0, 0, -1), 0, height - h), // top
+		side(vec3(0, 0, 1), vec3(0, 1, 0), width - w, height - h), // front
+		side(vec3(1, 0, 0), vec3(0, 1, 0), width - w, 0) // side
+	};
+}
+
+// the shader for a set of features, or the fallback while it compiles
+GLuint Application::shaderVariant(uint64_t features) {
+	GLuint shader = m_asyncShaders ? m_shaders.try_get(features) : m_shaders.get(features);
+	return shader ? shader : m_fallbackShader;
+}
+
+// the PN triangle variant when tessellating, or 0 to draw triangles (also
+// while it compiles, or if it failed to)
+GLuint Application::tessellatedVariant(uint64_t features) {
+	if (!m_tessellation || !m_tessellationSupported) return 0;
+	if (m_asyncShaders) return m_tessShaders.try_get(features);
+	if (m_tessShaders.failed(features)) return 0;
+	try {
+		return m_tessShaders.get(features);
+	}
+	catch (const std::exception &) {
+		cerr << "Warning: Could not build the PN triangle variant [" << m_tessShaders.describe(features) << "], drawing triangles" << endl;
+		return 0;
+	}
+}
+
+// per frame uniforms of a shader (which must be in use) that aren't in
+// FrameData: point lights and shadows, only in the CLUSTERED and SHADOWS variants
+void Application::setupShader(GLuint shader, const mat4 &view, int width, int height) {
+	if (shader == m_fallbackShader) return;
+	if (!m_pointLights.empty()) m_lightClusters.bind(shader, width, height);
+	if (m_shadows) m_shadowCascades.bind(shader, view);
+}
+
+// lamps on a jittered grid over and around the model, like a lit
+// facility floor. Closer together the more there are, with the radius
+// shrinking to match so each fragment sees a similar number of lights
+void Application::setPointLights(int count) {
+	m_pointLightCount = count;
+	m_pointLights.resize(count);
+	mt19937 random(7);
+	uniform_real_distribution<float> unit(0.f, 1.f);
+	const int side = std::max(1, int(std::ceil(std::sqrt(float(count)))));
+	const float extent = 24, spacing = extent / side;
+	for (int i = 0; i < count; i++) {
+		point_light &light = m_pointLights[i];
+		float x = (i % side + unit(random)) * spacing - extent / 2;
+		float z = (i / side + unit(random)) * spacing - extent / 2;
+		light.position = vec3(x, 1 + unit(random) * 8, z);
+		light.radius = glm::clamp(spacing * 3, 2.f, 10.f);
+		light.color = mix(vec3(1.f, 0.85f, 0.6f), vec3(unit(random), unit(random), unit(random)), 0.3f) * 0.2f;
+	}
+	m_dirty = true;
+}
+
+// lighting for the CPU renderers, matches the uniforms set in render()
+ShadingParams Application::shadingParams(const mat4 &proj, const mat4 &view) const {
+	ShadingParams params;
+	params.projection = proj;
+	params.modelView = view;
+	params.color = m_modelColor;
+	params.lightDirection = normalize(m_lightDirection);
+	params.phong = m_phong;
+	return params;
+}
+
+// draw the model with the CPU rasterizer and copy it into the current framebuffer
+void Application::renderSoftware(const mat4 &proj, const mat4 &view, int width, int height) {
+	m_softRasterizer.resize(width, height);
+	m_softRasterizer.render(m_model.getMeshVertices(), shadingParams(proj, view));
+	presentPixels(m_softRasterizer.pixels().data(), m_softRasterizer.stride(), width, height);
+}
+
+// restart the ray caster if anything changed and show the tiles done so far
+void Application::renderRayCast(const mat4 &proj, const mat4 &view, int width, int height) {
+	ShadingParams params = shadingParams(proj, view);
+	bool restart = m_rayCastMeshDirty || m_rayCastTilesShown < 0
+		|| width != m_rayCaster.width() || height != m_rayCaster.height()
+		|| params.projection != m_rayCastParams.projection || params.modelView != m_rayCastParams.modelView
+		|| params.color != m_rayCastParams.color || params.lightDirection != m_rayCastParams.lightDirection
+		|| m_rayCastSettings.shadows != m_rayCastStarted.shadows || m_rayCastSettings.sampleCount() != m_rayCastStarted.sampleCount();
+	if (restart) {
+		if (m_rayCastMeshDirty) {
+			m_rayCaster.setMesh(m_model.getMeshVertices());
+			m_rayCastMeshDirty = false;
+		}
+		m_rayCaster.start(params, m_rayCastSettings, width, height);
+		m_rayCastParams = params;
+		m_rayCastStarted = m_rayCastSettings;
+	}
+
+	// copy before uploading, tiles keep landing while we draw
+	m_rayCastTilesShown = m_rayCaster.tilesDone();
+	m_rayCaster.copyPixels(m_rayCastPixels);
+	presentPixels(m_rayCastPixels.data(), width, width, height);
+}
+
+// upload RGBA8 pixels (bottom row first) and blit them into the current framebuffer
+void Application::presentPixels(const unsigned char *pixels, int rowLength, int width, int height) {
+	// (re)create the texture to blit from
+	if (!m_presentTexture) {
+		glGenTextures(1, &m_presentTexture);
+		glGenFramebuffers(1, &m_presentFramebuffer);
+	}
+	glBindTexture(GL_TEXTURE_2D, m_presentTexture);
+	if (m_presentWidth != width || m_presentHeight != height) {
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		m_presentWidth = width;
+		m_presentHeight = height;
+	}
+
+	// rows may be padded (the rasterizer pads to whole tiles)
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, rowLength);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	// blit into whatever is bound for drawing (the window or a headless target)
+	GLint readFramebuffer;
+	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFramebuffer);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, m_presentFramebuffer);
+	glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_presentTexture, 0);
+	glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
 }
 
 // render the GUI
@@ -78,7 +542,7 @@ void Application::renderGUI() {
 
 	// setup window
 	ImGui::SetNextWindowPos(ImVec2(5, 5), ImGuiSetCond_Once);
-	ImGui::SetNextWindowSize(ImVec2(500, 170), ImGuiSetCond_Once);
+	ImGui::SetNextWindowSize(ImVec2(500, 300), ImGuiSetCond_Once);
 	ImGui::Begin("Mesh loader", 0);
 
 	// Loading buttons
@@ -93,12 +557,7 @@ void Application::renderGUI() {
 	ImGui::SameLine();
 	if (ImGui::Button("Load")) {
 		// load mesh from 'filename'
-		if (m_model.loadOBJ(filename)) {
-			m_model.build();
-		}
-		else {
-			cout << "Error: Unable to load model" << endl;
-		}
+		loadModel(filename);
 	}
 
 	ImGui::SameLine();
@@ -111,20 +570,131 @@ void Application::renderGUI() {
 	if (ImGui::Button("Unload")) {
 		// unload mesh
 		m_model.destroy();
+		m_rayCastMeshDirty = true;
+		m_dirty = true;
 	}
 
 	// Color picker
-	ImGui::ColorEdit3("Model Color", glm::value_ptr(m_modelColor));
+	m_dirty |= ImGui::ColorEdit3("Model Color", glm::value_ptr(m_modelColor));
 
 	// Directional light properties
 	ImGui::Separator();
 	ImGui::Text("Light Direction");
-	ImGui::SliderFloat("X", &m_lightDirection.x, -1.0f, 1.0f);
-	ImGui::SliderFloat("Y", &m_lightDirection.y, -1.0f, 1.0f);
-	ImGui::SliderFloat("Z", &m_lightDirection.z, -1.0f, 1.0f);
+	m_dirty |= ImGui::SliderFloat("X", &m_lightDirection.x, -1.0f, 1.0f);
+	m_dirty |= ImGui::SliderFloat("Y", &m_lightDirection.y, -1.0f, 1.0f);
+	m_dirty |= ImGui::SliderFloat("Z", &m_lightDirection.z, -1.0f, 1.0f);
+	m_dirty |= ImGui::Checkbox("Phong lighting", &m_phong);
+	ImGui::SameLine();
+	ImGui::Text("(%d shader variants built)", int(m_shaders.size()));
+	m_dirty |= ImGui::Checkbox("Shadows", &m_shadows);
+	if (m_shadows) {
+		ImGui::SameLine();
+		ImGui::Text("%d cascades re-rendered, %d reused in total", int(m_shadowCascades.total_rendered()), int(m_shadowCascades.total_reused()));
+	}
+	// render queue, sorted by state then depth
+	m_dirty |= ImGui::SliderInt("Instances", &m_instances, 1, 256);
+	ImGui::SameLine();
+	m_dirty |= ImGui::Checkbox("Sort draws", &m_sortDraws);
+	ImGui::SameLine();
+	m_dirty |= ImGui::Checkbox("Quad view", &m_quadView);
+	if (m_tessellationSupported) {
+		m_dirty |= ImGui::Checkbox("PN triangles", &m_tessellation);
+		if (m_tessellation) {
+			ImGui::SameLine();
+			m_dirty |= ImGui::SliderFloat("Edge pixels", &m_tessEdgePixels, 2.f, 64.f);
+		}
+	}
+	const render_queue::stats &stats = m_renderQueue.last_stats();
+	ImGui::Text("%u draws in %u GL calls, %u state changes", stats.draws, stats.batches, stats.state_changes());
+	ImGui::Text("sort %.3f ms, record %.3f ms (%u lists), replay %.3f ms", stats.sort_ms, stats.record_ms, stats.lists, stats.replay_ms);
+	const texture_loader::stats &textures = m_textures.last_stats();
+	if (textures.requested > 0) {
+		ImGui::Text("Textures: %u of %u loaded (%u failed), %u decoding, %u streaming, %.1f KB this frame",
+			textures.complete, textures.requested, textures.failed, textures.decoding, textures.uploading, textures.uploaded_bytes / 1024.0);
+		ImGui::Text("%.1f MB on the GPU (%.1f MB as RGBA8), %u from the cache",
+			textures.gpu_bytes / 1048576.0, textures.rgba_bytes / 1048576.0, textures.cache_hits);
+		ImGui::Text("%u texture binds per frame", m_textureBinds);
+	}
+	if (ImGui::SliderInt("Point lights", &m_pointLightCount, 0, 1024)) setPointLights(m_pointLightCount);
+	if (!m_pointLights.empty()) {
+		ImGui::SameLine();
+		ImGui::Text("%.3f ms", m_lightClusters.assign_milliseconds());
+	}
+
+	// CPU occlusion culling
+	ImGui::Separator();
+	m_dirty |= ImGui::Checkbox("Occlusion culling", &m_occlusionCulling);
+	ImGui::SameLine();
+	ImGui::Text("%d / %d chunks visible", m_visibleChunkCount, int(m_model.getChunkBounds().size()));
+
+	// CPU rasterizer instead of OpenGL
+	m_dirty |= ImGui::Checkbox("Software rasterizer", &m_softwareRendering);
+	if (m_softwareRendering) {
+		double ms = m_softRasterizer.milliseconds();
+		ImGui::SameLine();
+		ImGui::Text("%.2f ms, %.2f Mtris/s", ms, ms > 0 ? m_softRasterizer.triangleCount() / (ms * 1000.0) : 0.0);
+	}
+
+	// reference ray caster
+	m_dirty |= ImGui::Checkbox("Ray caster", &m_rayCasting);
+	if (m_rayCasting) {
+		ImGui::SameLine();
+		m_dirty |= ImGui::Checkbox("Shadows", &m_rayCastSettings.shadows);
+		ImGui::SameLine();
+		ImGui::PushItemWidth(80);
+		m_dirty |= ImGui::SliderInt("Samples", &m_rayCastSettings.samples, 1, RayCaster::Settings::maxSamples);
+		ImGui::PopItemWidth();
+		double ms = m_rayCaster.milliseconds();
+		ImGui::Text("%d / %d tiles, %.0f ms, %.2f Mrays/s", m_rayCaster.tilesDone(), m_rayCaster.tileCount(),
+			ms, ms > 0 ? m_rayCaster.rays() / (ms * 1000.0) : 0.0);
+	}
+
+	// only redraw on input or changes unless benchmarking
+	ImGui::Checkbox("Continuous rendering", &m_continuousRendering);
+	ImGui::SameLine();
+	ImGui::Checkbox("Profiler", &m_showProfiler);
+	ImGui::SameLine();
+	renderTraceGUI();
 
 	// finish creating window
 	ImGui::End();
+
+	// shader compile errors from hot reloading
+	renderShaderErrorGUI();
+
+	// profiler only records while its window is open
+	cgra::profiler::setEnabled(m_showProfiler);
+	if (m_showProfiler) cgra::profiler::renderGUI(&m_showProfiler);
+}
+
+// trace recording controls
+void Application::renderTraceGUI() {
+	bool tracing = cgra::trace::enabled();
+	if (ImGui::Checkbox("Trace", &tracing)) cgra::trace::setEnabled(tracing);
+	ImGui::SameLine();
+	if (ImGui::Button("Dump trace")) {
+		cgra::trace::dump("trace.json");
+	}
+	ImGui::SameLine();
+	ImGui::Text("%d events", int(cgra::trace::eventCount()));
+}
+
+
+// compile and link errors from the last shader reload, until fixed
+void Application::renderShaderErrorGUI() {
+	vector<shader_reloader::program_error> errors = m_shaderReloader.errors();
+	if (errors.empty()) return;
+
+	ImGui::SetNextWindowPos(ImVec2(5, 310), ImGuiSetCond_Once);
+	ImGui::SetNextWindowSize(ImVec2(500, 200), ImGuiSetCond_Once);
+	ImGui::Begin("Shader errors", 0);
+	ImGui::TextWrapped("Still using the last program that built. Fix the shader and save to retry.");
+	for (auto &error : errors) {
+		ImGui::Separator();
+		ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s", error.name.c_str());
+		ImGui::TextUnformatted(error.log.c_str());
+	}
+	ImGui::End();
 }
 
 
@@ -148,6 +718,12 @@ void Application::keyCallback(int key, int scancode, int action, int mods) {
 }
 
 
+void Application::framebufferSizeCallback(int width, int height) {
+	m_windowsize = vec2(width, height);
+	m_dirty = true;
+}
+
+
 void Application::charCallback(unsigned int c) {
 	(void)c; // currently un-used
 }
\ No newline at end of file
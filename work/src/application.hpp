@@ -1,11 +1,27 @@
 
 #pragma once
 
+// std
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
 // glm
 #include <glm/glm.hpp>
 
 // project
 #include "opengl.hpp"
+#include "cgra/cgra_light_clusters.hpp"
+#include "cgra/cgra_occlusion.hpp"
+#include "cgra/cgra_render_queue.hpp"
+#include "cgra/cgra_shader.hpp"
+#include "cgra/cgra_shadow_cascades.hpp"
+#include "cgra/cgra_stream_buffer.hpp"
+#include "cgra/cgra_texture_loader.hpp"
+#include "cgra/cgra_thread_pool.hpp"
+#include "ray_caster.hpp"
+#include "soft_rasterizer.hpp"
 
 // class to load and draw an obj file
 #include "objfile.h"
@@ -14,25 +30,177 @@
 // Main application class
 class Application {
 private:
-	// window
-	glm::vec2 m_windowsize;
+	// window. The framebuffer size comes through framebufferSizeCallback
+	// (including the initial one) so rendering needs no GLFW calls
+	glm::vec2 m_windowsize = glm::vec2(0);
 	GLFWwindow *m_window;
 
-	// basic shader
-	GLuint m_shader;
+	// basic shader, with PHONG, CLUSTERED (point lights), SHADOWS and TEXTURED variants
+	cgra::shader_permutations m_shaders;
+	std::uint64_t m_phongFeature = 0;
+	std::uint64_t m_clusteredFeature = 0;
+	std::uint64_t m_shadowFeature = 0;
+	std::uint64_t m_texturedFeature = 0;
+	bool m_phong = false; // phong instead of lambert lighting
+
+	// the variants as PN triangle patches (GL 4.0 tessellation), curving
+	// coarse smooth meshes and splitting them finer the larger they are on
+	// screen. Drawn instead of m_shaders when m_tessellation is on
+	cgra::shader_permutations m_tessShaders;
+	bool m_tessellationSupported = false;
+	bool m_tessellation = false;
+	float m_tessEdgePixels = 16; // target tessellated edge length on screen
+
+	// variants compile in the background, drawing with the flat fallback
+	// program until they're ready
+	GLuint m_fallbackShader = 0;
+	bool m_asyncShaders = true;
+
+	// rebuilds m_shaders when their files change, wakes the event loop
+	cgra::shader_reloader m_shaderReloader{ []() { glfwPostEmptyEvent(); } };
 
 	ObjFile m_model; // model to load and draw
+	std::uint64_t m_modelVersion = 0; // bumped whenever m_model changes
 	glm::vec3 m_modelColor = glm::vec3(1.0f, 1.0f, 1.0f); // white as default
 	glm::vec3 m_lightDirection = glm::vec3(0.0f, -1.0f, -1.0f); // For directional light
 
+	// CPU occlusion culling
+	cgra::thread_pool m_pool; // workers for CPU side work
+	cgra::occlusion_culler m_culler{ m_pool };
+	bool m_occlusionCulling = true;
+	std::vector<char> m_visibleChunks; // one flag per model chunk
+	int m_visibleChunkCount = 0;
+
+	// the model's diffuse textures, decoded on the pool and streamed in
+	// over a few frames. One per model material, 0 for none. Small textures
+	// share atlas pages, so materials that only differed by texture can
+	// share a render queue material (the first material that looks the same)
+	cgra::texture_loader m_textures{ m_pool };
+	std::vector<GLuint> m_materialTextures;
+	std::vector<int> m_sharedMaterials;
+	bool m_textureAtlas = true;
+	unsigned m_textureBinds = 0; // by the last frame's materials
+	unsigned m_frameTextureBinds = 0; // counting this frame
+
+	// cascaded shadow maps for the directional light, cached between frames
+	cgra::shadow_cascades m_shadowCascades;
+	bool m_shadows = true;
+
+	// point lights, binned into clusters on the CPU every frame
+	std::vector<cgra::point_light> m_pointLights;
+	cgra::light_clusters m_lightClusters{ m_pool };
+	int m_pointLightCount = 0; // GUI slider
+
+	// draws are sorted by state and depth before submission
+	cgra::render_queue m_renderQueue{ &m_pool }; // records command lists on the pool
+	bool m_sortDraws = true;
+	int m_instances = 1; // copies of the model in a grid, with mixed materials and lighting
+
+	// a camera and the part of the window it draws to, one render queue pass each
+	struct View {
+		glm::mat4 proj;
+		glm::mat4 view;
+		glm::ivec4 viewport; // x, y, width, height
+		float farPlane; // depth is normalized to it for the sort keys
+	};
+	// perspective, top, front and side views instead of one. The views
+	// share one sort and submit, but that is a small part of the frame:
+	// each view still shades and rasterizes its own draws, so frame time
+	// grows about linearly with the number of views
+	bool m_quadView = false;
+
+	// FrameData for the shaders, a small slot of this ring each frame
+	std::unique_ptr<cgra::stream_buffer> m_frameData; // created by the first frame
+	GLint m_uniformAlignment = 256;
+
+	// event driven rendering
+	bool m_dirty = true; // state changed since the last frame
+	bool m_continuousRendering = false; // redraw every frame (for benchmarks)
+
+	// frame profiler overlay
+	bool m_showProfiler = false;
+
+	// CPU rasterizer, blitted to the window instead of drawing with GL
+	SoftRasterizer m_softRasterizer{ m_pool };
+	bool m_softwareRendering = false;
+
+	// texture the CPU renderers' images are uploaded to and blitted from
+	GLuint m_presentTexture = 0;
+	GLuint m_presentFramebuffer = 0; // read framebuffer for m_presentTexture
+	int m_presentWidth = 0;
+	int m_presentHeight = 0;
+
+	// reference ray caster, renders progressively over several frames
+	RayCaster m_rayCaster{ m_pool };
+	bool m_rayCasting = false;
+	RayCaster::Settings m_rayCastSettings;
+	bool m_rayCastMeshDirty = true; // BVH needs rebuilding
+	ShadingParams m_rayCastParams; // what the current ray cast was started with
+	RayCaster::Settings m_rayCastStarted;
+	int m_rayCastTilesShown = -1; // tiles done at the last upload
+	std::vector<unsigned char> m_rayCastPixels;
+
+	GLuint shaderVariant(std::uint64_t features);
+	GLuint tessellatedVariant(std::uint64_t features);
+	void setupShader(GLuint shader, const glm::mat4 &view, int width, int height);
+	std::vector<View> quadViews(const glm::mat4 &proj, const glm::mat4 &view, const cgra::aabb &scene, int width, int height) const;
+	ShadingParams shadingParams(const glm::mat4 &proj, const glm::mat4 &view) const;
+	void renderSoftware(const glm::mat4 &proj, const glm::mat4 &view, int width, int height);
+	void renderRayCast(const glm::mat4 &proj, const glm::mat4 &view, int width, int height);
+	void presentPixels(const unsigned char *pixels, int rowLength, int width, int height);
+
+	// GUI helpers
+	void renderTraceGUI();
+	void renderShaderErrorGUI();
+
 public:
 	// setup
 	Application(GLFWwindow *);
+	~Application();
 
 	// disable copy constructors (for safety)
 	Application(const Application&) = delete;
 	Application& operator=(const Application&) = delete;
 
+	// load and build a model, replacing the current one
+	bool loadModel(const std::string &filename);
+
+	// true if the next frame would look different from the last one
+	bool needsRedraw() const { return m_dirty || m_continuousRendering || m_shaderReloader.pending() || m_shaders.pending() > 0 || m_tessShaders.pending() > 0 || m_textures.busy() || (m_rayCasting && m_rayCastTilesShown != m_rayCaster.tileCount()); }
+	void setContinuousRendering(bool continuous) { m_continuousRendering = continuous; }
+
+	// wait for shader variants to build instead of drawing with a fallback
+	void setAsyncShaders(bool async) { m_asyncShaders = async; }
+
+	// replace the point lights with count lamps around the model
+	void setPointLights(int count);
+
+	// draw count copies of the model, and whether to sort the draws
+	void setInstances(int count) { m_instances = std::max(1, count); m_dirty = true; }
+	void setSortDraws(bool sort) { m_sortDraws = sort; m_dirty = true; }
+
+	// draw as PN triangle patches where GL 4.0 tessellation is available
+	void setTessellation(bool tessellate) { m_tessellation = tessellate; m_dirty = true; }
+	bool tessellationSupported() const { return m_tessellationSupported; }
+
+	// split the window into perspective, top, front and side views
+	void setQuadView(bool quad) { m_quadView = quad; m_dirty = true; }
+	const cgra::render_queue::stats & renderStats() const { return m_renderQueue.last_stats(); }
+
+	// textures still decoding or streaming in, and how they're going
+	bool loadingTextures() const { return m_textures.busy(); }
+	const cgra::texture_loader::stats & textureStats() const { return m_textures.last_stats(); }
+
+	// block compress textures loaded from now on (on by default)
+	void setTextureCompression(bool compress) { m_textures.set_compression(compress); }
+
+	// pack small textures of models loaded from now on into atlas pages (on by default)
+	void setTextureAtlas(bool atlas) { m_textureAtlas = atlas; }
+	unsigned textureBinds() const { return m_textureBinds; }
+
+	// render with the CPU rasterizer instead of OpenGL
+	void setSoftwareRendering(bool software) { m_softwareRendering = software; m_dirty = true; }
+
 	// rendering callbacks (every frame)
 	void render();
 	void renderGUI();
@@ -43,4 +211,5 @@ public:
 	void scrollCallback(double xoffset, double yoffset);
 	void keyCallback(int key, int scancode, int action, int mods);
 	void charCallback(unsigned int c);
+	void framebufferSizeCallback(int width, int height);
 };
\ No newline at end of file
@@ -0,0 +1,190 @@
+// std
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// glm
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+// project
+#include "batch_renderer.hpp"
+#include "frame_data.hpp"
+#include "objfile.h"
+#include "cgra/cgra_bounded_queue.hpp"
+#include "cgra/cgra_offscreen.hpp"
+#include "cgra/cgra_shader.hpp"
+#include "cgra/cgra_stream_buffer.hpp"
+#include "cgra/cgra_trace.hpp"
+
+
+using namespace std;
+using namespace cgra;
+using namespace glm;
+namespace fs = std::filesystem;
+
+
+namespace {
+
+	// parsed mesh waiting for the GL thread
+	struct ParsedMesh {
+		string name;
+		unique_ptr<ObjFile> model;
+	};
+
+	// rendered pixels waiting to be encoded
+	struct RenderedImage {
+		string path;
+		vector<unsigned char> pixels;
+	};
+
+	unsigned threadCount(unsigned requested) {
+		return requested > 0 ? requested : std::max(1u, thread::hardware_concurrency());
+	}
+}
+
+
+BatchRenderer::BatchRenderer(GLFWwindow *window, int width, int height, unsigned parseThreads, unsigned encodeThreads)
+	: m_window(window), m_width(width), m_height(height),
+	m_parseThreads(threadCount(parseThreads)), m_encodeThreads(threadCount(encodeThreads)) {
+	FrameData::setBlockBindings();
+	shader_builder sb;
+	sb.set_shader(GL_VERTEX_SHADER, CGRA_SRCDIR + std::string("//res//shaders//default_vert.glsl"));
+	sb.set_shader(GL_FRAGMENT_SHADER, CGRA_SRCDIR + std::string("//res//shaders//default_frag.glsl"));
+	m_shader = sb.build();
+}
+
+
+BatchRenderer::~BatchRenderer() {
+	glDeleteProgram(m_shader);
+}
+
+
+int BatchRenderer::run(const std::string &inputDir, const std::string &outputDir) {
+	// collect the work up front so workers only need an atomic counter
+	vector<fs::path> files;
+	error_code ec;
+	for (const auto &entry : fs::directory_iterator(inputDir, ec)) {
+		if (entry.is_regular_file() && entry.path().extension() == ".obj") {
+			files.push_back(entry.path());
+		}
+	}
+	if (ec) {
+		cerr << "Error: Could not read directory " << inputDir << endl;
+		return 0;
+	}
+	sort(files.begin(), files.end());
+	fs::create_directories(outputDir, ec);
+	cout << "Rendering " << files.size() << " thumbnails with " << m_parseThreads << " parse and " << m_encodeThreads << " encode threads" << endl;
+
+	auto start = chrono::steady_clock::now();
+
+	// a couple of items per worker is enough to keep every stage busy
+	bounded_queue<ParsedMesh> parsed(m_parseThreads * 2);
+	bounded_queue<RenderedImage> rendered(m_encodeThreads * 2);
+
+	// stage 1: parse and build CPU mesh data
+	atomic<size_t> nextFile{ 0 };
+	atomic<unsigned> parsersLeft{ m_parseThreads };
+	vector<thread> parsers;
+	for (unsigned t = 0; t < m_parseThreads; t++) {
+		parsers.emplace_back([&, t]() {
+			trace::setThreadName("parse " + to_string(t));
+			size_t i;
+			while ((i = nextFile++) < files.size()) {
+				ParsedMesh mesh;
+				mesh.name = files[i].stem().string();
+				mesh.model.reset(new ObjFile());
+				if (!mesh.model->loadOBJ(files[i].string())) {
+					cerr << "Error: Unable to load model " << files[i] << endl;
+					continue;
+				}
+				mesh.model->buildMesh();
+				if (!parsed.push(move(mesh))) break;
+			}
+			// last parser out closes the queue so the renderer can finish
+			if (--parsersLeft == 0) parsed.close();
+		});
+	}
+
+	// stage 3: encode PNGs
+	atomic<int> written{ 0 };
+	vector<thread> encoders;
+	for (unsigned t = 0; t < m_encodeThreads; t++) {
+		encoders.emplace_back([&, t]() {
+			trace::setThreadName("encode " + to_string(t));
+			RenderedImage image;
+			while (rendered.pop(image)) {
+				CGRA_TRACE_SCOPE("write_png");
+				if (write_png(image.path, m_width, m_height, image.pixels)) written++;
+			}
+		});
+	}
+
+	// stage 2: render on this thread, which owns the GL context
+	offscreen_target target(m_width, m_height);
+	target.bind();
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(GL_LESS);
+	glUseProgram(m_shader);
+	glUniform3fv(glGetUniformLocation(m_shader, "uColor"), 1, value_ptr(vec3(1)));
+
+	// FrameData then ObjectData for each image, in one slot of a ring
+	GLint alignment = 256;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	const GLsizeiptr objectOffset = (GLsizeiptr(sizeof(FrameData)) + alignment - 1) / alignment * alignment;
+	stream_buffer uniforms(GL_UNIFORM_BUFFER, objectOffset + sizeof(mat4));
+	ShadingParams shading;
+	shading.lightDirection = normalize(vec3(0.0f, -1.0f, -1.0f));
+
+	const float fovy = 1.f;
+	ParsedMesh mesh;
+	while (parsed.pop(mesh)) {
+		CGRA_TRACE_SCOPE("BatchRenderer::render");
+		mesh.model->upload();
+
+		// frame the bounding sphere from slightly above and to the side
+		const aabb &bounds = mesh.model->bounds();
+		vec3 center = (bounds.min + bounds.max) * 0.5f;
+		float radius = std::max(length(bounds.max - bounds.min) * 0.5f, 1e-4f);
+		float distance = radius / sin(fovy * 0.5f);
+		vec3 eye = center + normalize(vec3(0.6f, 0.5f, 1.0f)) * distance;
+		mat4 view = lookAt(eye, center, vec3(0, 1, 0));
+		mat4 proj = perspective(fovy, float(m_width) / m_height, std::max(distance - radius * 1.1f, distance * 0.01f), distance + radius * 1.1f);
+
+		glClearColor(0.3f, 0.3f, 0.4f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		shading.projection = proj;
+		FrameData frameData(shading);
+		stream_buffer::allocation block = uniforms.allocate(objectOffset + sizeof(mat4), alignment);
+		memcpy(block.data, &frameData, sizeof(FrameData));
+		memcpy(static_cast<char *>(block.data) + objectOffset, value_ptr(view), sizeof(mat4));
+		uniforms.flush(block);
+		glBindBufferRange(GL_UNIFORM_BUFFER, FrameData::binding, uniforms.buffer(), block.offset, sizeof(FrameData));
+		glBindBufferRange(GL_UNIFORM_BUFFER, render_queue::object_binding, uniforms.buffer(), block.offset + objectOffset, sizeof(mat4));
+		mesh.model->draw();
+		uniforms.end_frame();
+
+		RenderedImage image;
+		image.path = (fs::path(outputDir) / (mesh.name + ".png")).string();
+		image.pixels = target.read_pixels();
+		mesh.model.reset(); // free GL and CPU data before blocking on the encoders
+		rendered.push(move(image));
+	}
+	rendered.close();
+
+	for (auto &t : parsers) t.join();
+	for (auto &t : encoders) t.join();
+	offscreen_target::unbind();
+
+	chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+	cout << "Wrote " << written << " thumbnails in " << elapsed.count() << " s (";
+	cout << (elapsed.count() > 0 ? written / elapsed.count() : 0) << " per second)" << endl;
+	return written;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+// std
+#include <string>
+
+// project
+#include "opengl.hpp"
+
+
+// Renders a thumbnail of every OBJ file in a directory.
+// Three stages connected by bounded queues run at the same time:
+// worker threads parse files and build CPU mesh data, the GL thread
+// uploads, auto-frames and renders each mesh, and more worker threads
+// encode the read back pixels to PNG. The queues keep memory bounded
+// and let the renderer keep working while files are read and written.
+class BatchRenderer {
+private:
+	GLFWwindow *m_window;
+	GLuint m_shader = 0;
+	int m_width;
+	int m_height;
+	unsigned m_parseThreads;
+	unsigned m_encodeThreads;
+
+public:
+	// window must have a current GL context, thread counts of zero
+	// mean one per hardware thread
+	BatchRenderer(GLFWwindow *window, int width, int height, unsigned parseThreads = 0, unsigned encodeThreads = 0);
+
+	// disable copy constructors (for safety)
+	BatchRenderer(const BatchRenderer&) = delete;
+	BatchRenderer& operator=(const BatchRenderer&) = delete;
+
+	~BatchRenderer();
+
+	// render every .obj in inputDir to outputDir/<name>.png
+	// returns the number of thumbnails written
+	int run(const std::string &inputDir, const std::string &outputDir);
+};
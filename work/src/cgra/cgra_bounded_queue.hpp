@@ -0,0 +1,65 @@
+#pragma once
+
+// std
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+
+namespace cgra {
+
+	// thread safe FIFO with a fixed capacity, used to connect pipeline
+	// stages so a fast producer can't run arbitrarily far ahead
+	template <typename T>
+	class bounded_queue {
+	private:
+		std::deque<T> m_items;
+		std::size_t m_capacity;
+		bool m_closed = false;
+		std::mutex m_mutex;
+		std::condition_variable m_not_empty;
+		std::condition_variable m_not_full;
+
+	public:
+		explicit bounded_queue(std::size_t capacity) : m_capacity(capacity > 0 ? capacity : 1) { }
+
+		// remove copy ctors
+		bounded_queue(const bounded_queue &) = delete;
+		bounded_queue & operator=(const bounded_queue &) = delete;
+
+		// blocks while full. returns false (and drops item) if the queue is closed
+		bool push(T item) {
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_not_full.wait(lock, [this]() { return m_closed || m_items.size() < m_capacity; });
+			if (m_closed) return false;
+			m_items.push_back(std::move(item));
+			lock.unlock();
+			m_not_empty.notify_one();
+			return true;
+		}
+
+		// blocks while empty. returns false once the queue is closed and drained
+		bool pop(T &item) {
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_not_empty.wait(lock, [this]() { return m_closed || !m_items.empty(); });
+			if (m_items.empty()) return false;
+			item = std::move(m_items.front());
+			m_items.pop_front();
+			lock.unlock();
+			m_not_full.notify_one();
+			return true;
+		}
+
+		// no more pushes, pops drain what is left
+		void close() {
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_closed = true;
+			}
+			m_not_empty.notify_all();
+			m_not_full.notify_all();
+		}
+	};
+
+}
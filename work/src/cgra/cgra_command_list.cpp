@@ -0,0 +1,183 @@
+// std
+#include <cstring>
+
+// glm
+#include <glm/gtc/type_ptr.hpp>
+
+// project
+#include "cgra_command_list.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+
+namespace cgra {
+
+	namespace {
+		struct draw_payload {
+			GLenum mode;
+			GLsizei count;
+			uint32_t first;
+		};
+
+		struct multi_draw_payload {
+			GLenum mode;
+			GLsizei draw_count;
+			// followed by draw_count GLsizei counts, then draw_count uint32_t firsts
+		};
+
+		struct buffer_range_payload {
+			GLintptr offset;
+			GLsizeiptr size;
+			GLenum target;
+			GLuint index;
+			GLuint buffer;
+		};
+
+		struct call_payload {
+			const command_list::callback *f;
+			GLuint argument;
+		};
+
+		constexpr size_t padded(size_t size) { return (size + 7) & ~size_t(7); }
+	}
+
+
+	void * command_list::push(op type, size_t size) {
+		size_t at = m_arena.size();
+		m_arena.resize(at + sizeof(header) + padded(size));
+		header h = { type, uint32_t(size) };
+		memcpy(&m_arena[at], &h, sizeof(header));
+		m_commands++;
+		return &m_arena[at + sizeof(header)];
+	}
+
+
+	void command_list::use_program(GLuint program) {
+		memcpy(push(op::use_program, sizeof(program)), &program, sizeof(program));
+	}
+
+
+	void command_list::bind_vertex_array(GLuint vao) {
+		memcpy(push(op::bind_vertex_array, sizeof(vao)), &vao, sizeof(vao));
+	}
+
+
+	void command_list::uniform(GLint location, const mat4 &value) {
+		unsigned char *p = static_cast<unsigned char *>(push(op::uniform_matrix4, sizeof(GLint) + sizeof(mat4)));
+		memcpy(p, &location, sizeof(GLint));
+		memcpy(p + sizeof(GLint), value_ptr(value), sizeof(mat4));
+	}
+
+
+	void command_list::uniform(GLint location, const vec3 &value) {
+		unsigned char *p = static_cast<unsigned char *>(push(op::uniform_vec3, sizeof(GLint) + sizeof(vec3)));
+		memcpy(p, &location, sizeof(GLint));
+		memcpy(p + sizeof(GLint), value_ptr(value), sizeof(vec3));
+	}
+
+
+	void command_list::bind_buffer_range(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size) {
+		buffer_range_payload b = { offset, size, target, index, buffer };
+		memcpy(push(op::bind_buffer_range, sizeof(b)), &b, sizeof(b));
+	}
+
+
+	void command_list::draw_elements(GLenum mode, GLsizei count, uint32_t first) {
+		draw_payload d = { mode, count, first };
+		memcpy(push(op::draw_elements, sizeof(d)), &d, sizeof(d));
+	}
+
+
+	void command_list::multi_draw_elements(GLenum mode, const GLsizei *counts, const uint32_t *firsts, GLsizei draw_count) {
+		multi_draw_payload d = { mode, draw_count };
+		unsigned char *p = static_cast<unsigned char *>(push(op::multi_draw_elements, sizeof(d) + draw_count * (sizeof(GLsizei) + sizeof(uint32_t))));
+		memcpy(p, &d, sizeof(d));
+		memcpy(p + sizeof(d), counts, draw_count * sizeof(GLsizei));
+		memcpy(p + sizeof(d) + draw_count * sizeof(GLsizei), firsts, draw_count * sizeof(uint32_t));
+	}
+
+
+	void command_list::call(const callback *f, GLuint argument) {
+		call_payload c = { f, argument };
+		memcpy(push(op::call, sizeof(c)), &c, sizeof(c));
+	}
+
+
+	void command_list::replay() const {
+		const unsigned char *p = m_arena.data();
+		const unsigned char *end = p + m_arena.size();
+		while (p < end) {
+			header h;
+			memcpy(&h, p, sizeof(header));
+			const unsigned char *payload = p + sizeof(header);
+			p = payload + padded(h.size);
+
+			switch (h.type) {
+			case op::use_program: {
+				GLuint program;
+				memcpy(&program, payload, sizeof(program));
+				glUseProgram(program);
+				break;
+			}
+			case op::bind_vertex_array: {
+				GLuint vao;
+				memcpy(&vao, payload, sizeof(vao));
+				glBindVertexArray(vao);
+				break;
+			}
+			case op::uniform_matrix4: {
+				GLint location;
+				float value[16];
+				memcpy(&location, payload, sizeof(GLint));
+				memcpy(value, payload + sizeof(GLint), sizeof(value));
+				glUniformMatrix4fv(location, 1, false, value);
+				break;
+			}
+			case op::uniform_vec3: {
+				GLint location;
+				float value[3];
+				memcpy(&location, payload, sizeof(GLint));
+				memcpy(value, payload + sizeof(GLint), sizeof(value));
+				glUniform3fv(location, 1, value);
+				break;
+			}
+			case op::bind_buffer_range: {
+				buffer_range_payload b;
+				memcpy(&b, payload, sizeof(b));
+				glBindBufferRange(b.target, b.index, b.buffer, b.offset, b.size);
+				break;
+			}
+			case op::draw_elements: {
+				draw_payload d;
+				memcpy(&d, payload, sizeof(d));
+				glDrawElements(d.mode, d.count, GL_UNSIGNED_INT, (const GLvoid *)(sizeof(unsigned int) * d.first));
+				break;
+			}
+			case op::multi_draw_elements: {
+				multi_draw_payload d;
+				memcpy(&d, payload, sizeof(d));
+				const unsigned char *counts = payload + sizeof(d);
+				const unsigned char *firsts = counts + d.draw_count * sizeof(GLsizei);
+				m_offsets.resize(d.draw_count);
+				for (GLsizei i = 0; i < d.draw_count; i++) {
+					uint32_t first;
+					memcpy(&first, firsts + i * sizeof(uint32_t), sizeof(first));
+					m_offsets[i] = (const GLvoid *)(sizeof(unsigned int) * first);
+				}
+				// counts are 4 byte aligned in the arena, which is all GLsizei needs
+				glMultiDrawElements(d.mode, reinterpret_cast<const GLsizei *>(counts), GL_UNSIGNED_INT, m_offsets.data(), d.draw_count);
+				break;
+			}
+			case op::call: {
+				call_payload c;
+				memcpy(&c, payload, sizeof(c));
+				(*c.f)(c.argument);
+				break;
+			}
+			}
+		}
+	}
+
+}
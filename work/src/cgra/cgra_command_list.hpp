@@ -0,0 +1,86 @@
+#pragma once
+
+// std
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include <opengl.hpp>
+
+
+namespace cgra {
+
+	// deferred list of GL state changes and draws. Recording is plain CPU
+	// work into an arena that keeps its capacity between frames, so any
+	// thread can record a list (without a GL context) and the GL thread
+	// replays it later. Uniform locations have to be looked up beforehand
+	// on the GL thread.
+	class command_list {
+	public:
+		// GL work that doesn't fit a command (per program uniforms etc),
+		// must outlive replay()
+		using callback = std::function<void(GLuint)>;
+
+	private:
+		enum class op : std::uint32_t {
+			use_program,
+			bind_vertex_array,
+			uniform_matrix4,
+			uniform_vec3,
+			bind_buffer_range,
+			draw_elements,
+			multi_draw_elements,
+			call
+		};
+
+		// every command is a header followed by its payload, padded to 8 bytes
+		struct header {
+			op type;
+			std::uint32_t size; // payload bytes
+		};
+
+		std::vector<unsigned char> m_arena;
+		std::size_t m_commands = 0;
+
+		// offsets for glMultiDrawElements, built while replaying
+		mutable std::vector<const GLvoid *> m_offsets;
+
+		void * push(op type, std::size_t size);
+
+	public:
+		command_list() { }
+
+		// empty the list, keeping the arena's memory
+		void clear() { m_arena.clear(); m_commands = 0; }
+
+		void use_program(GLuint program);
+		void bind_vertex_array(GLuint vao);
+		void uniform(GLint location, const glm::mat4 &value);
+		void uniform(GLint location, const glm::vec3 &value);
+
+		// glBindBufferRange, eg. a uniform block's slice of a stream_buffer
+		void bind_buffer_range(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+
+		// glDrawElements with GL_UNSIGNED_INT indices starting at first
+		void draw_elements(GLenum mode, GLsizei count, std::uint32_t first);
+
+		// glMultiDrawElements, counts and firsts are copied into the list
+		void multi_draw_elements(GLenum mode, const GLsizei *counts, const std::uint32_t *firsts, GLsizei draw_count);
+
+		// calls (*f)(argument) when replayed
+		void call(const callback *f, GLuint argument);
+
+		// issue every command in order, on the GL thread
+		void replay() const;
+
+		bool empty() const { return m_commands == 0; }
+		std::size_t commands() const { return m_commands; }
+		std::size_t bytes() const { return m_arena.size(); }
+	};
+
+}
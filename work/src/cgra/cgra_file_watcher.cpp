@@ -0,0 +1,179 @@
+// std
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+
+// linux
+#if defined(__linux__)
+#define CGRA_HAVE_INOTIFY
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// project
+#include "cgra_file_watcher.hpp"
+#include "cgra_trace.hpp"
+
+
+namespace fs = std::filesystem;
+
+
+namespace cgra {
+
+	file_watcher::file_watcher(std::function<void()> on_change) : m_on_change(std::move(on_change)) {
+#ifdef CGRA_HAVE_INOTIFY
+		m_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		m_wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (m_inotify < 0 || m_wake < 0) {
+			std::cerr << "Warning: inotify unavailable, polling for file changes instead" << std::endl;
+			if (m_inotify >= 0) close(m_inotify);
+			if (m_wake >= 0) close(m_wake);
+			m_inotify = m_wake = -1;
+		}
+#endif
+		m_thread = std::thread([this]() {
+			trace::setThreadName("file watcher");
+			if (m_inotify >= 0) run_inotify();
+			else run_polling();
+		});
+	}
+
+
+	file_watcher::~file_watcher() {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_stop_cv.notify_all();
+#ifdef CGRA_HAVE_INOTIFY
+		if (m_wake >= 0) {
+			uint64_t one = 1;
+			(void)!write(m_wake, &one, sizeof(one));
+		}
+#endif
+		m_thread.join();
+#ifdef CGRA_HAVE_INOTIFY
+		if (m_inotify >= 0) close(m_inotify);
+		if (m_wake >= 0) close(m_wake);
+#endif
+	}
+
+
+	std::string file_watcher::normalize(const std::string &filename) {
+		std::error_code ec;
+		fs::path path = fs::absolute(filename, ec);
+		if (ec) path = filename;
+		return path.lexically_normal().string();
+	}
+
+
+	void file_watcher::watch(const std::string &filename) {
+		fs::path path = normalize(filename);
+		std::string directory = path.parent_path().string();
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		bool new_directory = m_directories.find(directory) == m_directories.end();
+		m_directories[directory].insert(path.filename().string());
+		if (m_inotify >= 0) {
+			if (new_directory) add_directory_watch(directory);
+		}
+		else {
+			m_times[path.string()] = modified_time(path.string());
+		}
+	}
+
+
+	std::vector<std::string> file_watcher::take_changed() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::vector<std::string> changed(m_changed.begin(), m_changed.end());
+		m_changed.clear();
+		m_pending = false;
+		return changed;
+	}
+
+
+	void file_watcher::add_directory_watch(const std::string &directory) {
+#ifdef CGRA_HAVE_INOTIFY
+		// finished writes, and files renamed into place
+		int wd = inotify_add_watch(m_inotify, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+		if (wd < 0) {
+			std::cerr << "Warning: Could not watch " << directory << " for changes" << std::endl;
+			return;
+		}
+		m_watch_directories[wd] = directory;
+#else
+		(void)directory;
+#endif
+	}
+
+
+	long long file_watcher::modified_time(const std::string &path) {
+		std::error_code ec;
+		auto time = fs::last_write_time(path, ec);
+		return ec ? -1 : (long long)time.time_since_epoch().count();
+	}
+
+
+	void file_watcher::run_inotify() {
+#ifdef CGRA_HAVE_INOTIFY
+		// inotify_event is variable length, read as many as fit
+		alignas(inotify_event) char buffer[4096];
+		pollfd fds[2] = { { m_inotify, POLLIN, 0 }, { m_wake, POLLIN, 0 } };
+		while (!m_stop) {
+			if (poll(fds, 2, -1) < 0) continue;
+			if (fds[1].revents & POLLIN) {
+				uint64_t count;
+				(void)!read(m_wake, &count, sizeof(count));
+			}
+			if (!(fds[0].revents & POLLIN)) continue;
+
+			bool changed = false;
+			ssize_t length;
+			while ((length = read(m_inotify, buffer, sizeof(buffer))) > 0) {
+				std::lock_guard<std::mutex> lock(m_mutex);
+				for (char *p = buffer; p < buffer + length; p += sizeof(inotify_event) + reinterpret_cast<inotify_event *>(p)->len) {
+					const inotify_event *event = reinterpret_cast<inotify_event *>(p);
+					if (event->len == 0) continue;
+					auto directory = m_watch_directories.find(event->wd);
+					if (directory == m_watch_directories.end()) continue;
+					const std::set<std::string> &names = m_directories[directory->second];
+					if (names.count(event->name)) {
+						m_changed.insert((fs::path(directory->second) / event->name).string());
+						changed = true;
+					}
+				}
+			}
+			if (changed) {
+				m_pending = true;
+				if (m_on_change) m_on_change();
+			}
+		}
+#endif
+	}
+
+
+	void file_watcher::run_polling() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (!m_stop) {
+			m_stop_cv.wait_for(lock, std::chrono::milliseconds(250));
+			bool changed = false;
+			for (auto &entry : m_times) {
+				long long time = modified_time(entry.first);
+				if (time != entry.second && time != -1) {
+					entry.second = time;
+					m_changed.insert(entry.first);
+					changed = true;
+				}
+			}
+			if (changed) {
+				m_pending = true;
+				lock.unlock();
+				if (m_on_change) m_on_change();
+				lock.lock();
+			}
+		}
+	}
+
+}
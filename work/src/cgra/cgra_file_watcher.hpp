@@ -0,0 +1,69 @@
+#pragma once
+
+// std
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace cgra {
+
+	// watches files for changes on a background thread. Uses inotify on
+	// Linux, watching the parent directory so editors that save by writing
+	// a new file and renaming it over the old one are still seen. Other
+	// platforms poll modification times a few times a second.
+	class file_watcher {
+	private:
+		std::function<void()> m_on_change;
+		std::thread m_thread;
+		mutable std::mutex m_mutex;
+		std::map<std::string, std::set<std::string>> m_directories; // directory -> watched file names
+		std::set<std::string> m_changed; // full paths changed since take_changed()
+		std::atomic<bool> m_pending{ false };
+		std::atomic<bool> m_stop{ false };
+		std::condition_variable m_stop_cv; // wakes the polling thread on shutdown
+
+		// inotify instance, and an eventfd to wake the thread for new
+		// watches and shutdown (unused when polling)
+		int m_inotify = -1;
+		int m_wake = -1;
+		std::map<int, std::string> m_watch_directories; // watch descriptor -> directory
+
+		// last modification times, when polling
+		std::map<std::string, long long> m_times;
+
+		void run_inotify();
+		void run_polling();
+		void add_directory_watch(const std::string &directory);
+		long long modified_time(const std::string &path);
+
+	public:
+		// on_change is called from the watcher thread after a change
+		// (eg. to wake an event loop), it must be thread safe
+		explicit file_watcher(std::function<void()> on_change = nullptr);
+		~file_watcher();
+
+		// remove copy ctors
+		file_watcher(const file_watcher &) = delete;
+		file_watcher & operator=(const file_watcher &) = delete;
+
+		// start watching a file, it doesn't need to exist yet
+		void watch(const std::string &filename);
+
+		// true if anything changed since the last take_changed()
+		bool pending() const { return m_pending.load(); }
+
+		// normalized paths of the files changed since the last call
+		std::vector<std::string> take_changed();
+
+		// the form paths are reported in, for comparing with take_changed()
+		static std::string normalize(const std::string &filename);
+	};
+
+}
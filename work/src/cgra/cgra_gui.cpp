@@ -1,9 +1,14 @@
 
 // std
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
 
 // project
 #include "cgra_gui.hpp"
+#include "cgra_stream_buffer.hpp"
 
 
 using namespace std;
@@ -22,7 +27,28 @@ namespace cgra {
 		int          g_shaderHandle = 0, g_vertHandle = 0, g_fragHandle = 0;
 		int          g_attribLocationTex = 0, g_attribLocationProjMtx = 0;
 		int          g_attribLocationPosition = 0, g_attribLocationUV = 0, g_attribLocationColor = 0;
-		unsigned int g_vboHandle = 0, g_vaoHandle = 0, g_elementsHandle = 0;
+		unsigned int g_vaoHandle = 0;
+
+		// every draw list's vertices and indices are streamed through one
+		// ring buffer, in one allocation per frame
+		std::unique_ptr<stream_buffer> g_streamBuffer;
+
+		// clipboard when ImGui runs off the main thread, see useDeferredClipboard
+		bool         g_deferredClipboard = false;
+		std::string  g_pasteText; // ImGui's thread only
+		std::mutex   g_copiedMutex;
+		std::string  g_copiedText;
+		bool         g_copied = false;
+
+	#define OFFSETOF(TYPE, ELEMENT) ((size_t)&(((TYPE *)0)->ELEMENT))
+		// point the vertex attributes at vertices starting at offset in the stream buffer
+		void setVertexAttributes(GLintptr offset) {
+			glBindBuffer(GL_ARRAY_BUFFER, g_streamBuffer->buffer());
+			glVertexAttribPointer(g_attribLocationPosition, 2, GL_FLOAT, GL_FALSE, sizeof(ImDrawVert), (GLvoid*)(offset + OFFSETOF(ImDrawVert, pos)));
+			glVertexAttribPointer(g_attribLocationUV, 2, GL_FLOAT, GL_FALSE, sizeof(ImDrawVert), (GLvoid*)(offset + OFFSETOF(ImDrawVert, uv)));
+			glVertexAttribPointer(g_attribLocationColor, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(ImDrawVert), (GLvoid*)(offset + OFFSETOF(ImDrawVert, col)));
+		}
+	#undef OFFSETOF
 
 
 		void createFontsTexture() {
@@ -101,21 +127,15 @@ namespace cgra {
 			g_attribLocationUV = glGetAttribLocation(g_shaderHandle, "vUV");
 			g_attribLocationColor = glGetAttribLocation(g_shaderHandle, "vColor");
 
-			glGenBuffers(1, &g_vboHandle);
-			glGenBuffers(1, &g_elementsHandle);
+			// 256KB a frame is plenty for typical GUIs, it grows if needed
+			g_streamBuffer.reset(new stream_buffer(GL_ARRAY_BUFFER, 256 * 1024));
 
 			glGenVertexArrays(1, &g_vaoHandle);
 			glBindVertexArray(g_vaoHandle);
-			glBindBuffer(GL_ARRAY_BUFFER, g_vboHandle);
 			glEnableVertexAttribArray(g_attribLocationPosition);
 			glEnableVertexAttribArray(g_attribLocationUV);
 			glEnableVertexAttribArray(g_attribLocationColor);
-
-		#define OFFSETOF(TYPE, ELEMENT) ((size_t)&(((TYPE *)0)->ELEMENT))
-			glVertexAttribPointer(g_attribLocationPosition, 2, GL_FLOAT, GL_FALSE, sizeof(ImDrawVert), (GLvoid*)OFFSETOF(ImDrawVert, pos));
-			glVertexAttribPointer(g_attribLocationUV, 2, GL_FLOAT, GL_FALSE, sizeof(ImDrawVert), (GLvoid*)OFFSETOF(ImDrawVert, uv));
-			glVertexAttribPointer(g_attribLocationColor, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(ImDrawVert), (GLvoid*)OFFSETOF(ImDrawVert, col));
-		#undef OFFSETOF
+			setVertexAttributes(0);
 
 			createFontsTexture();
 
@@ -130,9 +150,8 @@ namespace cgra {
 
 		void invalidateDeviceObjects() {
 			if (g_vaoHandle) glDeleteVertexArrays(1, &g_vaoHandle);
-			if (g_vboHandle) glDeleteBuffers(1, &g_vboHandle);
-			if (g_elementsHandle) glDeleteBuffers(1, &g_elementsHandle);
-			g_vaoHandle = g_vboHandle = g_elementsHandle = 0;
+			g_vaoHandle = 0;
+			g_streamBuffer.reset();
 
 			if (g_shaderHandle && g_vertHandle) glDetachShader(g_shaderHandle, g_vertHandle);
 			if (g_vertHandle) glDeleteShader(g_vertHandle);
@@ -156,13 +175,15 @@ namespace cgra {
 
 		void renderDrawLists(ImDrawData* draw_data) {
 			// avoid rendering when minimized, scale coordinates for
-			// retina displays (screen coordinates != framebuffer coordinates)
+			// retina displays (screen coordinates != framebuffer coordinates).
+			// Clip rects are scaled as they're used rather than in place, so
+			// the same draw data can be drawn again by redraw()
 			ImGuiIO& io = ImGui::GetIO();
 			int fb_width = (int)(io.DisplaySize.x * io.DisplayFramebufferScale.x);
 			int fb_height = (int)(io.DisplaySize.y * io.DisplayFramebufferScale.y);
-			if (fb_width == 0 || fb_height == 0)
+			if (fb_width == 0 || fb_height == 0 || draw_data->TotalVtxCount == 0)
 				return;
-			draw_data->ScaleClipRects(io.DisplayFramebufferScale);
+			const ImVec2 scale = io.DisplayFramebufferScale;
 
 			// backup GL state
 			GLenum last_active_texture; glGetIntegerv(GL_ACTIVE_TEXTURE, (GLint*)&last_active_texture);
@@ -206,32 +227,58 @@ namespace cgra {
 			glUseProgram(g_shaderHandle);
 			glUniform1i(g_attribLocationTex, 0);
 			glUniformMatrix4fv(g_attribLocationProjMtx, 1, GL_FALSE, &ortho_projection[0][0]);
-			glBindVertexArray(g_vaoHandle);
 
+			// all the vertices then all the indices, each list's indices stay
+			// relative to its own vertices and are drawn with a base vertex
+			const GLsizeiptr vtx_size = (GLsizeiptr)draw_data->TotalVtxCount * sizeof(ImDrawVert);
+			const GLsizeiptr idx_size = (GLsizeiptr)draw_data->TotalIdxCount * sizeof(ImDrawIdx);
+			stream_buffer::allocation upload = g_streamBuffer->allocate(vtx_size + idx_size, sizeof(ImDrawVert));
+			ImDrawVert* vtx_dst = (ImDrawVert*)upload.data;
+			ImDrawIdx* idx_dst = (ImDrawIdx*)(vtx_dst + draw_data->TotalVtxCount);
 			for (int n = 0; n < draw_data->CmdListsCount; n++) {
 				const ImDrawList* cmd_list = draw_data->CmdLists[n];
-				const ImDrawIdx* idx_buffer_offset = 0;
+				memcpy(vtx_dst, cmd_list->VtxBuffer.Data, cmd_list->VtxBuffer.Size * sizeof(ImDrawVert));
+				memcpy(idx_dst, cmd_list->IdxBuffer.Data, cmd_list->IdxBuffer.Size * sizeof(ImDrawIdx));
+				vtx_dst += cmd_list->VtxBuffer.Size;
+				idx_dst += cmd_list->IdxBuffer.Size;
+			}
+			g_streamBuffer->flush(upload);
 
-				glBindBuffer(GL_ARRAY_BUFFER, g_vboHandle);
-				glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)cmd_list->VtxBuffer.Size * sizeof(ImDrawVert), (const GLvoid*)cmd_list->VtxBuffer.Data, GL_STREAM_DRAW);
+			glBindVertexArray(g_vaoHandle);
 
-				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_elementsHandle);
-				glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)cmd_list->IdxBuffer.Size * sizeof(ImDrawIdx), (const GLvoid*)cmd_list->IdxBuffer.Data, GL_STREAM_DRAW);
+			// the buffer may have grown, so bind after allocating
+			setVertexAttributes(upload.offset);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_streamBuffer->buffer());
 
+			GLintptr idx_offset = upload.offset + vtx_size;
+			GLint base_vertex = 0;
+			GLint bound_texture = -1; // skip binding the same texture again
+			for (int n = 0; n < draw_data->CmdListsCount; n++) {
+				const ImDrawList* cmd_list = draw_data->CmdLists[n];
 				for (int cmd_i = 0; cmd_i < cmd_list->CmdBuffer.Size; cmd_i++) {
 					const ImDrawCmd* pcmd = &cmd_list->CmdBuffer[cmd_i];
 					if (pcmd->UserCallback) {
 						pcmd->UserCallback(cmd_list, pcmd);
+						bound_texture = -1;
 					}
 					else {
-						glBindTexture(GL_TEXTURE_2D, (GLuint)(intptr_t)pcmd->TextureId);
-						glScissor((int)pcmd->ClipRect.x, (int)(fb_height - pcmd->ClipRect.w), (int)(pcmd->ClipRect.z - pcmd->ClipRect.x), (int)(pcmd->ClipRect.w - pcmd->ClipRect.y));
-						glDrawElements(GL_TRIANGLES, (GLsizei)pcmd->ElemCount, sizeof(ImDrawIdx) == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, idx_buffer_offset);
+						GLuint texture = (GLuint)(intptr_t)pcmd->TextureId;
+						if ((GLint)texture != bound_texture) {
+							glBindTexture(GL_TEXTURE_2D, texture);
+							bound_texture = (GLint)texture;
+						}
+						const ImVec4 clip(pcmd->ClipRect.x * scale.x, pcmd->ClipRect.y * scale.y, pcmd->ClipRect.z * scale.x, pcmd->ClipRect.w * scale.y);
+						glScissor((int)clip.x, (int)(fb_height - clip.w), (int)(clip.z - clip.x), (int)(clip.w - clip.y));
+						glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei)pcmd->ElemCount, sizeof(ImDrawIdx) == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, (const GLvoid*)idx_offset, base_vertex);
 					}
-					idx_buffer_offset += pcmd->ElemCount;
+					idx_offset += pcmd->ElemCount * sizeof(ImDrawIdx);
 				}
+				base_vertex += cmd_list->VtxBuffer.Size;
 			}
 
+			// fence this frame's part of the ring
+			g_streamBuffer->end_frame();
+
 			// restore modified GL state
 			glUseProgram(last_program);
 			glBindTexture(GL_TEXTURE_2D, last_texture);
@@ -260,6 +307,22 @@ namespace cgra {
 			glfwSetClipboardString((GLFWwindow*)user_data, text);
 		}
 
+
+		const char* getDeferredClipboardText(void*) {
+			return g_pasteText.c_str();
+		}
+
+
+		void setDeferredClipboardText(void*, const char* text) {
+			{
+				lock_guard<mutex> lock(g_copiedMutex);
+				g_copiedText = text;
+				g_copied = true;
+			}
+			g_pasteText = text; // pasting again before the main thread catches up
+			glfwPostEmptyEvent();
+		}
+
 	}
 
 	namespace gui {
@@ -324,8 +387,8 @@ namespace cgra {
 			// alternatively you can set this to NULL and call ImGui::GetDrawData()
 			// after ImGui::Render() to get the same ImDrawData pointer.
 			io.RenderDrawListsFn = renderDrawLists;
-			io.SetClipboardTextFn = setClipboardText;
-			io.GetClipboardTextFn = getClipboardText;
+			io.SetClipboardTextFn = g_deferredClipboard ? setDeferredClipboardText : setClipboardText;
+			io.GetClipboardTextFn = g_deferredClipboard ? getDeferredClipboardText : getClipboardText;
 			io.ClipboardUserData = g_window;
 
 			if (install_callbacks) {
@@ -338,19 +401,33 @@ namespace cgra {
 			return true;
 		}
 
+		window_state window_state::capture(GLFWwindow* window) {
+			window_state state;
+			glfwGetWindowSize(window, &state.width, &state.height);
+			glfwGetFramebufferSize(window, &state.framebuffer_width, &state.framebuffer_height);
+			state.focused = glfwGetWindowAttrib(window, GLFW_FOCUSED) != 0;
+			if (state.focused) glfwGetCursorPos(window, &state.cursor_x, &state.cursor_y);
+			for (int i = 0; i < 3; i++)
+				state.mouse_down[i] = glfwGetMouseButton(window, i) != 0;
+			return state;
+		}
+
 		void newFrame() {
+			window_state window = window_state::capture(g_window);
+			newFrame(window);
+			glfwSetInputMode(g_window, GLFW_CURSOR, window.hide_cursor ? GLFW_CURSOR_HIDDEN : GLFW_CURSOR_NORMAL);
+		}
+
+		void newFrame(window_state &window) {
 			if (!g_fontTexture)
 				createDeviceObjects();
 
 			ImGuiIO& io = ImGui::GetIO();
 
 			// setup display size (every frame to accommodate for window resizing)
-			int w, h;
-			int display_w, display_h;
-			glfwGetWindowSize(g_window, &w, &h);
-			glfwGetFramebufferSize(g_window, &display_w, &display_h);
+			int w = window.width, h = window.height;
 			io.DisplaySize = ImVec2((float)w, (float)h);
-			io.DisplayFramebufferScale = ImVec2(w > 0 ? ((float)display_w / w) : 0, h > 0 ? ((float)display_h / h) : 0);
+			io.DisplayFramebufferScale = ImVec2(w > 0 ? ((float)window.framebuffer_width / w) : 0, h > 0 ? ((float)window.framebuffer_height / h) : 0);
 
 			// setup time step
 			double current_time =  glfwGetTime();
@@ -360,12 +437,10 @@ namespace cgra {
 			// setup inputs
 			// we already got mouse wheel, keyboard keys & characters
 			// from glfw callbackspolled in glfwPollEvents()
-			if (glfwGetWindowAttrib(g_window, GLFW_FOCUSED)) {
-				double mouse_x, mouse_y;
-				glfwGetCursorPos(g_window, &mouse_x, &mouse_y);
+			if (window.focused) {
 				// Mouse position in screen coordinates
 				// (set to -1,-1 if no mouse / on another screen, etc.)
-				io.MousePos = ImVec2((float)mouse_x, (float)mouse_y);
+				io.MousePos = ImVec2((float)window.cursor_x, (float)window.cursor_y);
 			} else {
 				io.MousePos = ImVec2(-1,-1);
 			}
@@ -373,7 +448,7 @@ namespace cgra {
 			for (int i = 0; i < 3; i++) {
 				// If a mouse press event came, always pass it as "mouse held this frame",
 				// so we don't miss click-release events that are shorter than 1 frame.
-				io.MouseDown[i] = g_mousePressed[i] || glfwGetMouseButton(g_window, i) != 0;
+				io.MouseDown[i] = g_mousePressed[i] || window.mouse_down[i];
 				g_mousePressed[i] = false;
 			}
 
@@ -381,7 +456,7 @@ namespace cgra {
 			g_mouseWheel = 0.0f;
 
 			// hide OS mouse cursor if ImGui is drawing it
-			glfwSetInputMode(g_window, GLFW_CURSOR, io.MouseDrawCursor ? GLFW_CURSOR_HIDDEN : GLFW_CURSOR_NORMAL);
+			window.hide_cursor = io.MouseDrawCursor;
 
 			// start the frame
 			ImGui::NewFrame();
@@ -391,11 +466,32 @@ namespace cgra {
 			ImGui::Render();
 		}
 
+		void redraw() {
+			ImDrawData* draw_data = ImGui::GetDrawData();
+			if (draw_data) renderDrawLists(draw_data);
+		}
+
 		void shutdown() {
 			invalidateDeviceObjects();
 			ImGui::Shutdown();
 		}
 
+		void useDeferredClipboard() {
+			g_deferredClipboard = true;
+		}
+
+		void setPasteText(const std::string &text) {
+			g_pasteText = text;
+		}
+
+		bool takeCopiedText(std::string &text) {
+			lock_guard<mutex> lock(g_copiedMutex);
+			if (!g_copied) return false;
+			text = std::move(g_copiedText);
+			g_copied = false;
+			return true;
+		}
+
 	}
 
 }
\ No newline at end of file
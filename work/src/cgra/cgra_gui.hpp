@@ -1,6 +1,9 @@
 
 #pragma once
 
+// std
+#include <string>
+
 // imgui
 #include <imgui.h>
 
@@ -17,10 +20,36 @@ namespace cgra {
 		void keyCallback(GLFWwindow*, int key, int /*scancode*/, int action, int mods);
 		void charCallback(GLFWwindow*, unsigned int c);
 
+		// window and mouse state newFrame() reads from GLFW. Only the main
+		// thread may query GLFW, so a render thread gets it captured there
+		struct window_state {
+			int width = 0, height = 0; // screen coordinates
+			int framebuffer_width = 0, framebuffer_height = 0;
+			bool focused = false;
+			double cursor_x = -1, cursor_y = -1;
+			bool mouse_down[3] = { false, false, false };
+
+			// set by newFrame, hide the OS cursor while ImGui draws its own.
+			// Not captured, the thread owning the window applies it
+			bool hide_cursor = false;
+
+			static window_state capture(GLFWwindow* window);
+		};
+
 		// helper functions to setup, run and shutdown ImGui
 		bool init(GLFWwindow* window, bool install_callbacks=false);
 		void newFrame();
+		void newFrame(window_state &window); // from any thread, sets window.hide_cursor instead of the cursor
 		void render();
+		void redraw(); // draw the last render()ed GUI again, without rebuilding it
 		void shutdown();
+
+		// GLFW's clipboard is main thread only. When ImGui runs on another
+		// thread, call this before init: ImGui then pastes the text last
+		// given to setPasteText, and copies wait for the main thread to take
+		// them with takeCopiedText (a copy posts an empty event to wake it)
+		void useDeferredClipboard();
+		void setPasteText(const std::string &text); // on the thread running ImGui
+		bool takeCopiedText(std::string &text); // on the main thread
 	}
 }
\ No newline at end of file
@@ -0,0 +1,249 @@
+// std
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <thread>
+
+// glm
+#include <glm/gtc/matrix_transform.hpp>
+
+// project
+#include "cgra_light_clusters.hpp"
+#include "cgra_trace.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+
+namespace cgra {
+
+	light_clusters::light_clusters(thread_pool &pool, float near_depth, float far_depth) : m_pool(&pool), m_near(near_depth), m_far(far_depth) {
+		m_clusters.assign(cluster_count * 2, 0);
+		m_slice_indices.resize(grid_z);
+	}
+
+
+	light_clusters::~light_clusters() {
+		if (m_buffers[0]) {
+			glDeleteTextures(3, m_textures);
+			glDeleteBuffers(3, m_buffers);
+		}
+	}
+
+
+	void light_clusters::assign(const vector<point_light> &lights, const mat4 &view, const mat4 &proj) {
+		CGRA_TRACE_SCOPE("light_clusters::assign");
+		auto start = chrono::steady_clock::now();
+		const size_t light_count = lights.size();
+		const float slice_scale = grid_z / std::log(m_far / m_near);
+		const auto slice_of = [&](float depth) {
+			if (depth <= m_near) return 0;
+			return std::min(grid_z - 1, int(std::log(depth / m_near) * slice_scale));
+		};
+
+		// move the lights to view space and find the depth slices they touch
+		m_view_lights.resize(light_count);
+		m_lights.resize(light_count * 2);
+		m_pool->parallel_for(0, light_count, 256, [&](size_t first, size_t last) {
+			for (size_t i = first; i < last; i++) {
+				view_light &v = m_view_lights[i];
+				v.position = vec3(view * vec4(lights[i].position, 1));
+				v.radius = lights[i].radius;
+				float depth = -v.position.z;
+				if (depth + v.radius <= m_near) {
+					v.zmin = 1; v.zmax = 0; // behind the camera
+				}
+				else {
+					v.zmin = slice_of(depth - v.radius);
+					v.zmax = slice_of(depth + v.radius);
+				}
+				m_lights[i * 2] = vec4(v.position, v.radius);
+				m_lights[i * 2 + 1] = vec4(lights[i].color, 0);
+			}
+		});
+
+		// each slice only writes its own clusters and index list
+		const vec2 scale(proj[0][0], proj[1][1]);
+		m_pool->parallel_for(0, grid_z, 1, [&](size_t first, size_t last) {
+			for (size_t s = first; s < last; s++) assign_slice(int(s), scale);
+		});
+
+		// join the slices, offsets become absolute
+		size_t total = 0;
+		for (auto &indices : m_slice_indices) total += indices.size();
+		m_indices.resize(std::min(total, m_max_indices));
+		m_dropped = total - m_indices.size();
+		size_t base = 0;
+		for (int s = 0; s < grid_z; s++) {
+			const vector<uint32_t> &indices = m_slice_indices[s];
+			size_t copied = std::min(indices.size(), m_indices.size() - base);
+			if (copied) std::memcpy(m_indices.data() + base, indices.data(), copied * sizeof(uint32_t));
+			uint32_t *clusters = &m_clusters[s * grid_x * grid_y * 2];
+			for (int c = 0; c < grid_x * grid_y; c++) {
+				size_t offset = base + clusters[c * 2];
+				clusters[c * 2] = uint32_t(offset);
+				// past the limit, this cluster loses its last lights
+				if (offset + clusters[c * 2 + 1] > m_indices.size()) {
+					clusters[c * 2 + 1] = uint32_t(m_indices.size() - std::min(offset, m_indices.size()));
+				}
+			}
+			base += copied;
+		}
+
+		m_assign_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	}
+
+
+	void light_clusters::assign_slice(int slice, const vec2 &scale) {
+		const float ratio = m_far / m_near;
+		const float slice_near = m_near * std::pow(ratio, float(slice) / grid_z);
+		const float slice_far = slice == grid_z - 1 ? numeric_limits<float>::infinity() : m_near * std::pow(ratio, float(slice + 1) / grid_z);
+
+		// screen tile rectangle of every light that reaches this slice
+		struct rect {
+			uint32_t light;
+			int x0, y0, x1, y1; // inclusive
+		};
+		vector<rect> rects;
+		uint32_t counts[grid_x * grid_y] = { };
+		for (size_t i = 0; i < m_view_lights.size(); i++) {
+			const view_light &v = m_view_lights[i];
+			if (slice < v.zmin || slice > v.zmax) continue;
+
+			// the sphere's bounding box clipped to the slice, projected. x / d
+			// is extreme at the nearest depth for the side away from the
+			// centre of the screen and the farthest depth for the other
+			float depth = -v.position.z;
+			float d0 = std::max(slice_near, depth - v.radius);
+			float d1 = std::min(slice_far, depth + v.radius);
+			vec2 lo = vec2(v.position) - v.radius;
+			vec2 hi = vec2(v.position) + v.radius;
+			vec2 ndc_lo, ndc_hi;
+			for (int a = 0; a < 2; a++) {
+				ndc_lo[a] = scale[a] * (lo[a] < 0 ? lo[a] / d0 : lo[a] / d1);
+				ndc_hi[a] = scale[a] * (hi[a] > 0 ? hi[a] / d0 : hi[a] / d1);
+			}
+			if (ndc_hi.x < -1 || ndc_lo.x > 1 || ndc_hi.y < -1 || ndc_lo.y > 1) continue;
+
+			rect r;
+			r.light = uint32_t(i);
+			r.x0 = glm::clamp(int(std::floor((ndc_lo.x * 0.5f + 0.5f) * grid_x)), 0, grid_x - 1);
+			r.x1 = glm::clamp(int(std::floor((ndc_hi.x * 0.5f + 0.5f) * grid_x)), 0, grid_x - 1);
+			r.y0 = glm::clamp(int(std::floor((ndc_lo.y * 0.5f + 0.5f) * grid_y)), 0, grid_y - 1);
+			r.y1 = glm::clamp(int(std::floor((ndc_hi.y * 0.5f + 0.5f) * grid_y)), 0, grid_y - 1);
+			for (int y = r.y0; y <= r.y1; y++) {
+				for (int x = r.x0; x <= r.x1; x++) counts[y * grid_x + x]++;
+			}
+			rects.push_back(r);
+		}
+
+		// counts to offsets, then fill using the counts as cursors
+		uint32_t *clusters = &m_clusters[slice * grid_x * grid_y * 2];
+		uint32_t offset = 0;
+		for (int c = 0; c < grid_x * grid_y; c++) {
+			clusters[c * 2] = offset;
+			clusters[c * 2 + 1] = 0;
+			offset += counts[c];
+		}
+		vector<uint32_t> &indices = m_slice_indices[slice];
+		indices.resize(offset);
+		for (const rect &r : rects) {
+			for (int y = r.y0; y <= r.y1; y++) {
+				for (int x = r.x0; x <= r.x1; x++) {
+					uint32_t *cluster = &clusters[(y * grid_x + x) * 2];
+					indices[cluster[0] + cluster[1]++] = r.light;
+				}
+			}
+		}
+	}
+
+
+	void light_clusters::upload() {
+		CGRA_TRACE_SCOPE("light_clusters::upload");
+		const GLenum formats[3] = { GL_RG32UI, GL_R32UI, GL_RGBA32F };
+		if (!m_buffers[0]) {
+			glGenBuffers(3, m_buffers);
+			glGenTextures(3, m_textures);
+			for (int i = 0; i < 3; i++) {
+				glBindBuffer(GL_TEXTURE_BUFFER, m_buffers[i]);
+				glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+				glBindTexture(GL_TEXTURE_BUFFER, m_textures[i]);
+				glTexBuffer(GL_TEXTURE_BUFFER, formats[i], m_buffers[i]);
+			}
+			glBindTexture(GL_TEXTURE_BUFFER, 0);
+			GLint max_texels = 0;
+			glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+			m_max_indices = std::max<size_t>(m_max_indices, size_t(max_texels));
+		}
+
+		// respecifying the whole store each frame lets the driver orphan it
+		const void *data[3] = { m_clusters.data(), m_indices.data(), m_lights.data() };
+		const size_t sizes[3] = { m_clusters.size() * sizeof(uint32_t), m_indices.size() * sizeof(uint32_t), m_lights.size() * sizeof(vec4) };
+		for (int i = 0; i < 3; i++) {
+			glBindBuffer(GL_TEXTURE_BUFFER, m_buffers[i]);
+			if (sizes[i]) glBufferData(GL_TEXTURE_BUFFER, sizes[i], data[i], GL_STREAM_DRAW);
+		}
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	}
+
+
+	void light_clusters::bind(GLuint program, int width, int height, GLuint first_unit) const {
+		const char *names[3] = { "uClusters", "uClusterLightIndices", "uClusterLights" };
+		for (int i = 0; i < 3; i++) {
+			glActiveTexture(GL_TEXTURE0 + first_unit + i);
+			glBindTexture(GL_TEXTURE_BUFFER, m_textures[i]);
+			glUniform1i(glGetUniformLocation(program, names[i]), first_unit + i);
+		}
+		glActiveTexture(GL_TEXTURE0);
+
+		// slice = log(depth) * scale + bias, the inverse of the slice depths in assign()
+		const float scale = grid_z / std::log(m_far / m_near);
+		glUniform3i(glGetUniformLocation(program, "uClusterGrid"), grid_x, grid_y, grid_z);
+		glUniform2f(glGetUniformLocation(program, "uClusterTileSize"), float(width) / grid_x, float(height) / grid_y);
+		glUniform2f(glGetUniformLocation(program, "uClusterDepth"), scale, -std::log(m_near) * scale);
+	}
+
+
+	void light_clusters::benchmark(int light_count, int frames) {
+		// lights scattered through the first 60 units of the view
+		mt19937 random(1234);
+		uniform_real_distribution<float> unit(0.f, 1.f);
+		vector<point_light> lights(light_count);
+		for (point_light &light : lights) {
+			light.position = vec3(unit(random) * 60 - 30, unit(random) * 40 - 20, -1 - unit(random) * 60);
+			light.radius = 2 + unit(random) * 4;
+			light.color = vec3(unit(random), unit(random), unit(random));
+		}
+		const mat4 view(1);
+		const mat4 proj = perspective(1.f, 16.f / 9.f, 0.1f, 1000.f);
+
+		const unsigned hardware = std::max(1u, thread::hardware_concurrency());
+		vector<unsigned> thread_counts;
+		for (unsigned t = 1; t < hardware; t *= 2) thread_counts.push_back(t);
+		thread_counts.push_back(hardware);
+
+		cout << "Light clusters: " << light_count << " lights, " << grid_x << "x" << grid_y << "x" << grid_z << " clusters, " << frames << " frames" << endl;
+		cout << setw(8) << "threads" << setw(12) << "ms/frame" << setw(12) << "indices" << setw(10) << "speedup" << endl;
+		double baseline = 0;
+		for (unsigned threads : thread_counts) {
+			// assign from inside the pool so exactly 'threads' threads do the work
+			thread_pool pool(threads);
+			light_clusters clusters(pool);
+			double ms = pool.submit([&]() {
+				clusters.assign(lights, view, proj); // warm up
+				auto start = chrono::steady_clock::now();
+				for (int i = 0; i < frames; i++) clusters.assign(lights, view, proj);
+				return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / frames;
+			}).get();
+			if (baseline == 0) baseline = ms;
+			cout << setw(8) << threads << setw(12) << fixed << setprecision(3) << ms << setw(12) << clusters.index_count() << setw(9) << baseline / ms << "x" << endl;
+		}
+	}
+
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+// std
+#include <cstdint>
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include <opengl.hpp>
+#include "cgra_thread_pool.hpp"
+
+
+namespace cgra {
+
+	// point light with a hard cutoff radius, in world space
+	struct point_light {
+		glm::vec3 position;
+		float radius = 1.f;
+		glm::vec3 color = glm::vec3(1.f);
+	};
+
+
+	// clustered forward shading. The view frustum is split into a grid of
+	// clusters, screen tiles in x and y and exponential depth slices in z,
+	// and each cluster gets the list of lights whose sphere may touch it.
+	// Assignment runs on the CPU every frame, one depth slice per task, and
+	// the results are uploaded as three texture buffers the fragment shader
+	// reads with texelFetch:
+	//
+	//   uClusters            RG32UI, offset and count into the index list per cluster
+	//   uClusterLightIndices R32UI, light indices
+	//   uClusterLights       RGBA32F, view space position and radius, then color, per light
+	//
+	// Fragments beyond the far slice use the far slice, so lights are never
+	// missed, only less tightly culled. Assumes a symmetric perspective.
+	class light_clusters {
+	public:
+		static constexpr int grid_x = 16;
+		static constexpr int grid_y = 9;
+		static constexpr int grid_z = 24;
+		static constexpr int cluster_count = grid_x * grid_y * grid_z;
+
+	private:
+		thread_pool *m_pool;
+		float m_near;
+		float m_far;
+
+		// per light, after transforming to view space
+		struct view_light {
+			glm::vec3 position;
+			float radius;
+			int zmin, zmax; // slices touched, zmin > zmax if not visible
+		};
+		std::vector<view_light> m_view_lights;
+
+		// per slice light indices and cluster (offset, count) pairs relative
+		// to the slice, filled in parallel then joined into the upload arrays
+		std::vector<std::vector<std::uint32_t>> m_slice_indices;
+		std::vector<std::uint32_t> m_clusters; // 2 per cluster
+		std::vector<std::uint32_t> m_indices;
+		std::vector<glm::vec4> m_lights; // 2 per light
+		std::size_t m_dropped = 0;
+
+		// GL buffers and their buffer textures: clusters, indices, lights
+		GLuint m_buffers[3] = { };
+		GLuint m_textures[3] = { };
+		std::size_t m_max_indices = 65536; // GL_MAX_TEXTURE_BUFFER_SIZE, queried on first upload
+
+		double m_assign_ms = 0;
+
+		void assign_slice(int slice, const glm::vec2 &scale);
+
+	public:
+		// the depth slices span near_depth to far_depth, lights are not limited
+		explicit light_clusters(thread_pool &pool, float near_depth = 0.1f, float far_depth = 100.f);
+
+		// remove copy ctors
+		light_clusters(const light_clusters &) = delete;
+		light_clusters & operator=(const light_clusters &) = delete;
+
+		~light_clusters();
+
+		// bin the lights into clusters for this view. CPU only, no GL
+		void assign(const std::vector<point_light> &lights, const glm::mat4 &view, const glm::mat4 &proj);
+
+		// upload the last assignment, requires a current GL context
+		void upload();
+
+		// bind the buffer textures to units first_unit .. first_unit + 2 and
+		// set the cluster uniforms of program (which must be in use) for a
+		// viewport of width x height pixels
+		void bind(GLuint program, int width, int height, GLuint first_unit = 1) const;
+
+		// stats for the last assignment
+		double assign_milliseconds() const { return m_assign_ms; }
+		std::size_t index_count() const { return m_indices.size(); }
+		std::size_t dropped() const { return m_dropped; } // indices over the buffer texture limit
+
+		// times assign() for light_count lights scattered through the view
+		// with 1, 2, 4 ... hardware threads and prints ms per frame
+		static void benchmark(int light_count, int frames);
+	};
+
+}
@@ -0,0 +1,251 @@
+// std
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+
+// sse2 (enabled by default on x86-64, and with -msse2 on gcc/clang)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CGRA_OCCLUSION_SSE2
+#include <emmintrin.h>
+#endif
+
+// project
+#include "cgra_occlusion.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+
+namespace cgra {
+
+	occlusion_culler::occlusion_culler(thread_pool &pool, int width, int height) : m_pool(&pool) {
+		resize(width, height);
+	}
+
+
+	void occlusion_culler::resize(int width, int height) {
+		m_tiles_x = std::max(1, (width + tile_width - 1) / tile_width);
+		m_tiles_y = std::max(1, (height + tile_height - 1) / tile_height);
+		m_width = m_tiles_x * tile_width;
+		m_height = m_tiles_y * tile_height;
+		m_depth.assign(size_t(m_width) * m_height, 1.f);
+		m_tile_max.assign(size_t(m_tiles_x) * m_tiles_y, 1.f);
+	}
+
+
+	void occlusion_culler::clear() {
+		std::fill(m_depth.begin(), m_depth.end(), 1.f);
+		std::fill(m_tile_max.begin(), m_tile_max.end(), 1.f);
+	}
+
+
+	void occlusion_culler::render_occluders(const mat4 &mvp, const vector<vec3> &triangles) {
+		const size_t tri_count = triangles.size() / 3;
+		if (tri_count == 0) return;
+		const float w = float(m_width), h = float(m_height);
+
+		// transform and set up every triangle
+		m_triangles.resize(tri_count);
+		m_pool->parallel_for(0, tri_count, 256, [&](size_t first, size_t last) {
+			for (size_t t = first; t < last; t++) {
+				triangle &tri = m_triangles[t];
+				tri.xmin = 1; tri.xmax = 0; // empty until proven otherwise
+
+				vec3 p[3];
+				bool clipped = false;
+				for (int i = 0; i < 3; i++) {
+					vec4 clip = mvp * vec4(triangles[t * 3 + i], 1);
+					// crosses the near plane, skipping an occluder is always safe
+					if (clip.w <= 1e-6f || clip.z < -clip.w) { clipped = true; break; }
+					vec3 ndc = vec3(clip) / clip.w;
+					p[i] = vec3((ndc.x * 0.5f + 0.5f) * w, (ndc.y * 0.5f + 0.5f) * h, ndc.z * 0.5f + 0.5f);
+				}
+				if (clipped) continue;
+
+				// make the winding counter-clockwise so inside is positive
+				float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[1].y - p[0].y) * (p[2].x - p[0].x);
+				if (std::abs(area) < 1e-8f) continue; // degenerate
+				if (area < 0) { std::swap(p[1], p[2]); area = -area; }
+
+				// pixel centers (i + 0.5) covered by the triangle bounds
+				float minx = std::min({ p[0].x, p[1].x, p[2].x }), maxx = std::max({ p[0].x, p[1].x, p[2].x });
+				float miny = std::min({ p[0].y, p[1].y, p[2].y }), maxy = std::max({ p[0].y, p[1].y, p[2].y });
+				tri.xmin = std::max(0, int(std::ceil(minx - 0.5f)));
+				tri.xmax = std::min(m_width - 1, int(std::floor(maxx - 0.5f)));
+				tri.ymin = std::max(0, int(std::ceil(miny - 0.5f)));
+				tri.ymax = std::min(m_height - 1, int(std::floor(maxy - 0.5f)));
+
+				// edge k is opposite vertex k, so E_k / area is barycentric k
+				for (int k = 0; k < 3; k++) {
+					const vec3 &vi = p[(k + 1) % 3], &vj = p[(k + 2) % 3];
+					tri.a[k] = -(vj.y - vi.y);
+					tri.b[k] = vj.x - vi.x;
+					tri.c[k] = -(tri.a[k] * vi.x + tri.b[k] * vi.y);
+				}
+
+				// depth plane from the barycentric weights
+				const float inv = 1.f / area;
+				tri.dzdx = (tri.a[0] * p[0].z + tri.a[1] * p[1].z + tri.a[2] * p[2].z) * inv;
+				tri.dzdy = (tri.b[0] * p[0].z + tri.b[1] * p[1].z + tri.b[2] * p[2].z) * inv;
+				tri.z0 = (tri.c[0] * p[0].z + tri.c[1] * p[1].z + tri.c[2] * p[2].z) * inv;
+			}
+		});
+
+		// bin triangles into tiles, one set of bins per batch so no locking
+		const size_t tile_count = size_t(m_tiles_x) * m_tiles_y;
+		const size_t batch_size = std::max<size_t>(256, (tri_count + m_pool->size()) / (m_pool->size() + 1));
+		const size_t batch_count = (tri_count + batch_size - 1) / batch_size;
+		m_bins.resize(batch_count);
+		m_pool->parallel_for(0, batch_count, 1, [&](size_t first, size_t last) {
+			for (size_t b = first; b < last; b++) {
+				auto &bins = m_bins[b];
+				bins.resize(tile_count);
+				for (auto &bin : bins) bin.clear();
+				size_t end = std::min(tri_count, (b + 1) * batch_size);
+				for (size_t t = b * batch_size; t < end; t++) {
+					const triangle &tri = m_triangles[t];
+					if (tri.xmin > tri.xmax || tri.ymin > tri.ymax) continue;
+					for (int ty = tri.ymin / tile_height; ty <= tri.ymax / tile_height; ty++) {
+						for (int tx = tri.xmin / tile_width; tx <= tri.xmax / tile_width; tx++) {
+							bins[ty * m_tiles_x + tx].push_back(unsigned(t));
+						}
+					}
+				}
+			}
+		});
+
+		// every tile is owned by exactly one task
+		m_pool->parallel_for(0, tile_count, 1, [&](size_t first, size_t last) {
+			for (size_t tile = first; tile < last; tile++) {
+				rasterize_tile(int(tile));
+			}
+		});
+	}
+
+
+	void occlusion_culler::rasterize_tile(int tile) {
+		const int tx0 = (tile % m_tiles_x) * tile_width;
+		const int ty0 = (tile / m_tiles_x) * tile_height;
+		float *depth = &m_depth[size_t(tile) * tile_width * tile_height];
+		bool touched = false;
+
+		for (const auto &bins : m_bins) {
+			for (unsigned t : bins[tile]) {
+				const triangle &tri = m_triangles[t];
+				touched = true;
+				const int y0 = std::max(tri.ymin, ty0) - ty0, y1 = std::min(tri.ymax, ty0 + tile_height - 1) - ty0;
+				const int x0 = std::max(tri.xmin, tx0) - tx0, x1 = std::min(tri.xmax, tx0 + tile_width - 1) - tx0;
+
+				for (int y = y0; y <= y1; y++) {
+					const float py = float(ty0 + y) + 0.5f;
+					float *row = depth + y * tile_width;
+#ifdef CGRA_OCCLUSION_SSE2
+					// row constant parts of the edge functions and depth
+					const __m128 zero = _mm_setzero_ps();
+					const __m128 lane = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+					__m128 a[3], e_row[3];
+					for (int k = 0; k < 3; k++) {
+						a[k] = _mm_set1_ps(tri.a[k]);
+						e_row[k] = _mm_set1_ps(tri.b[k] * py + tri.c[k]);
+					}
+					const __m128 dzdx = _mm_set1_ps(tri.dzdx);
+					const __m128 z_row = _mm_set1_ps(tri.z0 + tri.dzdy * py);
+
+					for (int x = x0 & ~3; x <= x1; x += 4) {
+						const __m128 px = _mm_add_ps(_mm_set1_ps(float(tx0 + x)), lane);
+						__m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a[0], px), e_row[0]), zero);
+						inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a[1], px), e_row[1]), zero));
+						inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a[2], px), e_row[2]), zero));
+						if (_mm_movemask_ps(inside) == 0) continue;
+
+						const __m128 z = _mm_add_ps(_mm_mul_ps(dzdx, px), z_row);
+						const __m128 old = _mm_loadu_ps(row + x);
+						const __m128 nearest = _mm_min_ps(old, z);
+						_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, old)));
+					}
+#else
+					for (int x = x0; x <= x1; x++) {
+						const float px = float(tx0 + x) + 0.5f;
+						bool inside = true;
+						for (int k = 0; k < 3; k++) {
+							inside = inside && (tri.a[k] * px + tri.b[k] * py + tri.c[k] >= 0);
+						}
+						if (!inside) continue;
+						row[x] = std::min(row[x], tri.z0 + tri.dzdx * px + tri.dzdy * py);
+					}
+#endif
+				}
+			}
+		}
+
+		if (touched) {
+			m_tile_max[tile] = *std::max_element(depth, depth + tile_width * tile_height);
+		}
+	}
+
+
+	bool occlusion_culler::test(const mat4 &mvp, const aabb &box) const {
+		vec3 lo(numeric_limits<float>::max()), hi(-numeric_limits<float>::max());
+		for (int i = 0; i < 8; i++) {
+			vec3 corner((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y, (i & 4) ? box.max.z : box.min.z);
+			vec4 clip = mvp * vec4(corner, 1);
+			// crosses the near plane, can't say anything useful
+			if (clip.w <= 1e-6f || clip.z < -clip.w) return true;
+			vec3 ndc = vec3(clip) / clip.w;
+			lo = glm::min(lo, ndc);
+			hi = glm::max(hi, ndc);
+		}
+
+		// outside the view frustum
+		if (hi.x < -1 || lo.x > 1 || hi.y < -1 || lo.y > 1 || lo.z > 1) return false;
+
+		// pixels touched by the screen space bounds
+		const float zmin = lo.z * 0.5f + 0.5f;
+		const int x0 = std::max(0, int(std::floor((lo.x * 0.5f + 0.5f) * m_width)));
+		const int x1 = std::min(m_width - 1, int(std::floor((hi.x * 0.5f + 0.5f) * m_width)));
+		const int y0 = std::max(0, int(std::floor((lo.y * 0.5f + 0.5f) * m_height)));
+		const int y1 = std::min(m_height - 1, int(std::floor((hi.y * 0.5f + 0.5f) * m_height)));
+
+		for (int ty = y0 / tile_height; ty <= y1 / tile_height; ty++) {
+			for (int tx = x0 / tile_width; tx <= x1 / tile_width; tx++) {
+				const int tile = ty * m_tiles_x + tx;
+				// every occluder in the tile is in front of the box
+				if (m_tile_max[tile] < zmin) continue;
+
+				const float *depth = &m_depth[size_t(tile) * tile_width * tile_height];
+				const int px0 = std::max(x0 - tx * tile_width, 0), px1 = std::min(x1 - tx * tile_width, tile_width - 1);
+				const int py0 = std::max(y0 - ty * tile_height, 0), py1 = std::min(y1 - ty * tile_height, tile_height - 1);
+				for (int y = py0; y <= py1; y++) {
+					for (int x = px0; x <= px1; x++) {
+						if (depth[y * tile_width + x] >= zmin) return true;
+					}
+				}
+			}
+		}
+		return false;
+	}
+
+
+	int occlusion_culler::test(const mat4 &mvp, const vector<aabb> &boxes, vector<char> &visible) const {
+		visible.resize(boxes.size());
+		std::atomic<int> count{ 0 };
+		m_pool->parallel_for(0, boxes.size(), 32, [&](size_t first, size_t last) {
+			int local = 0;
+			for (size_t i = first; i < last; i++) {
+				visible[i] = test(mvp, boxes[i]);
+				local += visible[i];
+			}
+			count += local;
+		});
+		return count;
+	}
+
+
+	float occlusion_culler::depth(int x, int y) const {
+		const int tile = (y / tile_height) * m_tiles_x + x / tile_width;
+		return m_depth[size_t(tile) * tile_width * tile_height + (y % tile_height) * tile_width + x % tile_width];
+	}
+
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+// std
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "cgra_thread_pool.hpp"
+
+
+namespace cgra {
+
+	// axis aligned bounding box in model space
+	struct aabb {
+		glm::vec3 min;
+		glm::vec3 max;
+	};
+
+
+	// CPU occlusion culler in the style of masked occlusion culling.
+	// A small set of occluder triangles is rasterized into a low resolution
+	// depth buffer split into tiles, then bounding boxes are tested against
+	// it. Rasterization and testing run across the thread pool and use SSE2
+	// where available. Never touches OpenGL, so it needs no GPU readback.
+	class occlusion_culler {
+	public:
+		// tiles are 16x8 pixels, a tile row is 4 SIMD lanes wide
+		static constexpr int tile_width = 16;
+		static constexpr int tile_height = 8;
+
+	private:
+		thread_pool *m_pool;
+		int m_width = 0;
+		int m_height = 0;
+		int m_tiles_x = 0;
+		int m_tiles_y = 0;
+
+		// depth in [0,1], 1 is far. stored tile by tile, row major within a tile
+		std::vector<float> m_depth;
+		// farthest depth in each tile, lets most tests skip the per-pixel loop
+		std::vector<float> m_tile_max;
+
+		// occluder triangle after setup, edge functions are inside when >= 0
+		struct triangle {
+			float a[3], b[3], c[3]; // edge function coefficients
+			float z0, dzdx, dzdy;   // depth plane
+			int xmin, ymin, xmax, ymax; // pixel bounds, inclusive
+		};
+		std::vector<triangle> m_triangles;
+
+		// per batch, per tile lists of triangle indices
+		std::vector<std::vector<std::vector<unsigned>>> m_bins;
+
+		void rasterize_tile(int tile);
+
+	public:
+		// width and height are rounded up to whole tiles
+		explicit occlusion_culler(thread_pool &pool, int width = 256, int height = 128);
+
+		void resize(int width, int height);
+		int width() const { return m_width; }
+		int height() const { return m_height; }
+
+		// reset the depth buffer to far
+		void clear();
+
+		// rasterize occluders into the depth buffer. triangles is a flat
+		// list of model space positions, three per triangle. Triangles
+		// crossing the near plane are skipped, which is always conservative.
+		void render_occluders(const glm::mat4 &mvp, const std::vector<glm::vec3> &triangles);
+
+		// true if any part of the box may be visible. Boxes outside the view
+		// frustum report false, boxes crossing the near plane report true.
+		bool test(const glm::mat4 &mvp, const aabb &box) const;
+
+		// tests every box in parallel, visible[i] is set to 1 or 0
+		// returns the number of visible boxes
+		int test(const glm::mat4 &mvp, const std::vector<aabb> &boxes, std::vector<char> &visible) const;
+
+		// depth value of pixel (x, y), y up, for debugging
+		float depth(int x, int y) const;
+	};
+
+}
@@ -0,0 +1,86 @@
+// std
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+// stb
+#include <stb_image_write.h>
+
+// project
+#include "cgra_offscreen.hpp"
+
+
+namespace cgra {
+
+	offscreen_target::offscreen_target(int width, int height) : m_width(width), m_height(height) {
+		m_fbo = gl_object::gen_framebuffer();
+		glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+
+		glGenRenderbuffers(1, &m_color);
+		glBindRenderbuffer(GL_RENDERBUFFER, m_color);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_color);
+
+		glGenRenderbuffers(1, &m_depth);
+		glBindRenderbuffer(GL_RENDERBUFFER, m_depth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_depth);
+
+		GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		if (status != GL_FRAMEBUFFER_COMPLETE) {
+			throw std::runtime_error("Error: Offscreen framebuffer is incomplete");
+		}
+	}
+
+
+	offscreen_target::~offscreen_target() {
+		glDeleteRenderbuffers(1, &m_color);
+		glDeleteRenderbuffers(1, &m_depth);
+	}
+
+
+	void offscreen_target::bind() {
+		glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+		glViewport(0, 0, m_width, m_height);
+	}
+
+
+	void offscreen_target::unbind() {
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+
+	std::vector<unsigned char> offscreen_target::read_pixels() {
+		std::vector<unsigned char> pixels(size_t(m_width) * m_height * 4);
+		GLint last_fbo;
+		glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &last_fbo);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, m_fbo);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glReadPixels(0, 0, m_width, m_height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, last_fbo);
+
+		// OpenGL rows start at the bottom, images start at the top
+		const size_t stride = size_t(m_width) * 4;
+		for (int y = 0; y < m_height / 2; y++) {
+			std::swap_ranges(pixels.begin() + y * stride, pixels.begin() + (y + 1) * stride, pixels.begin() + (m_height - 1 - y) * stride);
+		}
+		return pixels;
+	}
+
+
+	bool offscreen_target::write_png(const std::string &filename) {
+		return cgra::write_png(filename, m_width, m_height, read_pixels());
+	}
+
+
+	bool write_png(const std::string &filename, int width, int height, const std::vector<unsigned char> &pixels) {
+		if (!stbi_write_png(filename.c_str(), width, height, 4, pixels.data(), width * 4)) {
+			std::cerr << "Error: Could not write image " << filename << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+// std
+#include <string>
+#include <vector>
+
+// project
+#include <opengl.hpp>
+
+
+namespace cgra {
+
+	// framebuffer object with an RGBA8 color and 24-bit depth attachment
+	// for rendering without a visible window, and reading the result back
+	class offscreen_target {
+	private:
+		gl_object m_fbo;
+		GLuint m_color = 0;
+		GLuint m_depth = 0;
+		int m_width = 0;
+		int m_height = 0;
+
+	public:
+		// requires a current GL context
+		offscreen_target(int width, int height);
+
+		// remove copy ctors
+		offscreen_target(const offscreen_target &) = delete;
+		offscreen_target & operator=(const offscreen_target &) = delete;
+
+		~offscreen_target();
+
+		int width() const { return m_width; }
+		int height() const { return m_height; }
+
+		// bind as the draw and read framebuffer, and set the viewport
+		void bind();
+
+		// bind the default framebuffer again
+		static void unbind();
+
+		// read back tightly packed RGBA8 rows, top row first
+		std::vector<unsigned char> read_pixels();
+
+		// read back and write a PNG, returns false if writing failed
+		bool write_png(const std::string &filename);
+	};
+
+
+	// writes tightly packed RGBA8 pixels (top row first) to a PNG
+	bool write_png(const std::string &filename, int width, int height, const std::vector<unsigned char> &pixels);
+
+}
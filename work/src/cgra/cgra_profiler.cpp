@@ -0,0 +1,242 @@
+// std
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+// imgui
+#include <imgui.h>
+
+// project
+#include "cgra_profiler.hpp"
+
+
+using namespace std;
+
+
+namespace cgra {
+
+	namespace {
+
+		// one timed block in a frame
+		struct scope_record {
+			const char *name;
+			int depth;
+			bool gpu;
+			double cpu_begin, cpu_end; // ms
+			GLuint queries[2]; // begin and end timestamps
+		};
+
+		// frames alternate between two sets of queries, a frame's results
+		// are read when its set comes around again two frames later
+		struct frame_record {
+			vector<scope_record> scopes;
+			vector<GLuint> query_pool;
+			bool pending = false;
+		};
+
+		// latest resolved timings of a scope
+		struct scope_stats {
+			const char *name;
+			int depth;
+			float cpu_ms;
+			float gpu_ms; // negative if not timed on the GPU
+		};
+
+		const int history_size = 240;
+
+		// internal data
+		bool g_initialized = false;
+		bool g_enabled = false;
+		frame_record g_frames[2];
+		int g_frame = 0;
+		int g_depth = 0;
+		double g_frame_begin = 0;
+		float g_history[history_size] = { };
+		int g_history_next = 0;
+		int g_history_count = 0;
+		vector<scope_stats> g_stats;
+		int g_dropped = 0; // frames whose queries weren't ready in time
+
+		double now_ms() {
+			using namespace chrono;
+			return duration<double, milli>(steady_clock::now().time_since_epoch()).count();
+		}
+
+		frame_record & current_frame() {
+			return g_frames[g_frame & 1];
+		}
+
+		// read back a finished frame, without waiting on the GPU
+		void resolve(frame_record &frame) {
+			frame.pending = false;
+
+			// queries finish in order, so checking the last one is enough
+			GLuint last = 0;
+			for (const auto &s : frame.scopes) {
+				if (s.gpu) last = s.queries[1];
+			}
+			if (last) {
+				GLint available = 0;
+				glGetQueryObjectiv(last, GL_QUERY_RESULT_AVAILABLE, &available);
+				if (!available) {
+					g_dropped++;
+					return;
+				}
+			}
+
+			g_stats.clear();
+			for (const auto &s : frame.scopes) {
+				scope_stats stats = { s.name, s.depth, float(s.cpu_end - s.cpu_begin), -1.f };
+				if (s.gpu) {
+					GLuint64 begin = 0, end = 0;
+					glGetQueryObjectui64v(s.queries[0], GL_QUERY_RESULT, &begin);
+					glGetQueryObjectui64v(s.queries[1], GL_QUERY_RESULT, &end);
+					stats.gpu_ms = float(double(end - begin) * 1e-6);
+				}
+				g_stats.push_back(stats);
+			}
+		}
+
+		float percentile(vector<float> &values, float p) {
+			if (values.empty()) return 0;
+			size_t n = min(values.size() - 1, size_t(p * values.size()));
+			nth_element(values.begin(), values.begin() + n, values.end());
+			return values[n];
+		}
+	}
+
+
+	namespace profiler {
+
+		void init() {
+			g_initialized = true;
+		}
+
+
+		void newFrame() {
+			g_frame_begin = now_ms();
+			g_depth = 0;
+			if (!g_enabled) return;
+
+			frame_record &frame = current_frame();
+			if (frame.pending) resolve(frame);
+			frame.scopes.clear();
+		}
+
+
+		void endFrame() {
+			// CPU frame time is always tracked, it's just two clock reads
+			g_history[g_history_next] = float(now_ms() - g_frame_begin);
+			g_history_next = (g_history_next + 1) % history_size;
+			g_history_count = min(g_history_count + 1, history_size);
+
+			if (g_enabled) {
+				current_frame().pending = !current_frame().scopes.empty();
+				g_frame++;
+			}
+		}
+
+
+		void shutdown() {
+			for (auto &frame : g_frames) {
+				if (!frame.query_pool.empty()) {
+					glDeleteQueries(GLsizei(frame.query_pool.size()), frame.query_pool.data());
+				}
+				frame = frame_record();
+			}
+			g_stats.clear();
+			g_initialized = false;
+		}
+
+
+		void setEnabled(bool enabled) {
+			if (enabled && !g_enabled) {
+				// anything in flight is from before we stopped recording
+				for (auto &frame : g_frames) frame.pending = false;
+				current_frame().scopes.clear();
+			}
+			g_enabled = enabled && g_initialized;
+		}
+
+
+		bool enabled() {
+			return g_enabled;
+		}
+
+
+		void renderGUI(bool *open) {
+			ImGui::SetNextWindowPos(ImVec2(5, 300), ImGuiSetCond_Once);
+			ImGui::SetNextWindowSize(ImVec2(420, 300), ImGuiSetCond_Once);
+			if (!ImGui::Begin("Profiler", open)) {
+				ImGui::End();
+				return;
+			}
+
+			// rolling frame time graph, oldest first
+			float ordered[history_size];
+			for (int i = 0; i < g_history_count; i++) {
+				ordered[i] = g_history[(g_history_next - g_history_count + i + history_size) % history_size];
+			}
+			vector<float> sorted(ordered, ordered + g_history_count);
+			float p50 = percentile(sorted, 0.50f);
+			float p95 = percentile(sorted, 0.95f);
+			float p99 = percentile(sorted, 0.99f);
+			float top = max(p99 * 1.25f, 1.f);
+			ImGui::PlotLines("", ordered, g_history_count, 0, "CPU frame time (ms)", 0, top, ImVec2(ImGui::GetContentRegionAvailWidth(), 80));
+			ImGui::Text("p50 %.2f ms   p95 %.2f ms   p99 %.2f ms", p50, p95, p99);
+
+			// per-scope timings from the last resolved frame
+			ImGui::Separator();
+			ImGui::Columns(3, "scopes", false);
+			ImGui::Text("Scope"); ImGui::NextColumn();
+			ImGui::Text("CPU (ms)"); ImGui::NextColumn();
+			ImGui::Text("GPU (ms)"); ImGui::NextColumn();
+			for (const auto &s : g_stats) {
+				ImGui::Text("%*s%s", s.depth * 2, "", s.name); ImGui::NextColumn();
+				ImGui::Text("%.3f", s.cpu_ms); ImGui::NextColumn();
+				if (s.gpu_ms >= 0) ImGui::Text("%.3f", s.gpu_ms);
+				else ImGui::Text("-");
+				ImGui::NextColumn();
+			}
+			ImGui::Columns(1);
+			if (g_dropped) ImGui::Text("%d frame(s) skipped waiting for GPU queries", g_dropped);
+
+			ImGui::End();
+		}
+
+
+		scope::scope(const char *name, bool gpu) : m_index(-1) {
+			if (!g_enabled) return;
+			frame_record &frame = current_frame();
+			m_index = int(frame.scopes.size());
+
+			scope_record s = { name, g_depth++, gpu, now_ms(), 0, { 0, 0 } };
+			if (gpu) {
+				// grow the query pool as needed, queries are reused every other frame
+				size_t needed = 0;
+				for (const auto &other : frame.scopes) needed += other.gpu ? 2 : 0;
+				if (frame.query_pool.size() < needed + 2) {
+					size_t old_size = frame.query_pool.size();
+					frame.query_pool.resize(needed + 2);
+					glGenQueries(GLsizei(frame.query_pool.size() - old_size), &frame.query_pool[old_size]);
+				}
+				s.queries[0] = frame.query_pool[needed];
+				s.queries[1] = frame.query_pool[needed + 1];
+				glQueryCounter(s.queries[0], GL_TIMESTAMP);
+			}
+			frame.scopes.push_back(s);
+		}
+
+
+		scope::~scope() {
+			if (m_index < 0) return;
+			frame_record &frame = current_frame();
+			if (m_index >= int(frame.scopes.size())) return; // enabled mid-scope
+			scope_record &s = frame.scopes[m_index];
+			if (s.gpu) glQueryCounter(s.queries[1], GL_TIMESTAMP);
+			s.cpu_end = now_ms();
+			g_depth--;
+		}
+	}
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+// project
+#include <opengl.hpp>
+
+
+namespace cgra {
+	namespace profiler {
+
+		// helper functions to setup, run and shutdown the profiler
+		// (GL thread only). Needs a current GL context
+		void init();
+		void newFrame();
+		void endFrame();
+		void shutdown();
+
+		// scopes are only recorded while enabled, so a hidden
+		// profiler costs two clock reads per frame
+		void setEnabled(bool enabled);
+		bool enabled();
+
+		// draws the frame time graph, percentiles and per-scope
+		// timings in an ImGui window. Must be called between
+		// gui::newFrame() and gui::render()
+		void renderGUI(bool *open = nullptr);
+
+		// times the enclosing block on the CPU and, if gpu is true, on the
+		// GPU with a pair of timestamp queries. Results are read two frames
+		// later so the queries never stall. name must outlive the frame
+		// (use string literals)
+		class scope {
+		private:
+			int m_index;
+
+		public:
+			explicit scope(const char *name, bool gpu = true);
+			~scope();
+
+			scope(const scope &) = delete;
+			scope & operator=(const scope &) = delete;
+		};
+	}
+}
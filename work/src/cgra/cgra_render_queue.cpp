@@ -0,0 +1,277 @@
+// std
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+// glm
+#include <glm/gtc/type_ptr.hpp>
+
+// project
+#include "cgra_render_queue.hpp"
+#include "cgra_trace.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+
+namespace cgra {
+
+	void render_queue::clear() {
+		m_passes.clear();
+		m_programs.clear();
+		m_materials.clear();
+		m_vaos.clear();
+		m_transforms.clear();
+		m_items.clear();
+		m_keys.clear();
+	}
+
+
+	void render_queue::set_pass(unsigned pass, pass_begin begin) {
+		if (m_passes.size() <= pass) m_passes.resize(pass + 1);
+		m_passes[pass] = std::move(begin);
+	}
+
+
+	uint32_t render_queue::add_program(GLuint program, program_setup setup) {
+		program_entry entry;
+		entry.program = program;
+		entry.setup = std::move(setup);
+		m_programs.push_back(std::move(entry));
+		return uint32_t(m_programs.size() - 1);
+	}
+
+
+	uint32_t render_queue::add_material(material_apply apply) {
+		m_materials.push_back(std::move(apply));
+		return uint32_t(m_materials.size() - 1);
+	}
+
+
+	uint32_t render_queue::add_vertex_array(GLuint vao) {
+		m_vaos.push_back(vao);
+		return uint32_t(m_vaos.size() - 1);
+	}
+
+
+	uint32_t render_queue::add_transform(const mat4 &model_view) {
+		m_transforms.push_back(model_view);
+		return uint32_t(m_transforms.size() - 1);
+	}
+
+
+	void render_queue::add(unsigned pass, uint32_t program, uint32_t material, uint32_t vao, GLenum mode, GLsizei count, uint32_t first, uint32_t transform, float depth) {
+		set(allocate(1), pass, program, material, vao, mode, count, first, transform, depth);
+	}
+
+
+	size_t render_queue::allocate(size_t count) {
+		size_t first = m_items.size();
+		m_items.resize(first + count);
+		m_keys.resize(first + count);
+		return first;
+	}
+
+
+	size_t render_queue::allocate_transforms(size_t count) {
+		size_t first = m_transforms.size();
+		m_transforms.resize(first + count);
+		return first;
+	}
+
+
+	void render_queue::set(size_t slot, unsigned pass, uint32_t program, uint32_t material, uint32_t vao, GLenum mode, GLsizei count, uint32_t first, uint32_t transform, float depth) {
+		item &i = m_items[slot];
+		i.pass = pass;
+		i.program = program;
+		i.material = material;
+		i.vao = vao;
+		i.mode = mode;
+		i.count = count;
+		i.first = first;
+		i.transform = transform;
+
+		// skipped slots sort last. fields wider than their bits wrap, which
+		// only costs sorting quality
+		uint64_t key = ~uint64_t(0);
+		if (count > 0) {
+			const auto field = [](uint64_t value, int bits) { return value & ((uint64_t(1) << bits) - 1); };
+			uint64_t quantized = uint64_t(glm::clamp(depth, 0.f, 1.f) * float((1 << depth_bits) - 1));
+			key = field(pass, pass_bits);
+			key = (key << program_bits) | field(program, program_bits);
+			key = (key << material_bits) | field(material, material_bits);
+			key = (key << vao_bits) | field(vao, vao_bits);
+			key = (key << depth_bits) | quantized;
+		}
+		m_keys[slot] = { key, uint32_t(slot) };
+	}
+
+
+	void render_queue::radix_sort(vector<pair<uint64_t, uint32_t>> &keys, vector<pair<uint64_t, uint32_t>> &scratch) {
+		const size_t n = keys.size();
+		if (n < 2) return;
+		scratch.resize(n);
+
+		// every histogram in one read over the keys
+		size_t histograms[8][256] = { };
+		for (const auto &k : keys) {
+			for (int digit = 0; digit < 8; digit++) histograms[digit][(k.first >> (digit * 8)) & 0xff]++;
+		}
+
+		for (int digit = 0; digit < 8; digit++) {
+			size_t *histogram = histograms[digit];
+			const int shift = digit * 8;
+			if (histogram[(keys[0].first >> shift) & 0xff] == n) continue; // all the same
+
+			size_t offset = 0;
+			for (int b = 0; b < 256; b++) {
+				size_t count = histogram[b];
+				histogram[b] = offset;
+				offset += count;
+			}
+			for (const auto &k : keys) scratch[histogram[(k.first >> shift) & 0xff]++] = k;
+			keys.swap(scratch);
+		}
+	}
+
+
+	void render_queue::submit() {
+		CGRA_TRACE_SCOPE("render_queue::submit");
+		m_stats = stats();
+		if (m_items.empty()) return;
+
+		auto start = chrono::steady_clock::now();
+		if (m_sorting) radix_sort(m_keys, m_scratch);
+		auto sorted = chrono::steady_clock::now();
+
+		// every transform into the ring, each slot at an offset a uniform
+		// buffer range can start from
+		if (!m_object_data) {
+			GLint alignment = 256;
+			glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+			m_object_stride = (GLsizeiptr(sizeof(mat4)) + alignment - 1) / alignment * alignment;
+			m_object_data = make_unique<stream_buffer>(GL_UNIFORM_BUFFER, 1024 * m_object_stride);
+		}
+		stream_buffer::allocation objects = m_object_data->allocate(std::max<GLsizeiptr>(m_transforms.size(), 1) * m_object_stride, m_object_stride);
+		char *slot = static_cast<char *>(objects.data);
+		for (const mat4 &transform : m_transforms) {
+			memcpy(slot, value_ptr(transform), sizeof(mat4));
+			slot += m_object_stride;
+		}
+		m_object_data->flush(objects);
+		m_object_buffer = m_object_data->buffer();
+		m_object_offset = objects.offset;
+
+		// record contiguous ranges of the sorted list in parallel, big
+		// enough that recording outweighs the cost of a task
+		const size_t min_range = 256;
+		size_t list_count = 1;
+		if (m_pool && m_pool->size() > 1) list_count = glm::clamp<size_t>(m_keys.size() / min_range, 1, m_pool->size());
+		if (m_lists.size() < list_count) m_lists.resize(list_count);
+		m_list_stats.assign(list_count, stats());
+		const size_t per_list = (m_keys.size() + list_count - 1) / list_count;
+		const auto record_list = [&](size_t l) {
+			size_t begin = std::min(m_keys.size(), l * per_list);
+			size_t end = std::min(m_keys.size(), begin + per_list);
+			m_lists[l].clear();
+			record(begin, end, m_lists[l], m_list_stats[l]);
+		};
+		if (list_count == 1) record_list(0);
+		else m_pool->parallel_for(0, list_count, 1, [&](size_t first, size_t last) {
+			for (size_t l = first; l < last; l++) record_list(l);
+		});
+		auto recorded = chrono::steady_clock::now();
+
+		// replay in order on this thread
+		for (size_t l = 0; l < list_count; l++) m_lists[l].replay();
+		glBindVertexArray(0);
+		m_object_data->end_frame();
+		auto replayed = chrono::steady_clock::now();
+
+		for (const stats &counts : m_list_stats) {
+			m_stats.draws += counts.draws;
+			m_stats.passes += counts.passes;
+			m_stats.batches += counts.batches;
+			m_stats.programs += counts.programs;
+			m_stats.materials += counts.materials;
+			m_stats.vaos += counts.vaos;
+			m_stats.transforms += counts.transforms;
+		}
+		m_stats.lists = unsigned(list_count);
+		m_stats.sort_ms = chrono::duration<double, milli>(sorted - start).count();
+		m_stats.record_ms = chrono::duration<double, milli>(recorded - sorted).count();
+		m_stats.replay_ms = chrono::duration<double, milli>(replayed - recorded).count();
+	}
+
+
+	void render_queue::record(size_t begin, size_t end, command_list &list, stats &counts) {
+		// the state left behind by the previous range, which is what will be
+		// bound when this list is replayed
+		const item *current = nullptr;
+		for (size_t k = begin; k-- > 0;) {
+			if (m_items[m_keys[k].second].count > 0) {
+				current = &m_items[m_keys[k].second];
+				break;
+			}
+		}
+		GLuint current_program = current ? m_programs[current->program].program : 0;
+
+		// ranges of the current batch
+		vector<GLsizei> batch_counts;
+		vector<uint32_t> batch_firsts;
+		GLenum batch_mode = GL_TRIANGLES;
+		const auto flush = [&]() {
+			if (batch_counts.empty()) return;
+			if (batch_counts.size() == 1) list.draw_elements(batch_mode, batch_counts[0], batch_firsts[0]);
+			else list.multi_draw_elements(batch_mode, batch_counts.data(), batch_firsts.data(), GLsizei(batch_counts.size()));
+			counts.batches++;
+			batch_counts.clear();
+			batch_firsts.clear();
+		};
+
+		for (size_t k = begin; k < end; k++) {
+			const item &next = m_items[m_keys[k].second];
+			if (next.count == 0) continue; // culled
+			bool pass_changed = !current || next.pass != current->pass;
+			bool program_changed = pass_changed || next.program != current->program;
+			bool material_changed = program_changed || next.material != current->material;
+			bool vao_changed = !current || next.vao != current->vao;
+			bool transform_changed = !current || next.transform != current->transform;
+			if (program_changed || material_changed || vao_changed || transform_changed || next.mode != batch_mode) flush();
+
+			if (pass_changed) {
+				if (next.pass < m_passes.size() && m_passes[next.pass]) list.call(&m_passes[next.pass], next.pass);
+				current_program = 0; // set the program up again
+				counts.passes++;
+			}
+			const program_entry &program = m_programs[next.program];
+			if (program_changed && program.program != current_program) {
+				list.use_program(program.program);
+				current_program = program.program;
+				if (program.setup) list.call(&program.setup, program.program);
+				counts.programs++;
+			}
+			if (material_changed) {
+				if (m_materials[next.material]) list.call(&m_materials[next.material], program.program);
+				counts.materials++;
+			}
+			if (vao_changed) {
+				list.bind_vertex_array(m_vaos[next.vao]);
+				counts.vaos++;
+			}
+			if (transform_changed) {
+				list.bind_buffer_range(GL_UNIFORM_BUFFER, object_binding, m_object_buffer, m_object_offset + next.transform * m_object_stride, sizeof(mat4));
+				counts.transforms++;
+			}
+
+			batch_mode = next.mode;
+			batch_counts.push_back(next.count);
+			batch_firsts.push_back(next.first);
+			counts.draws++;
+			current = &next;
+		}
+		flush();
+	}
+
+}
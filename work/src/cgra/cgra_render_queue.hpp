@@ -0,0 +1,183 @@
+#pragma once
+
+// std
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include <opengl.hpp>
+#include "cgra_command_list.hpp"
+#include "cgra_stream_buffer.hpp"
+#include "cgra_thread_pool.hpp"
+
+
+namespace cgra {
+
+	// collects the frame's draws, sorts them by a 64-bit key and submits
+	// them changing only the state that differs from the previous draw.
+	//
+	// The key is, from the most significant bits down:
+	//
+	//   pass (4) | program (12) | material (12) | vertex array (12) | depth (24)
+	//
+	// so draws are grouped by pass, then by the most expensive state, and
+	// front to back within the same state. Programs, materials and vertex
+	// arrays get small ids in the order they are first added each frame.
+	// Consecutive draws that share all state are merged into a single
+	// glMultiDrawElements call.
+	//
+	// With a thread pool, draws can be filled in from worker threads
+	// (allocate() then set()) and the sorted list is recorded into command
+	// lists in parallel, one contiguous range each, which the GL thread
+	// then replays in order. Each range starts from the state the previous
+	// range leaves behind, so splitting adds no state changes.
+	//
+	// Transforms are written into a uniform buffer ring once per submit,
+	// and programs read theirs from a std140 block bound at object_binding
+	// (see shader_builder::set_uniform_block_binding):
+	//
+	//   layout(std140) uniform ObjectData { mat4 uModelViewMatrix; };
+	//
+	// Switching transforms is then a glBindBufferRange, which unlike a
+	// uniform doesn't need redoing when the program changes.
+	//
+	// Passes can have a callback to set up for their draws (a viewport and
+	// camera, say). Since it may change what a program's setup depends on,
+	// the program and material are applied again after it.
+	class render_queue {
+	public:
+		static constexpr int pass_bits = 4;
+		static constexpr int program_bits = 12;
+		static constexpr int material_bits = 12;
+		static constexpr int vao_bits = 12;
+		static constexpr int depth_bits = 24;
+
+		// uniform buffer binding point of the ObjectData block
+		static constexpr GLuint object_binding = 1;
+
+		// called with the program in use when a program is switched to
+		// (per frame uniforms) or a material is applied (material uniforms)
+		using program_setup = std::function<void(GLuint program)>;
+		using material_apply = std::function<void(GLuint program)>;
+
+		// called with the pass number before the pass's first draw
+		using pass_begin = std::function<void(GLuint pass)>;
+
+		// counted by the last submit()
+		struct stats {
+			unsigned draws = 0;       // items submitted
+			unsigned passes = 0;      // passes begun
+			unsigned batches = 0;     // GL draw calls after merging
+			unsigned programs = 0;    // glUseProgram calls
+			unsigned materials = 0;   // material applies
+			unsigned vaos = 0;        // glBindVertexArray calls
+			unsigned transforms = 0;  // ObjectData range binds
+			unsigned lists = 0;       // command lists recorded
+			double sort_ms = 0;
+			double record_ms = 0;     // wall time, across the pool
+			double replay_ms = 0;     // GL thread
+			unsigned state_changes() const { return programs + materials + vaos + transforms; }
+		};
+
+	private:
+		struct program_entry {
+			GLuint program;
+			program_setup setup;
+		};
+
+		struct item {
+			std::uint32_t pass;
+			std::uint32_t program;
+			std::uint32_t material;
+			std::uint32_t vao;
+			GLenum mode;
+			GLsizei count; // 0 for culled slots
+			std::uint32_t first; // first index
+			std::uint32_t transform;
+		};
+
+		thread_pool *m_pool;
+		std::vector<pass_begin> m_passes; // by pass number, empty for none
+		std::vector<program_entry> m_programs;
+		std::vector<material_apply> m_materials;
+		std::vector<GLuint> m_vaos;
+		std::vector<glm::mat4> m_transforms;
+		std::vector<item> m_items;
+
+		// the transforms as ObjectData blocks, one aligned slot each. The
+		// ring is created by the first submit, on the GL thread
+		std::unique_ptr<stream_buffer> m_object_data;
+		GLsizeiptr m_object_stride = 0;
+		GLuint m_object_buffer = 0; // this submit's slots, for recording
+		GLintptr m_object_offset = 0;
+
+		// (key, item index), sorted in place with m_scratch as the other buffer
+		std::vector<std::pair<std::uint64_t, std::uint32_t>> m_keys;
+		std::vector<std::pair<std::uint64_t, std::uint32_t>> m_scratch;
+
+		// one command list and its stats per recorded range
+		std::vector<command_list> m_lists;
+		std::vector<stats> m_list_stats;
+
+		bool m_sorting = true;
+		stats m_stats;
+
+		void record(std::size_t begin, std::size_t end, command_list &list, stats &counts);
+
+	public:
+		// pool is used for recording, or nullptr to record on the calling thread
+		explicit render_queue(thread_pool *pool = nullptr) : m_pool(pool) { }
+
+		// remove copy ctors
+		render_queue(const render_queue &) = delete;
+		render_queue & operator=(const render_queue &) = delete;
+
+		// forget this frame's draws, passes, programs, materials and transforms
+		void clear();
+
+		// set pass up with begin (on the GL thread) before its draws
+		void set_pass(unsigned pass, pass_begin begin);
+
+		// register state for this frame, the returned ids go in add() and set()
+		std::uint32_t add_program(GLuint program, program_setup setup);
+		std::uint32_t add_material(material_apply apply);
+		std::uint32_t add_vertex_array(GLuint vao);
+		std::uint32_t add_transform(const glm::mat4 &model_view);
+
+		// queue glDrawElements(mode, count, GL_UNSIGNED_INT, first index) with
+		// the vertex array bound. depth is in [0, 1] and draws front to back
+		// within the same state, pass 1 - depth for back to front
+		void add(unsigned pass, std::uint32_t program, std::uint32_t material, std::uint32_t vao, GLenum mode, GLsizei count, std::uint32_t first, std::uint32_t transform, float depth);
+
+		// reserve slots for draws and transforms to be filled in by set() and
+		// set_transform(), which are safe to call from several threads at once
+		// for different slots. Returns the first slot. A draw slot with a
+		// count of 0 is skipped
+		std::size_t allocate(std::size_t count);
+		std::size_t allocate_transforms(std::size_t count);
+		void set(std::size_t slot, unsigned pass, std::uint32_t program, std::uint32_t material, std::uint32_t vao, GLenum mode, GLsizei count, std::uint32_t first, std::uint32_t transform, float depth);
+		void set_transform(std::size_t slot, const glm::mat4 &model_view) { m_transforms[slot] = model_view; }
+
+		// false submits in the order draws were added, for comparison
+		void set_sorting(bool sorting) { m_sorting = sorting; }
+		bool sorting() const { return m_sorting; }
+
+		// sort (if enabled), record and draw everything queued since clear()
+		void submit();
+
+		std::size_t size() const { return m_items.size(); }
+		const stats & last_stats() const { return m_stats; }
+
+		// stable LSD radix sort on the keys, 8 bits a pass. Passes where
+		// every key has the same digit are skipped, so keys that only use
+		// a few fields cost a few passes
+		static void radix_sort(std::vector<std::pair<std::uint64_t, std::uint32_t>> &keys, std::vector<std::pair<std::uint64_t, std::uint32_t>> &scratch);
+	};
+
+}
@@ -1,16 +1,37 @@
 
 // std
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <random>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
 // project
 #include "cgra_shader.hpp"
+#include "cgra_trace.hpp"
 #include <opengl.hpp>
 
 
+// GL_KHR_parallel_shader_compile (and the identical ARB version) came
+// after our version of GLEW, so define what we use by hand
+#ifndef GL_MAX_SHADER_COMPILER_THREADS_KHR
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#endif
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+typedef void (APIENTRY *PFN_glMaxShaderCompilerThreads)(GLuint count);
+
+
 // forward declaration
 class shader_error : public std::runtime_error {
 public:
@@ -36,57 +57,139 @@ public:
 };
 
 
-void printShaderInfoLog(GLuint obj) {
+std::string getShaderInfoLog(GLuint obj) {
 	int infologLength = 0;
 	int charsWritten = 0;
 	glGetShaderiv(obj, GL_INFO_LOG_LENGTH, &infologLength);
 	if (infologLength > 1) {
 		std::vector<char> infoLog(infologLength);
 		glGetShaderInfoLog(obj, infologLength, &charsWritten, &infoLog[0]);
-		std::cout << "CGRA Shader : " << "SHADER :\n" << &infoLog[0] << std::endl;
+		return &infoLog[0];
 	}
+	return "";
 }
 
 
-void printProgramInfoLog(GLuint obj) {
+std::string getProgramInfoLog(GLuint obj) {
 	int infologLength = 0;
 	int charsWritten = 0;
 	glGetProgramiv(obj, GL_INFO_LOG_LENGTH, &infologLength);
 	if (infologLength > 1) {
 		std::vector<char> infoLog(infologLength);
 		glGetProgramInfoLog(obj, infologLength, &charsWritten, &infoLog[0]);
-		std::cout << "CGRA Shader : " << "PROGRAM :\n" << &infoLog[0] << std::endl;
+		return &infoLog[0];
 	}
+	return "";
+}
+
+
+void printShaderInfoLog(GLuint obj) {
+	std::string infoLog = getShaderInfoLog(obj);
+	if (!infoLog.empty()) std::cout << "CGRA Shader : " << "SHADER :\n" << infoLog << std::endl;
+}
+
+
+void printProgramInfoLog(GLuint obj) {
+	std::string infoLog = getProgramInfoLog(obj);
+	if (!infoLog.empty()) std::cout << "CGRA Shader : " << "PROGRAM :\n" << infoLog << std::endl;
 }
 
 
 namespace cgra {
 
-	void shader_builder::set_shader(GLenum type, const std::string &filename) {
-		std::ifstream fileStream(filename);
+	namespace {
+		// a name next to filename that no other thread or instance will
+		// pick, a random per process prefix and a counter
+		std::string temporary_filename(const std::string &filename) {
+			static const std::uint64_t process = (std::uint64_t(std::random_device()()) << 32) ^ std::uint64_t(std::chrono::system_clock::now().time_since_epoch().count());
+			static std::atomic<unsigned> counter{ 0 };
+			std::ostringstream name;
+			name << filename << "." << std::hex << process << "." << counter.fetch_add(1) << ".tmp";
+			return name.str();
+		}
+	}
 
-		if (!fileStream) {
+	std::string shader_builder::s_cache_directory;
+	std::map<std::string, GLuint> shader_builder::s_block_bindings;
+
+
+	bool shader_builder::parallel_compile_supported() {
+		// checked once, the first time there's a current context
+		static const bool supported = []() {
+			const char *name = nullptr;
+			if (glfwExtensionSupported("GL_KHR_parallel_shader_compile")) name = "glMaxShaderCompilerThreadsKHR";
+			else if (glfwExtensionSupported("GL_ARB_parallel_shader_compile")) name = "glMaxShaderCompilerThreadsARB";
+			if (!name) return false;
+
+			// let the driver use as many threads as it likes
+			auto max_threads = reinterpret_cast<PFN_glMaxShaderCompilerThreads>(glfwGetProcAddress(name));
+			if (max_threads) max_threads(0xFFFFFFFFu);
+			return true;
+		}();
+		return supported;
+	}
+
+
+	void shader_builder::set_cache_directory(const std::string &directory) {
+		s_cache_directory = directory;
+	}
+
+
+	void shader_builder::set_uniform_block_binding(const std::string &block, GLuint binding) {
+		s_block_bindings[block] = binding;
+	}
+
+
+	void shader_builder::bind_uniform_blocks(GLuint program) const {
+		// linking (or loading a binary) resets every block to binding 0
+		for (auto &block_pair : s_block_bindings) {
+			GLuint index = glGetUniformBlockIndex(program, block_pair.first.c_str());
+			if (index != GL_INVALID_INDEX) glUniformBlockBinding(program, index, block_pair.second);
+		}
+	}
+
+
+	void shader_builder::set_shader(GLenum type, const std::string &filename) {
+		if (!try_set_shader(type, filename)) {
 			std::cerr << "Error: Could not locate and open file " << filename << std::endl;
 			throw std::runtime_error("Error: Could not locate and open file " + filename);
 		}
+	}
+
+
+	void shader_builder::set_shader_source(GLenum type, const std::string &source) {
+		try_set_shader_source(type, source);
+	}
+
+
+	bool shader_builder::try_set_shader(GLenum type, const std::string &filename) {
+		m_files[type] = filename;
+		std::ifstream fileStream(filename);
+		if (!fileStream) {
+			m_log += "Could not locate and open file " + filename + "\n";
+			return false;
+		}
 
 		std::stringstream buffer;
 		buffer << fileStream.rdbuf();
+		return try_set_shader_source(type, buffer.str());
+	}
 
-		try {
-			set_shader_source(type, buffer.str());
-		}
-		catch (shader_compile_error &e) {
-			std::cerr << "Error: Could not compile " << filename << std::endl;
-			throw e;
-		}
+
+	bool shader_builder::try_set_shader_source(GLenum type, const std::string &source) {
+		// compiled lazily by build(), which may not need to at all
+		m_sources[type] = source;
+		return true;
 	}
 
 
-	void shader_builder::set_shader_source(GLenum type, const std::string &source) {
+	void shader_builder::set_define(const std::string &name, const std::string &value) {
+		m_defines[name] = value;
+	}
+
 
-		// same as GLint shader = glCreateShader(type);
-		gl_object shader = gl_object::gen_shader(type);
+	std::string shader_builder::final_source(GLenum type) const {
+		const std::string &source = m_sources.at(type);
 
 		// cgra specific extra (allows different shaders to be defined in a single source)
 		// Start of CGRA addition
@@ -118,23 +221,14 @@ namespace cgra {
 				break;
 		}
 		oss << "#define " << get_define(type) << std::endl;
+		for (auto &define : m_defines) {
+			oss << "#define " << define.first << ' ' << define.second << std::endl;
+		}
 		oss << iss.rdbuf();
-		std::string final_source = oss.str();
 		//
 		// End of CGRA addition
 
-		// upload and compile the shader
-		const char *text_c = final_source.c_str();
-		glShaderSource(shader, 1, &text_c, nullptr);
-		glCompileShader(shader);
-
-		// check compilation status
-		GLint compile_status;
-		glGetShaderiv(shader, GL_COMPILE_STATUS, &compile_status);
-		printShaderInfoLog(shader); // print warnings and errors
-		if (!compile_status) throw shader_compile_error();
-
-		m_shaders[type] = std::make_shared<gl_object>(std::move(shader));
+		return oss.str();
 	}
 
 
@@ -158,21 +252,519 @@ namespace cgra {
 			program = glCreateProgram();
 		}
 
+		if (load_binary(program)) {
+			bind_uniform_blocks(program);
+			return program;
+		}
+		compile();
+		link(program);
+		if (!check_compile()) throw shader_compile_error();
+		if (!check_link(program)) throw shader_link_error();
+		save_binary(program);
+		bind_uniform_blocks(program);
+		return program;
+	}
+
+
+	GLuint shader_builder::try_build() {
+		GLuint program = begin_build();
+		if (!finish_build(program)) {
+			glDeleteProgram(program);
+			return 0;
+		}
+		return program;
+	}
+
+
+	GLuint shader_builder::begin_build() {
+		GLuint program = glCreateProgram();
+		if (load_binary(program)) return program;
+		compile();
+		link(program);
+		return program;
+	}
+
+
+	bool shader_builder::build_complete(GLuint program) const {
+		if (m_loaded_from_cache || !parallel_compile_supported()) return true;
+		GLint complete = GL_FALSE;
+		glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &complete);
+		return complete;
+	}
+
+
+	bool shader_builder::finish_build(GLuint program) {
+		if (!m_loaded_from_cache) {
+			if (!check_compile() || !check_link(program)) return false;
+			save_binary(program);
+		}
+		bind_uniform_blocks(program);
+		return true;
+	}
+
+
+	void shader_builder::compile() {
+		CGRA_TRACE_SCOPE("shader_builder::compile");
+		for (auto &source_pair : m_sources) {
+			if (m_shaders.count(source_pair.first)) continue; // compiled by an earlier build
+
+			// same as GLint shader = glCreateShader(type);
+			gl_object shader = gl_object::gen_shader(source_pair.first);
+
+			// upload and compile the shader, without asking for the result
+			// so drivers that compile on other threads can get on with it
+			std::string text = final_source(source_pair.first);
+			const char *text_c = text.c_str();
+			glShaderSource(shader, 1, &text_c, nullptr);
+			glCompileShader(shader);
+
+			m_shaders[source_pair.first] = std::make_shared<gl_object>(std::move(shader));
+		}
+	}
+
+
+	bool shader_builder::check_compile() {
+		bool compiled = true;
+		for (auto &shader_pair : m_shaders) {
+			GLuint shader = *(shader_pair.second);
+
+			// check compilation status
+			GLint compile_status;
+			glGetShaderiv(shader, GL_COMPILE_STATUS, &compile_status);
+			printShaderInfoLog(shader); // print warnings and errors
+			if (!compile_status) {
+				auto file = m_files.find(shader_pair.first);
+				std::string name = file != m_files.end() ? file->second : "shader source";
+				std::cerr << "Error: Could not compile " << name << std::endl;
+				m_log += "In " + name + ":\n" + getShaderInfoLog(shader);
+				compiled = false;
+			}
+		}
+		return compiled;
+	}
+
+
+	void shader_builder::link(GLuint program) {
+		CGRA_TRACE_SCOPE("shader_builder::link");
+
 		// attach shaders
 		for (auto &shader_pair : m_shaders) {
 			glAttachShader(program, *(shader_pair.second));
 		}
 
-		// link the program
+		// ask for a binary we can cache
+		if (binary_cache_enabled()) {
+			glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		}
+
+		// link the program, the result is checked in check_link
 		glLinkProgram(program);
+	}
+
 
+	bool shader_builder::check_link(GLuint program) {
 		// check link status
 		GLint link_status;
 		glGetProgramiv(program, GL_LINK_STATUS, &link_status);
 		printProgramInfoLog(program); // print warnings and errors
-		if (!link_status) throw shader_link_error();
+		if (!link_status) m_log += getProgramInfoLog(program);
+		return link_status;
+	}
+
+
+	bool shader_builder::binary_cache_enabled() const {
+		if (s_cache_directory.empty()) return false;
+		if (!GLEW_ARB_get_program_binary) return false;
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		return formats > 0;
+	}
+
+
+	std::string shader_builder::cache_filename() const {
+		// FNV-1a over the driver and the exact sources the driver would see
+		std::uint64_t hash = 14695981039346656037ull;
+		const auto add = [&](const std::string &text) {
+			for (unsigned char c : text) {
+				hash = (hash ^ c) * 1099511628211ull;
+			}
+			hash = (hash ^ 0xFF) * 1099511628211ull; // separator
+		};
+		add(reinterpret_cast<const char *>(glGetString(GL_VENDOR)));
+		add(reinterpret_cast<const char *>(glGetString(GL_RENDERER)));
+		add(reinterpret_cast<const char *>(glGetString(GL_VERSION)));
+		for (auto &source_pair : m_sources) {
+			add(std::to_string(source_pair.first));
+			add(final_source(source_pair.first));
+		}
+
+		std::ostringstream name;
+		name << std::hex << std::setw(16) << std::setfill('0') << hash << ".bin";
+		return (std::filesystem::path(s_cache_directory) / name.str()).string();
+	}
 
+
+	bool shader_builder::load_binary(GLuint program) {
+		m_loaded_from_cache = false;
+		if (!binary_cache_enabled()) return false;
+		CGRA_TRACE_SCOPE("shader_builder::load_binary");
+
+		std::string filename = cache_filename();
+		std::ifstream file(filename, std::ios::binary);
+		if (!file) return false;
+
+		// format followed by the binary
+		GLenum format = 0;
+		file.read(reinterpret_cast<char *>(&format), sizeof(format));
+		std::vector<char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		file.close();
+
+		// an unknown format would be a GL error rather than a failed link
+		GLint format_count = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &format_count);
+		std::vector<GLint> formats(format_count);
+		glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, formats.data());
+		bool known_format = std::find(formats.begin(), formats.end(), GLint(format)) != formats.end();
+
+		// drivers reject binaries from other versions (or just because), in
+		// which case the program is left unlinked and we compile instead
+		GLint link_status = GL_FALSE;
+		if (known_format && !binary.empty()) {
+			glProgramBinary(program, format, binary.data(), GLsizei(binary.size()));
+			glGetProgramiv(program, GL_LINK_STATUS, &link_status);
+		}
+		if (!link_status) {
+			std::cout << "CGRA Shader : cached binary " << filename << " was rejected, recompiling" << std::endl;
+			std::error_code ec;
+			std::filesystem::remove(filename, ec);
+			return false;
+		}
+		m_loaded_from_cache = true;
+		return true;
+	}
+
+
+	void shader_builder::save_binary(GLuint program) {
+		if (!binary_cache_enabled()) return;
+		CGRA_TRACE_SCOPE("shader_builder::save_binary");
+
+		GLint length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0) return;
+		std::vector<char> binary(length);
+		GLenum format = 0;
+		glGetProgramBinary(program, length, &length, &format, binary.data());
+
+		// each writer has its own temporary file, renamed over the entry
+		// once complete. Readers see the old binary or a whole new one
+		std::error_code ec;
+		std::filesystem::create_directories(s_cache_directory, ec);
+		std::string filename = cache_filename();
+		std::string temporary = temporary_filename(filename);
+		{
+			std::ofstream file(temporary, std::ios::binary);
+			file.write(reinterpret_cast<const char *>(&format), sizeof(format));
+			file.write(binary.data(), length);
+			if (!file) {
+				std::cerr << "Warning: Could not write shader cache " << temporary << std::endl;
+				file.close();
+				std::filesystem::remove(temporary, ec);
+				return;
+			}
+		}
+		std::filesystem::rename(temporary, filename, ec);
+		if (ec) std::filesystem::remove(temporary, ec);
+	}
+
+
+	shader_batch::~shader_batch() {
+		for (job &j : m_jobs) {
+			if (!j.finished) glDeleteProgram(j.program);
+		}
+	}
+
+
+	std::size_t shader_batch::add(shader_builder builder, const std::string &name) {
+		job j;
+		j.name = name;
+		j.builder = std::move(builder);
+		j.program = j.builder.begin_build();
+		m_pending++;
+		if (!m_free.empty()) {
+			std::size_t i = m_free.back();
+			m_free.pop_back();
+			m_jobs[i] = std::move(j);
+			return i;
+		}
+		m_jobs.push_back(std::move(j));
+		return m_jobs.size() - 1;
+	}
+
+
+	void shader_batch::finish(job &j) {
+		j.ok = j.builder.finish_build(j.program);
+		if (!j.ok) {
+			j.log = j.builder.log();
+			glDeleteProgram(j.program);
+			j.program = 0;
+		}
+		j.finished = true;
+		j.builder = shader_builder(); // release the shader objects
+		m_pending--;
+	}
+
+
+	std::size_t shader_batch::update() {
+		if (m_pending == 0) return 0;
+		CGRA_TRACE_SCOPE("shader_batch::update");
+		bool parallel = shader_builder::parallel_compile_supported();
+		for (job &j : m_jobs) {
+			if (j.finished) continue;
+			if (j.builder.build_complete(j.program)) {
+				// finish releases the builder, so ask about the cache first
+				bool cached = j.builder.loaded_from_cache();
+				finish(j);
+				// without parallel compile "complete" just means "would block"
+				if (!parallel && !cached) break;
+			}
+		}
+		return m_pending;
+	}
+
+
+	void shader_batch::wait(std::size_t i) {
+		if (!m_jobs[i].finished) finish(m_jobs[i]);
+	}
+
+
+	void shader_batch::release(std::size_t i) {
+		job &j = m_jobs[i];
+		if (!j.finished || j.released) return;
+		j.released = true;
+		j.log.clear();
+		m_free.push_back(i);
+	}
+
+
+	shader_permutations::~shader_permutations() {
+		for (auto &program : m_programs) {
+			glDeleteProgram(program.second);
+		}
+	}
+
+
+	void shader_permutations::set_shader(GLenum type, const std::string &filename) {
+		m_files[type] = filename;
+	}
+
+
+	std::uint64_t shader_permutations::add_feature(const std::string &define) {
+		if (m_features.size() == 64) throw std::length_error("Too many shader features");
+		m_features.push_back(define);
+		return std::uint64_t(1) << (m_features.size() - 1);
+	}
+
+
+	shader_builder shader_permutations::make_builder(std::uint64_t features) const {
+		shader_builder builder;
+		for (std::size_t i = 0; i < m_features.size(); i++) {
+			if (features & (std::uint64_t(1) << i)) builder.set_define(m_features[i]);
+		}
+		for (auto &file : m_files) {
+			builder.set_shader(file.first, file.second);
+		}
+		return builder;
+	}
+
+
+	GLuint shader_permutations::get(std::uint64_t features) {
+		auto it = m_programs.find(features);
+		if (it != m_programs.end()) return it->second;
+		if (m_failed.count(features)) throw shader_error("Shader variant [" + describe(features) + "] failed to build");
+
+		// already building, finish it now
+		auto building = m_building.find(features);
+		if (building != m_building.end()) {
+			m_batch.wait(building->second);
+			update();
+			it = m_programs.find(features);
+			if (it != m_programs.end()) return it->second;
+			// failed, build again below so the error is thrown as usual
+			m_failed.erase(features);
+		}
+
+		CGRA_TRACE_SCOPE("shader_permutations::get");
+		auto start = std::chrono::steady_clock::now();
+		shader_builder builder = make_builder(features);
+		GLuint program = 0;
+		try {
+			program = builder.build();
+		}
+		catch (...) {
+			m_failed.insert(features);
+			throw;
+		}
+		m_programs[features] = program;
+
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		std::cout << "CGRA Shader : built variant [" << describe(features) << "] in " << elapsed.count() << " ms";
+		std::cout << (builder.loaded_from_cache() ? " (cached binary)" : " (compiled)") << std::endl;
 		return program;
 	}
 
+
+	void shader_permutations::prefetch(std::uint64_t features) {
+		if (m_programs.count(features) || m_building.count(features) || m_failed.count(features)) return;
+		m_building[features] = m_batch.add(make_builder(features), describe(features));
+	}
+
+
+	GLuint shader_permutations::try_get(std::uint64_t features) {
+		update();
+		auto it = m_programs.find(features);
+		if (it != m_programs.end()) return it->second;
+		prefetch(features);
+		return 0;
+	}
+
+
+	void shader_permutations::update() {
+		if (m_building.empty()) return;
+		m_batch.update();
+		for (auto it = m_building.begin(); it != m_building.end();) {
+			if (!m_batch.finished(it->second)) {
+				++it;
+				continue;
+			}
+			GLuint program = m_batch.program(it->second);
+			if (program) {
+				m_programs[it->first] = program;
+				std::cout << "CGRA Shader : built variant [" << describe(it->first) << "] in the background" << std::endl;
+			}
+			else {
+				std::cerr << "Error: Could not build variant [" << describe(it->first) << "]" << std::endl;
+				m_failed.insert(it->first);
+			}
+			m_batch.release(it->second);
+			it = m_building.erase(it);
+		}
+	}
+
+
+	bool shader_permutations::try_rebuild(std::string &log) {
+		// the files changed, failed variants may build now
+		m_failed.clear();
+		std::unordered_map<std::uint64_t, GLuint> rebuilt;
+		for (auto &program : m_programs) {
+			shader_builder builder;
+			GLuint replacement = 0;
+			try {
+				builder = make_builder(program.first);
+				replacement = builder.try_build();
+			}
+			catch (const std::runtime_error &e) {
+				// a file could not be read
+				log = "Variant [" + describe(program.first) + "]\n" + e.what() + "\n";
+				for (auto &p : rebuilt) glDeleteProgram(p.second);
+				return false;
+			}
+			if (!replacement) {
+				log = "Variant [" + describe(program.first) + "]\n" + builder.log();
+				for (auto &p : rebuilt) glDeleteProgram(p.second);
+				return false;
+			}
+			rebuilt[program.first] = replacement;
+		}
+		for (auto &program : m_programs) {
+			glDeleteProgram(program.second);
+		}
+		m_programs = std::move(rebuilt);
+		return true;
+	}
+
+
+	std::string shader_permutations::describe(std::uint64_t features) const {
+		std::string names;
+		for (std::size_t i = 0; i < m_features.size(); i++) {
+			if (features & (std::uint64_t(1) << i)) names += (names.empty() ? "" : " ") + m_features[i];
+		}
+		return names.empty() ? "base" : names;
+	}
+
+
+	shader_reloader::shader_reloader(std::function<void()> on_change) : m_watcher(std::move(on_change)) { }
+
+
+	void shader_reloader::add(const std::map<GLenum, std::string> &files, const std::string &name, std::function<bool(std::string &)> rebuild) {
+		entry e{ {}, name, std::move(rebuild), "" };
+		for (auto &file : files) {
+			m_watcher.watch(file.second);
+			e.files.push_back(file_watcher::normalize(file.second));
+		}
+		m_programs.push_back(std::move(e));
+	}
+
+
+	void shader_reloader::add(GLuint &program, const shader_builder &builder, const std::string &name) {
+		std::map<GLenum, std::string> files = builder.files();
+		add(files, name, [&program, files](std::string &log) {
+			shader_builder rebuilt;
+			bool read = true;
+			for (auto &file : files) {
+				read = rebuilt.try_set_shader(file.first, file.second) && read;
+			}
+			GLuint replacement = read ? rebuilt.try_build() : 0;
+			if (!replacement) {
+				log = rebuilt.log();
+				return false;
+			}
+			glDeleteProgram(program);
+			program = replacement;
+			return true;
+		});
+	}
+
+
+	void shader_reloader::add(shader_permutations &permutations, const std::string &name) {
+		add(permutations.files(), name, [&permutations](std::string &log) {
+			return permutations.try_rebuild(log);
+		});
+	}
+
+
+	bool shader_reloader::update() {
+		if (!m_watcher.pending()) return false;
+		CGRA_TRACE_SCOPE("shader_reloader::update");
+		std::vector<std::string> changed = m_watcher.take_changed();
+
+		bool replaced = false;
+		for (entry &e : m_programs) {
+			bool affected = std::any_of(e.files.begin(), e.files.end(), [&](const std::string &file) {
+				return std::find(changed.begin(), changed.end(), file) != changed.end();
+			});
+			if (!affected) continue;
+
+			// build separately, only swapped in if everything worked
+			auto start = std::chrono::steady_clock::now();
+			if (!e.rebuild(e.error)) {
+				std::cerr << "Error: Could not rebuild shader program " << e.name << ", keeping the old one" << std::endl;
+				continue;
+			}
+			e.error.clear();
+			replaced = true;
+			std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+			std::cout << "Reloaded shader program " << e.name << " in " << elapsed.count() << " ms" << std::endl;
+		}
+		return replaced;
+	}
+
+
+	std::vector<shader_reloader::program_error> shader_reloader::errors() const {
+		std::vector<program_error> errors;
+		for (const entry &e : m_programs) {
+			if (!e.error.empty()) errors.push_back({ e.name, e.error });
+		}
+		return errors;
+	}
+
 }
\ No newline at end of file
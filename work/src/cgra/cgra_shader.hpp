@@ -2,26 +2,262 @@
 #pragma once
 
 // std
+#include <cstdint>
+#include <functional>
 #include <map>
 #include <memory>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 // project
 #include <opengl.hpp>
+#include "cgra_file_watcher.hpp"
 
 
 namespace cgra {
 
+	// collects shader sources and builds them into a program. Sources are
+	// only compiled in build(), and not at all if a program binary for the
+	// exact same sources and driver is in the cache directory
 	class shader_builder {
 	private:
+		std::map<GLenum, std::string> m_sources; // as given, see final_source()
+		std::map<std::string, std::string> m_defines; // added after #version
 		std::map<GLenum, std::shared_ptr<gl_object>> m_shaders;
+		std::map<GLenum, std::string> m_files; // source files, for reloading
+		std::string m_log; // compile and link errors
+		bool m_loaded_from_cache = false;
+
+		static std::string s_cache_directory;
+		static std::map<std::string, GLuint> s_block_bindings;
+
+		std::string final_source(GLenum type) const;
+		void bind_uniform_blocks(GLuint program) const;
+
+		// these only issue the GL calls, check_* wait for the results
+		void compile();
+		void link(GLuint program);
+		bool check_compile();
+		bool check_link(GLuint program);
+
+		// program binary cache
+		bool binary_cache_enabled() const;
+		std::string cache_filename() const;
+		bool load_binary(GLuint program);
+		void save_binary(GLuint program);
 
 	public:
 		shader_builder() { }
 		void set_shader(GLenum type, const std::string &filename);
 		void set_shader_source(GLenum type, const std::string &shadersource);
 
+		// adds '#define name value' to every stage, after the stage's own
+		// define (_VERTEX_ etc). Used for compile time shader variants
+		void set_define(const std::string &name, const std::string &value = "");
+
+		// compiles (or loads from the cache) and links, throws on failure
 		GLuint build(GLuint program = 0);
+
+		// as above, but return false (or 0) and append the error to log()
+		// instead of throwing. try_build always creates a new program
+		bool try_set_shader(GLenum type, const std::string &filename);
+		bool try_set_shader_source(GLenum type, const std::string &shadersource);
+		GLuint try_build();
+
+		// try_build split in two so many programs can compile at once.
+		// begin_build issues the compile and link and returns the new
+		// program, build_complete says whether finish_build would block,
+		// and finish_build checks the result (false and log() on failure)
+		GLuint begin_build();
+		bool build_complete(GLuint program) const;
+		bool finish_build(GLuint program);
+
+		// true if the driver compiles in the background and can be polled
+		// (GL_KHR_parallel_shader_compile or GL_ARB_parallel_shader_compile)
+		static bool parallel_compile_supported();
+
+		const std::map<GLenum, std::string> & files() const { return m_files; }
+		const std::string & log() const { return m_log; }
+
+		// true if the last build came from a cached program binary
+		bool loaded_from_cache() const { return m_loaded_from_cache; }
+
+		// where program binaries are cached (needs GL_ARB_get_program_binary),
+		// empty (the default) disables the cache
+		static void set_cache_directory(const std::string &directory);
+
+		// uniform blocks called block get this binding point in every program
+		// built from then on. GLSL 3.30 has no layout(binding = n), so blocks
+		// shared between programs are bound here, after linking
+		static void set_uniform_block_binding(const std::string &block, GLuint binding);
+	};
+
+
+	// compiles and links many programs at once. Every compile and link is
+	// issued up front and the results are collected by polling update()
+	// (eg. once a frame), so with parallel compile support nothing waits on
+	// the driver. Without it update() finishes one program per call, which
+	// blocks but spreads the cost over frames. Programs that built belong
+	// to the caller, failed or unfinished ones are deleted by the batch
+	class shader_batch {
+	private:
+		struct job {
+			std::string name;
+			shader_builder builder;
+			GLuint program = 0;
+			bool finished = false;
+			bool ok = false;
+			bool released = false;
+			std::string log;
+		};
+
+		std::vector<job> m_jobs;
+		std::vector<std::size_t> m_free; // released jobs, reused by add
+		std::size_t m_pending = 0;
+
+		void finish(job &j);
+
+	public:
+		shader_batch() { }
+		~shader_batch();
+
+		// remove copy ctors
+		shader_batch(const shader_batch &) = delete;
+		shader_batch & operator=(const shader_batch &) = delete;
+
+		// start building a program, returns its index in the batch
+		std::size_t add(shader_builder builder, const std::string &name = "");
+
+		// collect finished programs, returns how many are still building
+		std::size_t update();
+
+		// block until program i is finished
+		void wait(std::size_t i);
+
+		// done with the result of a finished job, its index may be reused
+		void release(std::size_t i);
+
+		std::size_t pending() const { return m_pending; }
+		bool done() const { return m_pending == 0; }
+
+		// program i once it has built, 0 while building or if it failed
+		bool finished(std::size_t i) const { return m_jobs[i].finished; }
+		GLuint program(std::size_t i) const { return m_jobs[i].ok ? m_jobs[i].program : 0; }
+		const std::string & log(std::size_t i) const { return m_jobs[i].log; }
+	};
+
+
+	// variants of one program specialized at compile time by a set of
+	// feature defines, instead of branching on uniforms in the shader.
+	// Each feature is a bit, variants are built the first time they are
+	// asked for and kept in a map keyed by the feature bitmask
+	class shader_permutations {
+	private:
+		std::map<GLenum, std::string> m_files;
+		std::vector<std::string> m_features; // bit i is defined as m_features[i]
+		std::unordered_map<std::uint64_t, GLuint> m_programs;
+
+		// variants building in the background, index in m_batch
+		shader_batch m_batch;
+		std::unordered_map<std::uint64_t, std::size_t> m_building;
+
+		// variants that failed to build, not tried again until the files change
+		std::unordered_set<std::uint64_t> m_failed;
+
+		shader_builder make_builder(std::uint64_t features) const;
+
+	public:
+		shader_permutations() { }
+		~shader_permutations();
+
+		// remove copy ctors
+		shader_permutations(const shader_permutations &) = delete;
+		shader_permutations & operator=(const shader_permutations &) = delete;
+
+		void set_shader(GLenum type, const std::string &filename);
+
+		// register a feature define (up to 64), returns its bit
+		std::uint64_t add_feature(const std::string &define);
+
+		// the program with exactly these features defined, built (or loaded
+		// from the binary cache) on first use. Throws like shader_builder::build,
+		// and without building again if the variant has already failed
+		GLuint get(std::uint64_t features);
+
+		// start building a variant in the background (see shader_batch)
+		void prefetch(std::uint64_t features);
+
+		// the variant if it has built, otherwise 0 (and it is prefetched),
+		// so the caller can draw with a fallback until it's ready
+		GLuint try_get(std::uint64_t features);
+
+		// true if the variant failed to build with the current files
+		bool failed(std::uint64_t features) const { return m_failed.count(features) > 0; }
+
+		// collect variants that finished building in the background
+		void update();
+
+		// number of variants built so far, and still building
+		std::size_t size() const { return m_programs.size(); }
+		std::size_t pending() const { return m_building.size(); }
+
+		// rebuild every variant built so far from the current files. All or
+		// nothing, on failure the old programs are kept and the log returned.
+		// Failed variants are forgotten so they are tried again
+		bool try_rebuild(std::string &log);
+
+		const std::map<GLenum, std::string> & files() const { return m_files; }
+
+		// human readable feature list, eg. "PHONG INSTANCED"
+		std::string describe(std::uint64_t features) const;
+	};
+
+
+	// rebuilds programs when their shader files change on disk. The old
+	// program stays in use until the new one compiles and links, failures
+	// are kept in errors() (for showing in the GUI) instead of throwing
+	class shader_reloader {
+	public:
+		struct program_error {
+			std::string name;
+			std::string log;
+		};
+
+	private:
+		struct entry {
+			std::vector<std::string> files;
+			std::string name;
+			std::function<bool(std::string &)> rebuild; // fills in the log on failure
+			std::string error;
+		};
+
+		file_watcher m_watcher;
+		std::vector<entry> m_programs;
+
+		void add(const std::map<GLenum, std::string> &files, const std::string &name, std::function<bool(std::string &)> rebuild);
+
+	public:
+		// on_change is called from the watcher thread when a file changes
+		explicit shader_reloader(std::function<void()> on_change = nullptr);
+
+		// watch the files program was built from, program is replaced in
+		// place so it must outlive the reloader
+		void add(GLuint &program, const shader_builder &builder, const std::string &name);
+
+		// same for every variant of a shader_permutations
+		void add(shader_permutations &permutations, const std::string &name);
+
+		// true if a watched file changed since the last update()
+		bool pending() const { return m_watcher.pending(); }
+
+		// call with the GL context current (eg. once a frame), rebuilds
+		// changed programs and returns true if any were replaced
+		bool update();
+
+		// programs whose last rebuild failed
+		std::vector<program_error> errors() const;
 	};
 
 }
\ No newline at end of file
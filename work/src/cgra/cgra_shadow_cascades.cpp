@@ -0,0 +1,204 @@
+// std
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+// glm
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+// project
+#include "cgra_shadow_cascades.hpp"
+#include "cgra_shader.hpp"
+#include "cgra_trace.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+
+namespace cgra {
+
+	shadow_cascades::shadow_cascades(int size, int count) : m_size(size), m_count(glm::clamp(count, 1, max_cascades)) { }
+
+
+	shadow_cascades::~shadow_cascades() {
+		glDeleteProgram(m_program);
+		glDeleteFramebuffers(1, &m_framebuffer);
+		glDeleteTextures(1, &m_texture);
+	}
+
+
+	void shadow_cascades::create() {
+		// depth array, sampled with hardware comparison. outside the map is lit
+		glGenTextures(1, &m_texture);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT32F, m_size, m_size, m_count, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+		const float border[4] = { 1, 1, 1, 1 };
+		glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+		// depth only framebuffer, a layer is attached per cascade
+		GLint previous = 0;
+		glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+		glGenFramebuffers(1, &m_framebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_texture, 0, 0);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+			cerr << "Error: Shadow map framebuffer is incomplete" << endl;
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, previous);
+
+		shader_builder depth;
+		depth.set_shader_source(GL_VERTEX_SHADER, R"(
+			#version 330 core
+			uniform mat4 uLightViewProj;
+			layout(location = 0) in vec3 aPosition;
+			void main() { gl_Position = uLightViewProj * vec4(aPosition, 1); }
+		)");
+		depth.set_shader_source(GL_FRAGMENT_SHADER, R"(
+			#version 330 core
+			void main() { }
+		)");
+		m_program = depth.build();
+	}
+
+
+	int shadow_cascades::update(const mat4 &view, float fovy, float aspect, float near_depth, const aabb &scene, const vec3 &light_direction, uint64_t scene_version, const function<void()> &draw) {
+		CGRA_TRACE_SCOPE("shadow_cascades::update");
+		if (!m_texture) create();
+		if (scene_version != m_scene_version) {
+			invalidate();
+			m_scene_version = scene_version;
+		}
+
+		// shadows end at the far side of the scene, rounded up to a quarter
+		// octave so the splits only move when the camera moves a long way
+		vec3 corners[8];
+		for (int i = 0; i < 8; i++) {
+			corners[i] = vec3(i & 1 ? scene.max.x : scene.min.x, i & 2 ? scene.max.y : scene.min.y, i & 4 ? scene.max.z : scene.min.z);
+		}
+		float far_depth = near_depth * 2;
+		for (const vec3 &corner : corners) far_depth = std::max(far_depth, -(view * vec4(corner, 1)).z);
+		far_depth = std::exp2(std::ceil(std::log2(far_depth) * 4) / 4);
+
+		// light space rotation, and the scene's depth range in it so casters
+		// outside a cascade's slice of the frustum still cast into it
+		vec3 direction = length(light_direction) > 1e-6f ? normalize(light_direction) : vec3(0, -1, 0);
+		vec3 up = std::abs(direction.y) > 0.99f ? vec3(0, 0, 1) : vec3(0, 1, 0);
+		mat4 light_view = lookAt(vec3(0), direction, up);
+		float zmin = INFINITY, zmax = -INFINITY;
+		for (const vec3 &corner : corners) {
+			float z = (light_view * vec4(corner, 1)).z;
+			zmin = std::min(zmin, z);
+			zmax = std::max(zmax, z);
+		}
+		float zpad = (zmax - zmin) * 0.01f + 1e-3f;
+
+		const mat4 inverse_view = inverse(view);
+		const float tan_y = std::tan(fovy / 2), tan_x = tan_y * aspect;
+		const float k2 = tan_x * tan_x + tan_y * tan_y; // squared corner distance per unit depth
+
+		m_rendered = 0;
+		bool state_saved = false;
+		GLint previous_framebuffer = 0, previous_program = 0, previous_viewport[4];
+		float split_near = near_depth;
+		for (int i = 0; i < m_count; i++) {
+			// mostly logarithmic splits, with some uniform to keep the far
+			// cascades from getting too thin
+			float t = float(i + 1) / m_count;
+			float split_far = mix(near_depth + (far_depth - near_depth) * t, near_depth * std::pow(far_depth / near_depth, t), 0.75f);
+
+			// smallest sphere around the slice, centred on the view axis
+			float centre = std::min(split_far, (split_near + split_far) * (1 + k2) / 2);
+			float radius = std::sqrt((centre - split_near) * (centre - split_near) + k2 * split_near * split_near);
+			radius = std::max(radius, std::sqrt((split_far - centre) * (split_far - centre) + k2 * split_far * split_far));
+			radius = std::ceil(radius * 16) / 16;
+
+			// snap the centre to whole texels so the map doesn't shimmer, and
+			// so it stays exactly the same while the camera is still
+			float texel = 2 * radius / m_size;
+			vec3 c = vec3(light_view * inverse_view * vec4(0, 0, -centre, 1));
+			c.x = std::floor(c.x / texel) * texel;
+			c.y = std::floor(c.y / texel) * texel;
+			mat4 light_proj = ortho(c.x - radius, c.x + radius, c.y - radius, c.y + radius, -zmax - zpad, -zmin + zpad);
+			mat4 light_view_proj = light_proj * light_view;
+
+			cascade &cached = m_cascades[i];
+			cached.far_depth = split_far;
+			cached.texel_size = texel;
+			split_near = split_far;
+			if (cached.valid && cached.light_view_proj == light_view_proj) {
+				m_total_reused++;
+				continue;
+			}
+			cached.light_view_proj = light_view_proj;
+			cached.valid = true;
+
+			if (!state_saved) {
+				glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous_framebuffer);
+				glGetIntegerv(GL_CURRENT_PROGRAM, &previous_program);
+				glGetIntegerv(GL_VIEWPORT, previous_viewport);
+				glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+				glViewport(0, 0, m_size, m_size);
+				glUseProgram(m_program);
+				glEnable(GL_DEPTH_TEST);
+				glDepthFunc(GL_LESS);
+				glEnable(GL_POLYGON_OFFSET_FILL);
+				glPolygonOffset(1.5f, 4.0f);
+				state_saved = true;
+			}
+			glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_texture, 0, i);
+			glClear(GL_DEPTH_BUFFER_BIT);
+			glUniformMatrix4fv(glGetUniformLocation(m_program, "uLightViewProj"), 1, false, value_ptr(light_view_proj));
+			draw();
+			m_rendered++;
+			m_total_rendered++;
+		}
+
+		if (state_saved) {
+			glDisable(GL_POLYGON_OFFSET_FILL);
+			glBindFramebuffer(GL_FRAMEBUFFER, previous_framebuffer);
+			glViewport(previous_viewport[0], previous_viewport[1], previous_viewport[2], previous_viewport[3]);
+			glUseProgram(previous_program);
+		}
+		return m_rendered;
+	}
+
+
+	void shadow_cascades::invalidate() {
+		for (cascade &c : m_cascades) c.valid = false;
+	}
+
+
+	void shadow_cascades::bind(GLuint program, const mat4 &view, GLuint unit) const {
+		glActiveTexture(GL_TEXTURE0 + unit);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture);
+		glActiveTexture(GL_TEXTURE0);
+
+		// view space straight to shadow map coordinates in [0,1]
+		const mat4 bias = translate(mat4(1), vec3(0.5f)) * scale(mat4(1), vec3(0.5f));
+		const mat4 inverse_view = inverse(view);
+		mat4 matrices[max_cascades];
+		vec4 far_depths(0), texel_sizes(0);
+		for (int i = 0; i < m_count; i++) {
+			matrices[i] = bias * m_cascades[i].light_view_proj * inverse_view;
+			far_depths[i] = m_cascades[i].far_depth;
+			texel_sizes[i] = m_cascades[i].texel_size;
+		}
+		glUniform1i(glGetUniformLocation(program, "uShadowMap"), unit);
+		glUniform1i(glGetUniformLocation(program, "uCascadeCount"), m_count);
+		glUniformMatrix4fv(glGetUniformLocation(program, "uShadowMatrices"), m_count, false, value_ptr(matrices[0]));
+		glUniform4fv(glGetUniformLocation(program, "uCascadeFar"), 1, value_ptr(far_depths));
+		glUniform4fv(glGetUniformLocation(program, "uShadowTexelSize"), 1, value_ptr(texel_sizes));
+	}
+
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+// std
+#include <cstdint>
+#include <functional>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include <opengl.hpp>
+#include "cgra_occlusion.hpp"
+
+
+namespace cgra {
+
+	// cascaded shadow maps for a directional light, one layer of a depth
+	// texture array per cascade.
+	//
+	// Cascades are cached. Each one is fitted with a bounding sphere of its
+	// slice of the view frustum (so it doesn't change size as the camera
+	// turns), snapped to whole shadow map texels, and only re-rendered if its
+	// light matrix or the scene changes. The shadowed range ends at the far
+	// side of the scene and is rounded up to a fixed set of distances, so a
+	// static scene renders its shadows once and small camera moves only
+	// re-render the near cascades.
+	class shadow_cascades {
+	public:
+		static constexpr int max_cascades = 4;
+
+	private:
+		int m_size;
+		int m_count;
+		GLuint m_texture = 0;
+		GLuint m_framebuffer = 0;
+		GLuint m_program = 0;
+
+		struct cascade {
+			glm::mat4 light_view_proj;
+			float far_depth = 0; // view space depth the cascade reaches
+			float texel_size = 0; // world size of a shadow map texel
+			bool valid = false;
+		};
+		cascade m_cascades[max_cascades];
+		std::uint64_t m_scene_version = 0;
+
+		int m_rendered = 0; // cascades rendered by the last update
+		std::uint64_t m_total_rendered = 0;
+		std::uint64_t m_total_reused = 0;
+
+		void create();
+
+	public:
+		// size is the width and height of each cascade, count at most max_cascades
+		explicit shadow_cascades(int size = 2048, int count = 3);
+
+		// remove copy ctors
+		shadow_cascades(const shadow_cascades &) = delete;
+		shadow_cascades & operator=(const shadow_cascades &) = delete;
+
+		~shadow_cascades();
+
+		// fit the cascades to the camera and re-render the ones that changed.
+		// fovy, aspect and near_depth describe the camera's (symmetric)
+		// projection, scene bounds everything that casts or receives shadows
+		// and scene_version must change whenever the geometry does. draw is
+		// called once per re-rendered cascade with a depth only program bound
+		// that reads positions from attribute 0. The framebuffer, viewport and
+		// program are restored afterwards. Returns the cascades re-rendered
+		int update(const glm::mat4 &view, float fovy, float aspect, float near_depth, const aabb &scene, const glm::vec3 &light_direction, std::uint64_t scene_version, const std::function<void()> &draw);
+
+		// force every cascade to be re-rendered on the next update
+		void invalidate();
+
+		// bind the shadow map to texture unit and set the shadow uniforms of
+		// program (which must be in use). view must match the last update
+		void bind(GLuint program, const glm::mat4 &view, GLuint unit = 4) const;
+
+		int count() const { return m_count; }
+		int size() const { return m_size; }
+
+		// cascades rendered by the last update, and in total vs. reused
+		int rendered() const { return m_rendered; }
+		std::uint64_t total_rendered() const { return m_total_rendered; }
+		std::uint64_t total_reused() const { return m_total_reused; }
+	};
+
+}
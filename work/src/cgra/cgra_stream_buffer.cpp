@@ -0,0 +1,140 @@
+// std
+#include <algorithm>
+
+// project
+#include "cgra_stream_buffer.hpp"
+
+
+namespace cgra {
+
+	stream_buffer::stream_buffer(GLenum target, GLsizeiptr frame_size) : m_target(target) {
+		m_persistent = GLEW_ARB_buffer_storage != 0;
+		create(std::max<GLsizeiptr>(frame_size, 256));
+	}
+
+
+	stream_buffer::~stream_buffer() {
+		release();
+	}
+
+
+	void stream_buffer::create(GLsizeiptr region_size) {
+		m_region_size = region_size;
+		const GLsizeiptr total = m_region_size * region_count;
+
+		GLint last_buffer = 0;
+		glGetIntegerv(m_target == GL_ELEMENT_ARRAY_BUFFER ? GL_ELEMENT_ARRAY_BUFFER_BINDING : GL_ARRAY_BUFFER_BINDING, &last_buffer);
+
+		glGenBuffers(1, &m_buffer);
+		glBindBuffer(m_target, m_buffer);
+		if (m_persistent) {
+			// map once and keep it mapped for the lifetime of the buffer
+			const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(m_target, total, nullptr, flags);
+			m_mapped = static_cast<char *>(glMapBufferRange(m_target, 0, total, flags));
+		}
+		else {
+			glBufferData(m_target, total, nullptr, GL_STREAM_DRAW);
+		}
+
+		// only restore bindings the target actually has
+		if (m_target == GL_ARRAY_BUFFER || m_target == GL_ELEMENT_ARRAY_BUFFER) {
+			glBindBuffer(m_target, last_buffer);
+		}
+
+		m_region = 0;
+		m_cursor = 0;
+		m_region_end = m_persistent ? m_region_size : total;
+	}
+
+
+	void stream_buffer::release() {
+		for (auto &fence : m_fences) {
+			if (fence) glDeleteSync(fence);
+			fence = nullptr;
+		}
+		if (m_buffer) {
+			if (m_mapped) {
+				glBindBuffer(m_target, m_buffer);
+				glUnmapBuffer(m_target);
+				m_mapped = nullptr;
+			}
+			// the driver keeps the storage alive for draws still in flight
+			glDeleteBuffers(1, &m_buffer);
+			m_buffer = 0;
+		}
+	}
+
+
+	void stream_buffer::wait(int region) {
+		GLsync &fence = m_fences[region];
+		if (!fence) return;
+		GLenum status = glClientWaitSync(fence, 0, 0);
+		if (status == GL_TIMEOUT_EXPIRED) {
+			// the GPU is more than two frames behind
+			m_stalls++;
+			do {
+				status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+			} while (status == GL_TIMEOUT_EXPIRED);
+		}
+		glDeleteSync(fence);
+		fence = nullptr;
+	}
+
+
+	stream_buffer::allocation stream_buffer::allocate(GLsizeiptr size, GLsizeiptr alignment) {
+		alignment = std::max<GLsizeiptr>(alignment, 1);
+		GLsizeiptr offset = (m_cursor + alignment - 1) / alignment * alignment;
+
+		if (offset + size > m_region_end) {
+			if (m_persistent || size + alignment > m_region_size * region_count) {
+				// this frame outgrew its region, start again with a bigger buffer
+				release();
+				create(std::max(m_region_size * 2, (size + alignment) * 2));
+			}
+			else {
+				// orphan the storage, the driver hands us a fresh block while
+				// the GPU finishes reading the old one
+				glBindBuffer(m_target, m_buffer);
+				glBufferData(m_target, m_region_size * region_count, nullptr, GL_STREAM_DRAW);
+				m_cursor = 0;
+			}
+			offset = (m_cursor + alignment - 1) / alignment * alignment;
+		}
+
+		allocation a;
+		a.offset = offset;
+		a.size = size;
+		m_cursor = offset + size;
+
+		if (m_persistent) {
+			a.data = m_mapped + offset;
+		}
+		else if (size > 0) {
+			// we never overwrite anything the GPU might still read, so skip the sync
+			glBindBuffer(m_target, m_buffer);
+			a.data = glMapBufferRange(m_target, offset, size, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+		}
+		return a;
+	}
+
+
+	void stream_buffer::flush(const allocation &a) {
+		if (m_persistent || !a.data) return; // coherent mapping, nothing to do
+		glBindBuffer(m_target, m_buffer);
+		glUnmapBuffer(m_target);
+	}
+
+
+	void stream_buffer::end_frame() {
+		if (!m_persistent) return; // orphaning takes care of synchronization
+
+		// fence this frame's region and move on to the oldest one
+		m_fences[m_region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		m_region = (m_region + 1) % region_count;
+		wait(m_region);
+		m_cursor = m_region * m_region_size;
+		m_region_end = m_cursor + m_region_size;
+	}
+
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+// std
+#include <cstddef>
+
+// project
+#include <opengl.hpp>
+
+
+namespace cgra {
+
+	// ring allocator for streaming per-frame dynamic data (GUI vertices,
+	// per-object uniforms, draw lists etc) without stalling on the driver.
+	//
+	// With ARB_buffer_storage the buffer is mapped once, persistent and
+	// coherent, and split into three regions guarded by fences, so the CPU
+	// only ever writes a region the GPU finished with two frames ago.
+	// Otherwise (plain GL 3.3) every allocation is mapped unsynchronized and
+	// the whole buffer is orphaned when it wraps.
+	class stream_buffer {
+	public:
+		// a chunk of the buffer that can be written this frame
+		struct allocation {
+			void *data = nullptr;   // CPU pointer to write to
+			GLintptr offset = 0;    // offset into buffer() for drawing
+			GLsizeiptr size = 0;
+		};
+
+		static constexpr int region_count = 3;
+
+	private:
+		GLenum m_target;
+		GLuint m_buffer = 0;
+		GLsizeiptr m_region_size = 0; // bytes available per frame
+		GLsizeiptr m_cursor = 0;      // next free byte in the buffer
+		GLsizeiptr m_region_end = 0;  // end of the current region
+		int m_region = 0;
+		bool m_persistent = false;
+		char *m_mapped = nullptr;     // persistent mapping
+		GLsync m_fences[region_count] = { };
+		unsigned m_stalls = 0;
+
+		void create(GLsizeiptr region_size);
+		void release();
+		void wait(int region);
+
+	public:
+		// requires a current GL context. frame_size is the expected number of
+		// bytes written per frame, the buffer grows if a frame writes more
+		stream_buffer(GLenum target, GLsizeiptr frame_size);
+
+		// remove copy ctors
+		stream_buffer(const stream_buffer &) = delete;
+		stream_buffer & operator=(const stream_buffer &) = delete;
+
+		~stream_buffer();
+
+		// GL buffer name, may change when the buffer grows so
+		// rebind (and respecify attributes) after allocating
+		GLuint buffer() const { return m_buffer; }
+
+		// true if using persistent mapping
+		bool persistent() const { return m_persistent; }
+
+		// number of times the CPU had to wait for the GPU
+		unsigned stalls() const { return m_stalls; }
+
+		// reserve size bytes with the start a multiple of alignment (which need
+		// not be a power of two). May bind the buffer to the target. The data
+		// must be written and flush()ed before any draw that reads it
+		allocation allocate(GLsizeiptr size, GLsizeiptr alignment = 16);
+
+		// finishes writing an allocation (unmaps it without persistent mapping)
+		void flush(const allocation &a);
+
+		// call once after the last draw that reads this frame's allocations
+		void end_frame();
+	};
+
+}
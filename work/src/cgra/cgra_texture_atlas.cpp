@@ -0,0 +1,107 @@
+// std
+#include <algorithm>
+#include <map>
+
+// stb
+#include <stb_image.h>
+#include <stb_rect_pack.h>
+
+// project
+#include "cgra_texture_atlas.hpp"
+#include "cgra_trace.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+
+namespace cgra {
+
+	texture_atlas::texture_atlas(int page_size, int max_image_size)
+		: m_page_size(std::max(page_size / cell_size, 1) * cell_size), m_max_image_size(max_image_size) { }
+
+
+	vector<texture_atlas::placement> texture_atlas::pack(const vector<string> &filenames) {
+		CGRA_TRACE_SCOPE("texture_atlas::pack");
+		vector<placement> placements(filenames.size());
+
+		// each small enough file once, with the placements it fills in
+		struct image {
+			string filename;
+			int width, height;
+			vector<size_t> users;
+		};
+		vector<image> images;
+		map<string, size_t> found;
+		for (size_t i = 0; i < filenames.size(); i++) {
+			if (filenames[i].empty()) continue;
+			auto existing = found.find(filenames[i]);
+			if (existing != found.end()) {
+				images[existing->second].users.push_back(i);
+				continue;
+			}
+			int width, height, channels;
+			if (!stbi_info(filenames[i].c_str(), &width, &height, &channels)) continue;
+			if (width > m_max_image_size || height > m_max_image_size) continue;
+			found[filenames[i]] = images.size();
+			images.push_back({ filenames[i], width, height, { i } });
+		}
+
+		// packed in whole cells, gutter included
+		const auto cells = [](int pixels) { return (pixels + 2 * padding + cell_size - 1) / cell_size; };
+		vector<stbrp_rect> rects(images.size());
+		for (size_t i = 0; i < images.size(); i++) {
+			rects[i].id = int(i);
+			rects[i].w = stbrp_coord(cells(images[i].width));
+			rects[i].h = stbrp_coord(cells(images[i].height));
+		}
+
+		const int page_cells = m_page_size / cell_size;
+		vector<stbrp_node> nodes(page_cells);
+		const auto pack_into = [&](vector<stbrp_rect> &into, int size) {
+			stbrp_context context;
+			stbrp_init_target(&context, size, size, nodes.data(), int(nodes.size()));
+			stbrp_pack_rects(&context, into.data(), int(into.size()));
+			return all_of(into.begin(), into.end(), [](const stbrp_rect &r) { return r.was_packed != 0; });
+		};
+
+		// fill pages until everything is packed
+		while (!rects.empty()) {
+			pack_into(rects, page_cells);
+			vector<stbrp_rect> packed, rest;
+			for (const stbrp_rect &r : rects) (r.was_packed ? packed : rest).push_back(r);
+			if (packed.size() < 2) break; // no point in a page for one image
+
+			// the last page is usually mostly empty, halve it while it all fits
+			int size = page_cells;
+			while (size > 1) {
+				vector<stbrp_rect> smaller = packed;
+				if (!pack_into(smaller, size / 2)) break;
+				packed = std::move(smaller);
+				size /= 2;
+			}
+
+			page p;
+			p.size = size * cell_size;
+			for (const stbrp_rect &r : packed) {
+				const image &img = images[r.id];
+				entry e;
+				e.filename = img.filename;
+				e.x = r.x * cell_size + padding;
+				e.y = r.y * cell_size + padding;
+				e.width = img.width;
+				e.height = img.height;
+				for (size_t user : img.users) {
+					placements[user].page = int(m_pages.size());
+					placements[user].offset = vec2(e.x, e.y) / float(p.size);
+					placements[user].scale = vec2(e.width, e.height) / float(p.size);
+				}
+				p.entries.push_back(std::move(e));
+			}
+			m_pages.push_back(std::move(p));
+			rects = std::move(rest);
+		}
+		return placements;
+	}
+
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+// std
+#include <string>
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+
+namespace cgra {
+
+	// packs small images into shared pages with stb_rect_pack, so a mesh that
+	// uses many of them binds one texture per page instead of one per image.
+	// Only the image sizes are read here (stbi_info), texture_loader composes
+	// and streams in the pages.
+	//
+	// Each image is surrounded by a gutter of its own edge pixels and starts
+	// on a multiple of cell_size, so a page's first levels filter (and block
+	// compress) without bleeding between neighbours. Pages are only given
+	// that many mip levels, and images must not rely on their texture
+	// coordinates wrapping.
+	class texture_atlas {
+	public:
+		static constexpr int padding = 8;    // gutter around each image, pixels
+		static constexpr int cell_size = 16; // packing granularity, pixels
+		static constexpr int levels = 3;     // mip levels a page can have
+
+		// an image's rectangle on its page, inside the gutter. Pages are in
+		// GL orientation, y = 0 is the bottom row
+		struct entry {
+			std::string filename;
+			int x = 0, y = 0;
+			int width = 0, height = 0;
+		};
+
+		struct page {
+			int size = 0; // width and height
+			std::vector<entry> entries;
+		};
+
+		// where an image ended up, texture coordinates in [0, 1] over the
+		// image map to offset + uv * scale on its page
+		struct placement {
+			int page = -1; // -1 if the image wasn't packed
+			glm::vec2 offset = glm::vec2(0);
+			glm::vec2 scale = glm::vec2(1);
+		};
+
+	private:
+		int m_page_size;
+		int m_max_image_size;
+		std::vector<page> m_pages;
+
+	public:
+		// images larger than max_image_size either way are left out
+		explicit texture_atlas(int page_size = 2048, int max_image_size = 256);
+
+		// pack the images that are small enough into new pages, one placement
+		// per filename. Images that can't be read, or would be alone on a
+		// page, are left out, as are empty filenames
+		std::vector<placement> pack(const std::vector<std::string> &filenames);
+
+		const std::vector<page> & pages() const { return m_pages; }
+	};
+
+}
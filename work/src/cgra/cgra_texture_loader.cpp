@@ -0,0 +1,482 @@
+// std
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <sstream>
+
+// stb
+#include <stb_image.h>
+#include <stb_image_resize.h>
+extern "C" {
+#include <stb_dxt.h>
+}
+
+// project
+#include "cgra_texture_loader.hpp"
+#include "cgra_trace.hpp"
+
+
+using namespace std;
+
+
+namespace cgra {
+
+	namespace {
+		// glew only finds extensions without entry points in the legacy
+		// extension string, which core profiles don't have
+		bool has_extension(const char *name) {
+			GLint count = 0;
+			glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+			for (GLint i = 0; i < count; i++) {
+				if (strcmp(reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i)), name) == 0) return true;
+			}
+			return false;
+		}
+
+		bool is_compressed(GLenum format) {
+			return format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT || format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+		}
+
+		// bytes of a level in a format
+		size_t level_size(GLenum format, int width, int height) {
+			if (!is_compressed(format)) return size_t(width) * height * 4;
+			size_t block_size = format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ? 8 : 16;
+			return size_t((width + 3) / 4) * ((height + 3) / 4) * block_size;
+		}
+
+		// cache file layout, followed by each level's width, height, size and data
+		struct cache_header {
+			char magic[8];
+			uint64_t hash; // of the image file
+			uint32_t format;
+			uint32_t levels;
+		};
+		const char cache_magic[8] = { 'C', 'G', 'R', 'A', 'B', 'C', 0, 1 };
+
+		// cache files are written by pool threads, and maybe by other
+		// instances too, so each write gets a name of its own
+		string temporary_filename(const string &filename) {
+			static const uint64_t process = (uint64_t(random_device()()) << 32) ^ uint64_t(chrono::system_clock::now().time_since_epoch().count());
+			static atomic<unsigned> counter{ 0 };
+			ostringstream name;
+			name << filename << "." << hex << process << "." << counter.fetch_add(1) << ".tmp";
+			return name.str();
+		}
+
+		// an image file's bytes as RGBA, bottom row first (obj texture
+		// coordinates start at the bottom, images at the top)
+		bool load_pixels(const string &filename, const vector<unsigned char> &bytes, int &width, int &height, vector<unsigned char> &pixels) {
+			int channels;
+			unsigned char *loaded = stbi_load_from_memory(bytes.data(), int(bytes.size()), &width, &height, &channels, 4);
+			if (!loaded) {
+				cerr << "Error: Could not load texture " << filename << " (" << stbi_failure_reason() << ")" << endl;
+				return false;
+			}
+			const size_t row = size_t(width) * 4;
+			pixels.resize(row * height);
+			for (int y = 0; y < height; y++) {
+				memcpy(&pixels[y * row], loaded + (height - 1 - y) * row, row);
+			}
+			stbi_image_free(loaded);
+			return true;
+		}
+	}
+
+
+	std::string texture_loader::s_cache_directory;
+
+
+	texture_loader::texture_loader(thread_pool &pool, GLsizeiptr bytes_per_frame) : m_pool(pool), m_bytes_per_frame(std::max<GLsizeiptr>(bytes_per_frame, 4096)) {
+		// stb_dxt builds its tables on first use without a lock, so do
+		// that here before any worker can race for it
+		unsigned char block[64] = { }, compressed[16];
+		stb_compress_dxt_block(compressed, block, 1, STB_DXT_NORMAL);
+		m_s3tc = GLEW_EXT_texture_compression_s3tc || has_extension("GL_EXT_texture_compression_s3tc");
+	}
+
+
+	texture_loader::~texture_loader() {
+		// decode tasks write into this object
+		{
+			unique_lock<mutex> lock(m_mutex);
+			m_decoded_cv.wait(lock, [this]() { return m_in_flight == 0; });
+		}
+		clear();
+	}
+
+
+	void texture_loader::decode(image &img, bool compress) {
+		CGRA_TRACE_SCOPE("texture_loader::decode");
+		auto start = chrono::steady_clock::now();
+		// the file, or every file on an atlas page
+		vector<string> files;
+		if (img.page.entries.empty()) files.push_back(img.filename);
+		for (const texture_atlas::entry &e : img.page.entries) files.push_back(e.filename);
+		vector<vector<unsigned char>> sources;
+		for (const string &filename : files) {
+			ifstream file(filename, ios::binary);
+			sources.emplace_back((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+			if (!file || sources.back().empty()) {
+				cerr << "Error: Could not read texture " << filename << endl;
+				return;
+			}
+		}
+
+		// compressed levels from an earlier run, keyed by FNV-1a of the files
+		// (and where they are on the page)
+		string cache_filename;
+		uint64_t hash = 14695981039346656037ull;
+		if (compress && !s_cache_directory.empty()) {
+			for (const vector<unsigned char> &bytes : sources) {
+				for (unsigned char c : bytes) hash = (hash ^ c) * 1099511628211ull;
+			}
+			for (const texture_atlas::entry &e : img.page.entries) {
+				for (int v : { e.x, e.y, img.page.size }) hash = (hash ^ uint64_t(v)) * 1099511628211ull;
+			}
+			ostringstream name;
+			name << hex << setw(16) << setfill('0') << hash << ".bc";
+			cache_filename = (filesystem::path(s_cache_directory) / name.str()).string();
+			if (read_cache(cache_filename, hash, img)) {
+				img.from_cache = true;
+				img.decode_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+				return;
+			}
+		}
+
+		mip_level base;
+		if (img.page.entries.empty()) {
+			if (!load_pixels(img.filename, sources[0], base.width, base.height, base.pixels)) return;
+		}
+		else {
+			// opaque black around the images, so an opaque page stays BC1
+			const int size = img.page.size;
+			base.width = base.height = size;
+			base.pixels.assign(size_t(size) * size * 4, 0);
+			for (size_t i = 3; i < base.pixels.size(); i += 4) base.pixels[i] = 255;
+
+			const int padding = texture_atlas::padding;
+			for (size_t i = 0; i < img.page.entries.size(); i++) {
+				const texture_atlas::entry &e = img.page.entries[i];
+				int width, height;
+				vector<unsigned char> pixels;
+				if (!load_pixels(e.filename, sources[i], width, height, pixels)) continue;
+				if (width != e.width || height != e.height) {
+					cerr << "Error: Texture " << e.filename << " changed size since it was packed" << endl;
+					continue;
+				}
+
+				// the image and its gutter, which repeats the edge pixels
+				for (int y = -padding; y < height + padding; y++) {
+					const unsigned char *row = &pixels[size_t(std::min(std::max(y, 0), height - 1)) * width * 4];
+					unsigned char *out = &base.pixels[(size_t(e.y + y) * size + e.x) * 4];
+					for (int x = -padding; x < width + padding; x++) {
+						memcpy(out + x * 4, row + std::min(std::max(x, 0), width - 1) * 4, 4);
+					}
+				}
+			}
+		}
+		img.levels.push_back(std::move(base));
+
+		// each level filtered down from the one above, in linear light. Atlas
+		// pages stop while their gutters still separate the images
+		const size_t max_levels = img.page.entries.empty() ? 32 : texture_atlas::levels;
+		while ((img.levels.back().width > 1 || img.levels.back().height > 1) && img.levels.size() < max_levels) {
+			const mip_level &above = img.levels.back();
+			mip_level level;
+			level.width = std::max(1, above.width / 2);
+			level.height = std::max(1, above.height / 2);
+			level.pixels.resize(size_t(level.width) * level.height * 4);
+			stbir_resize_uint8_srgb(above.pixels.data(), above.width, above.height, 0, level.pixels.data(), level.width, level.height, 0, 4, 3, 0);
+			img.levels.push_back(std::move(level));
+		}
+
+		if (compress) {
+			this->compress(img);
+			if (!cache_filename.empty()) write_cache(cache_filename, hash, img);
+		}
+		img.decode_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	}
+
+
+	void texture_loader::compress(image &img) {
+		CGRA_TRACE_SCOPE("texture_loader::compress");
+		auto start = chrono::steady_clock::now();
+
+		// BC1 unless anything is see through
+		const vector<unsigned char> &top = img.levels[0].pixels;
+		bool opaque = true;
+		for (size_t i = 3; i < top.size() && opaque; i += 4) opaque = top[i] == 255;
+		img.format = opaque ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+		const size_t block_size = opaque ? 8 : 16;
+
+		for (mip_level &level : img.levels) {
+			const int blocks_x = (level.width + 3) / 4, blocks_y = (level.height + 3) / 4;
+			vector<unsigned char> blocks(level_size(img.format, level.width, level.height));
+
+			// rows of blocks across the pool, the edges of sizes that aren't a
+			// multiple of four are padded by repeating the last pixel
+			m_pool.parallel_for(0, blocks_y, 8, [&](size_t first, size_t last) {
+				unsigned char source[64];
+				for (size_t by = first; by < last; by++) {
+					for (int bx = 0; bx < blocks_x; bx++) {
+						for (int y = 0; y < 4; y++) {
+							int sy = std::min(int(by) * 4 + y, level.height - 1);
+							for (int x = 0; x < 4; x++) {
+								int sx = std::min(bx * 4 + x, level.width - 1);
+								memcpy(&source[(y * 4 + x) * 4], &level.pixels[(size_t(sy) * level.width + sx) * 4], 4);
+							}
+						}
+						stb_compress_dxt_block(&blocks[(by * blocks_x + bx) * block_size], source, opaque ? 0 : 1, STB_DXT_NORMAL);
+					}
+				}
+			});
+			level.pixels = std::move(blocks);
+		}
+		img.compress_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	}
+
+
+	bool texture_loader::read_cache(const string &filename, uint64_t hash, image &img) {
+		ifstream file(filename, ios::binary);
+		if (!file) return false;
+		cache_header header;
+		file.read(reinterpret_cast<char *>(&header), sizeof(header));
+		if (!file || memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0 || header.hash != hash || !is_compressed(header.format) || header.levels == 0 || header.levels > 32) {
+			return false;
+		}
+
+		vector<mip_level> levels(header.levels);
+		for (mip_level &level : levels) {
+			uint32_t size = 0;
+			file.read(reinterpret_cast<char *>(&level.width), sizeof(level.width));
+			file.read(reinterpret_cast<char *>(&level.height), sizeof(level.height));
+			file.read(reinterpret_cast<char *>(&size), sizeof(size));
+			if (!file || level.width <= 0 || level.height <= 0 || size != level_size(header.format, level.width, level.height)) return false;
+			level.pixels.resize(size);
+			file.read(reinterpret_cast<char *>(level.pixels.data()), size);
+			if (!file) return false;
+		}
+		img.format = header.format;
+		img.levels = std::move(levels);
+		return true;
+	}
+
+
+	void texture_loader::write_cache(const string &filename, uint64_t hash, const image &img) {
+		// renaming the finished file into place is atomic, a reader gets
+		// the previous entry or this one, never a partial or mixed file
+		error_code ec;
+		filesystem::create_directories(s_cache_directory, ec);
+		string temporary = temporary_filename(filename);
+		{
+			ofstream file(temporary, ios::binary);
+			cache_header header;
+			memcpy(header.magic, cache_magic, sizeof(cache_magic));
+			header.hash = hash;
+			header.format = img.format;
+			header.levels = uint32_t(img.levels.size());
+			file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+			for (const mip_level &level : img.levels) {
+				uint32_t size = uint32_t(level.pixels.size());
+				file.write(reinterpret_cast<const char *>(&level.width), sizeof(level.width));
+				file.write(reinterpret_cast<const char *>(&level.height), sizeof(level.height));
+				file.write(reinterpret_cast<const char *>(&size), sizeof(size));
+				file.write(reinterpret_cast<const char *>(level.pixels.data()), size);
+			}
+			if (!file) {
+				cerr << "Warning: Could not write texture cache " << temporary << endl;
+				file.close();
+				filesystem::remove(temporary, ec);
+				return;
+			}
+		}
+		filesystem::rename(temporary, filename, ec);
+		if (ec) filesystem::remove(temporary, ec);
+	}
+
+
+	GLuint texture_loader::load(const string &filename) {
+		return request(filename, texture_atlas::page());
+	}
+
+
+	GLuint texture_loader::load(const texture_atlas::page &page) {
+		// named by what's on it
+		string key = "atlas";
+		for (const texture_atlas::entry &e : page.entries) key += "|" + e.filename + "@" + to_string(e.x) + "," + to_string(e.y);
+		return request(key, page);
+	}
+
+
+	GLuint texture_loader::request(const string &filename, const texture_atlas::page &page) {
+		auto found = m_textures.find(filename);
+		if (found != m_textures.end()) return found->second;
+
+		// white until the image arrives
+		GLuint texture;
+		const unsigned char white[4] = { 255, 255, 255, 255 };
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		m_textures[filename] = texture;
+		m_stats.requested++;
+		m_stats.decoding++;
+
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_in_flight++;
+		}
+		unsigned generation = m_generation;
+		bool compress = m_compress && m_s3tc;
+		m_pool.submit([this, texture, filename, page, generation, compress]() {
+			image img;
+			img.texture = texture;
+			img.filename = filename;
+			img.page = page;
+			img.generation = generation;
+			decode(img, compress);
+			lock_guard<mutex> lock(m_mutex);
+			m_decoded.push_back(std::move(img));
+			m_in_flight--;
+			m_decoded_cv.notify_all();
+		});
+		return texture;
+	}
+
+
+	bool texture_loader::update() {
+		m_stats.uploaded_bytes = 0;
+
+		// pick up finished decodes
+		{
+			lock_guard<mutex> lock(m_mutex);
+			for (image &img : m_decoded) {
+				m_stats.decoding--;
+				if (img.generation != m_generation) continue; // cleared since
+				m_stats.decode_ms += img.decode_ms;
+				m_stats.compress_ms += img.compress_ms;
+				m_stats.cache_hits += img.from_cache;
+				if (img.levels.empty()) {
+					m_stats.failed++;
+					continue;
+				}
+				for (const mip_level &level : img.levels) {
+					m_stats.gpu_bytes += level.pixels.size();
+					m_stats.rgba_bytes += level_size(GL_RGBA8, level.width, level.height);
+				}
+				img.level = int(img.levels.size()) - 1;
+				m_uploads.push_back(std::move(img));
+			}
+			m_decoded.clear();
+		}
+		m_stats.uploading = unsigned(m_uploads.size());
+		if (m_uploads.empty()) return false;
+
+		CGRA_TRACE_SCOPE("texture_loader::update");
+		if (!m_staging) m_staging = make_unique<stream_buffer>(GL_PIXEL_UNPACK_BUFFER, m_bytes_per_frame);
+
+		GLsizeiptr budget = m_bytes_per_frame;
+		while (budget > 0 && !m_uploads.empty()) {
+			image &img = m_uploads.front();
+			glBindTexture(GL_TEXTURE_2D, img.texture);
+
+			mip_level &level = img.levels[img.level];
+			const bool first_upload = img.level == int(img.levels.size()) - 1 && img.row == 0;
+			if (is_compressed(img.format)) {
+				// allocate every level up front, like the uncompressed path below
+				if (first_upload) {
+					glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+					for (size_t l = 0; l < img.levels.size(); l++) {
+						const mip_level &empty = img.levels[l];
+						glCompressedTexImage2D(GL_TEXTURE_2D, GLint(l), img.format, empty.width, empty.height, 0, GLsizei(level_size(img.format, empty.width, empty.height)), nullptr);
+					}
+					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, img.level);
+					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, img.level);
+				}
+
+				// as many whole rows of 4x4 blocks as the budget allows, at least
+				// one. Only the last may be cut short by the bottom edge
+				const GLsizeiptr row_bytes = GLsizeiptr(level_size(img.format, level.width, 4));
+				const int block_row = img.row / 4;
+				const int rows = int(std::min<GLsizeiptr>((level.height + 3) / 4 - block_row, std::max<GLsizeiptr>(1, budget / row_bytes)));
+				const int height = std::min(level.height - img.row, rows * 4);
+				const GLsizeiptr bytes = rows * row_bytes;
+				stream_buffer::allocation staging = m_staging->allocate(bytes, 16);
+				memcpy(staging.data, &level.pixels[block_row * row_bytes], bytes);
+				m_staging->flush(staging);
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_staging->buffer());
+				glCompressedTexSubImage2D(GL_TEXTURE_2D, img.level, 0, img.row, level.width, height, img.format, GLsizei(bytes), reinterpret_cast<const GLvoid *>(staging.offset));
+				budget -= bytes;
+				m_stats.uploaded_bytes += size_t(bytes);
+				img.row += height;
+			}
+			else {
+				// allocate every level up front (nothing to copy, so this doesn't
+				// wait on anything), sampling none of them until they're filled
+				if (first_upload) {
+					glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+					for (size_t l = 0; l < img.levels.size(); l++) {
+						glTexImage2D(GL_TEXTURE_2D, GLint(l), GL_RGBA8, img.levels[l].width, img.levels[l].height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+					}
+					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, img.level);
+					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, img.level);
+				}
+
+				// as many whole rows as the budget allows, at least one
+				const GLsizeiptr row_bytes = GLsizeiptr(level.width) * 4;
+				const int rows = int(std::min<GLsizeiptr>(level.height - img.row, std::max<GLsizeiptr>(1, budget / row_bytes)));
+				const GLsizeiptr bytes = rows * row_bytes;
+				stream_buffer::allocation staging = m_staging->allocate(bytes, 4);
+				memcpy(staging.data, &level.pixels[img.row * row_bytes], bytes);
+				m_staging->flush(staging);
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_staging->buffer());
+				glTexSubImage2D(GL_TEXTURE_2D, img.level, 0, img.row, level.width, rows, GL_RGBA, GL_UNSIGNED_BYTE, reinterpret_cast<const GLvoid *>(staging.offset));
+				budget -= bytes;
+				m_stats.uploaded_bytes += size_t(bytes);
+				img.row += rows;
+			}
+
+			// finished a level, start sampling it
+			if (img.row == level.height) {
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, img.level);
+				level.pixels = vector<unsigned char>();
+				img.level--;
+				img.row = 0;
+				if (img.level < 0) {
+					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, int(img.levels.size()) - 1);
+					m_stats.complete++;
+					m_uploads.pop_front();
+				}
+			}
+		}
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		m_staging->end_frame();
+		m_stats.uploading = unsigned(m_uploads.size());
+		return true;
+	}
+
+
+	void texture_loader::clear() {
+		for (auto &entry : m_textures) glDeleteTextures(1, &entry.second);
+		m_textures.clear();
+		m_uploads.clear();
+		m_generation++;
+	}
+
+}
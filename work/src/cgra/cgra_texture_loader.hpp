@@ -0,0 +1,138 @@
+#pragma once
+
+// std
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// project
+#include <opengl.hpp>
+#include "cgra_stream_buffer.hpp"
+#include "cgra_texture_atlas.hpp"
+#include "cgra_thread_pool.hpp"
+
+
+namespace cgra {
+
+	// loads textures without stalling the frame. Images are decoded with
+	// stb_image and their mip chains built with stb_image_resize on the
+	// thread pool. update() then streams them in through a ring of pixel
+	// unpack buffers, a fixed number of bytes per frame, smallest mip level
+	// first. The base level is raised to each finished level, so a texture
+	// sharpens over a few frames instead of popping in, and glTexImage2D is
+	// only ever called without data (to allocate levels).
+	//
+	// With compression on (and EXT_texture_compression_s3tc), every level is
+	// compressed to BC1 (opaque) or BC3 with stb_dxt, spread over the pool,
+	// and uploaded with glCompressedTexImage2D. Compressed levels are cached
+	// on disk keyed by a hash of the image file's bytes, so loading the same
+	// image again skips decoding and compression.
+	class texture_loader {
+	public:
+		// counted since construction, apart from uploaded_bytes
+		struct stats {
+			unsigned requested = 0;
+			unsigned complete = 0;
+			unsigned failed = 0;
+			unsigned decoding = 0;        // on the pool right now
+			unsigned uploading = 0;       // decoded, not fully uploaded
+			unsigned cache_hits = 0;      // compressed levels read from the cache
+			std::size_t uploaded_bytes = 0; // by the last update()
+			std::size_t gpu_bytes = 0;    // of the loaded textures
+			std::size_t rgba_bytes = 0;   // the same textures uncompressed
+			double decode_ms = 0;         // summed over images, on the workers
+			double compress_ms = 0;       // part of decode_ms
+		};
+
+	private:
+		struct mip_level {
+			int width = 0, height = 0;
+			std::vector<unsigned char> pixels;
+		};
+
+		struct image {
+			GLuint texture = 0;
+			std::string filename;
+			texture_atlas::page page; // the images to compose instead, if it has any
+			GLenum format = GL_RGBA8; // or a compressed format, the levels hold blocks
+			std::vector<mip_level> levels; // empty if decoding failed
+			bool from_cache = false;
+			double decode_ms = 0;
+			double compress_ms = 0;
+			unsigned generation = 0; // of the loader when requested, see clear()
+
+			int level = -1; // next level to upload, counting down to 0
+			int row = 0;    // next row within it
+		};
+
+		static std::string s_cache_directory;
+
+		thread_pool &m_pool;
+		GLsizeiptr m_bytes_per_frame;
+		bool m_compress = true;
+		bool m_s3tc = false; // driver support for BC1/BC3
+		std::unique_ptr<stream_buffer> m_staging; // created on the first upload
+		std::map<std::string, GLuint> m_textures; // by filename
+
+		// decoded on the workers, waiting for update()
+		std::mutex m_mutex;
+		std::condition_variable m_decoded_cv;
+		std::vector<image> m_decoded;
+		unsigned m_in_flight = 0; // tasks on the pool, guarded by m_mutex
+		unsigned m_generation = 0;
+
+		std::deque<image> m_uploads; // in order, the front one is streaming
+		stats m_stats;
+
+		GLuint request(const std::string &filename, const texture_atlas::page &page);
+		void decode(image &img, bool compress);
+		void compress(image &img);
+		static bool read_cache(const std::string &filename, std::uint64_t hash, image &img);
+		static void write_cache(const std::string &filename, std::uint64_t hash, const image &img);
+
+	public:
+		// bytes_per_frame bounds the upload work update() does each frame
+		explicit texture_loader(thread_pool &pool, GLsizeiptr bytes_per_frame = 4 << 20);
+
+		// remove copy ctors
+		texture_loader(const texture_loader &) = delete;
+		texture_loader & operator=(const texture_loader &) = delete;
+
+		// waits for decodes in flight, deletes every texture
+		~texture_loader();
+
+		// the texture for an image file, a 1x1 white texture until it has
+		// streamed in (or for good, if it fails to load). Repeated requests
+		// for the same file return the same texture. GL thread only
+		GLuint load(const std::string &filename);
+
+		// the same for an atlas page, composed from its images on the pool.
+		// Pages only have texture_atlas::levels mip levels
+		GLuint load(const texture_atlas::page &page);
+
+		// upload up to the per frame budget of decoded images, once a frame
+		// on the GL thread. Returns true if any texture changed
+		bool update();
+
+		// images still decoding or uploading
+		bool busy() const { return m_stats.decoding > 0 || !m_uploads.empty(); }
+
+		// forget and delete every texture (decodes in flight are dropped)
+		void clear();
+
+		// block compress textures loaded from now on, if the driver can
+		void set_compression(bool compress) { m_compress = compress; }
+		bool compression() const { return m_compress; }
+
+		// where compressed textures are cached, empty (the default) disables the cache
+		static void set_cache_directory(const std::string &directory) { s_cache_directory = directory; }
+
+		const stats & last_stats() const { return m_stats; }
+	};
+
+}
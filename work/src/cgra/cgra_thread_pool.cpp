@@ -0,0 +1,168 @@
+// std
+#include <algorithm>
+#include <string>
+
+// project
+#include "cgra_thread_pool.hpp"
+#include "cgra_trace.hpp"
+
+
+namespace cgra {
+
+	namespace {
+		// which pool and deque the current thread works for, if any
+		thread_local const void *t_pool = nullptr;
+		thread_local unsigned t_index = 0;
+	}
+
+
+	thread_pool::thread_pool(unsigned threads) {
+		if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+		for (unsigned i = 0; i < threads; i++) {
+			m_queues.emplace_back(new worker_queue());
+		}
+		for (unsigned i = 0; i < threads; i++) {
+			m_workers.emplace_back([this, i]() {
+				t_pool = this;
+				t_index = i;
+				trace::setThreadName("pool worker " + std::to_string(i));
+				worker_loop(i);
+			});
+		}
+	}
+
+
+	thread_pool::~thread_pool() {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_cv.notify_all();
+		for (auto &worker : m_workers) {
+			worker.join();
+		}
+	}
+
+
+	void thread_pool::push(std::function<void()> task) {
+		unsigned index = (t_pool == this) ? t_index : m_next_queue.fetch_add(1) % unsigned(m_queues.size());
+
+		// counted before it's visible, so a thief can't take it (and
+		// decrement) first and wrap m_pending around
+		m_pending.fetch_add(1);
+		{
+			std::lock_guard<std::mutex> lock(m_queues[index]->mutex);
+			m_queues[index]->tasks.push_back(std::move(task));
+		}
+
+		// taking the lock orders this with a worker checking m_pending
+		// before it sleeps, so the wake up can't be missed
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+		}
+		m_cv.notify_one();
+	}
+
+
+	bool thread_pool::try_pop(unsigned index, std::function<void()> &task) {
+		// own deque first, newest task
+		{
+			worker_queue &queue = *m_queues[index];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (!queue.tasks.empty()) {
+				task = std::move(queue.tasks.back());
+				queue.tasks.pop_back();
+				m_pending.fetch_sub(1);
+				return true;
+			}
+		}
+
+		// then steal the oldest task from someone else
+		const unsigned count = unsigned(m_queues.size());
+		for (unsigned i = 1; i < count; i++) {
+			worker_queue &queue = *m_queues[(index + i) % count];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (!queue.tasks.empty()) {
+				task = std::move(queue.tasks.front());
+				queue.tasks.pop_front();
+				m_pending.fetch_sub(1);
+				m_steals.fetch_add(1, std::memory_order_relaxed);
+				return true;
+			}
+		}
+		return false;
+	}
+
+
+	void thread_pool::worker_loop(unsigned index) {
+		while (true) {
+			std::function<void()> task;
+			if (try_pop(index, task)) {
+				task();
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cv.wait(lock, [this]() { return m_stop || m_pending.load() > 0; });
+			if (m_stop && m_pending.load() == 0) return; // stopping and nothing left to do
+		}
+	}
+
+
+	void thread_pool::parallel_for(std::size_t begin, std::size_t end, std::size_t grain, const std::function<void(std::size_t, std::size_t)> &body) {
+		if (end <= begin) return;
+		grain = std::max<std::size_t>(grain, 1);
+		const std::size_t range_count = (end - begin + grain - 1) / grain;
+
+		// single range, no point waking anyone up
+		if (range_count == 1 || m_workers.empty()) {
+			body(begin, end);
+			return;
+		}
+
+		// shared between the caller and helpers, helpers may start after
+		// the caller has already returned so it can't live on the stack
+		struct shared_state {
+			std::atomic<std::size_t> next{ 0 };
+			std::atomic<std::size_t> done{ 0 };
+			std::mutex mutex;
+			std::condition_variable cv;
+			std::exception_ptr error;
+		};
+		auto state = std::make_shared<shared_state>();
+
+		// body is only referenced while ranges remain, and the caller
+		// doesn't return until every range is done, so this is safe
+		const auto *body_ptr = &body;
+		auto run = [state, body_ptr, begin, end, grain, range_count]() {
+			std::size_t i;
+			while ((i = state->next.fetch_add(1)) < range_count) {
+				std::size_t first = begin + i * grain;
+				std::size_t last = std::min(end, first + grain);
+				try {
+					(*body_ptr)(first, last);
+				}
+				catch (...) {
+					std::lock_guard<std::mutex> lock(state->mutex);
+					if (!state->error) state->error = std::current_exception();
+				}
+				if (state->done.fetch_add(1) + 1 == range_count) {
+					std::lock_guard<std::mutex> lock(state->mutex);
+					state->cv.notify_all();
+				}
+			}
+		};
+
+		// wake up to one helper per worker, the caller is another helper
+		const std::size_t helpers = std::min<std::size_t>(m_workers.size(), range_count - 1);
+		for (std::size_t i = 0; i < helpers; i++) {
+			push(run);
+		}
+
+		run();
+
+		std::unique_lock<std::mutex> lock(state->mutex);
+		state->cv.wait(lock, [&]() { return state->done.load() == range_count; });
+		if (state->error) std::rethrow_exception(state->error);
+	}
+
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+// std
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace cgra {
+
+	// fixed size pool of worker threads for CPU side work
+	// (culling, rasterization, parsing etc). Does not touch OpenGL.
+	//
+	// Each worker owns a task deque. Tasks submitted from a worker go on the
+	// back of its own deque and it takes from the back (newest first, still
+	// hot in cache), other threads' tasks are dealt round robin. A worker with
+	// nothing left steals from the front of another worker's deque, so many
+	// small uneven tasks (ray tracing tiles etc) balance themselves.
+	class thread_pool {
+	private:
+		struct worker_queue {
+			std::mutex mutex;
+			std::deque<std::function<void()>> tasks;
+		};
+
+		std::vector<std::thread> m_workers;
+		std::vector<std::unique_ptr<worker_queue>> m_queues; // one per worker
+		std::atomic<std::size_t> m_pending{ 0 }; // queued, not yet taken
+		std::atomic<unsigned> m_next_queue{ 0 }; // round robin for outside submits
+		std::atomic<std::size_t> m_steals{ 0 };
+		std::mutex m_mutex; // only for sleeping and waking workers
+		std::condition_variable m_cv;
+		bool m_stop = false;
+
+		void worker_loop(unsigned index);
+		void push(std::function<void()> task);
+		bool try_pop(unsigned index, std::function<void()> &task);
+
+	public:
+		// creates a pool with the given number of threads
+		// zero means one per hardware thread
+		explicit thread_pool(unsigned threads = 0);
+
+		// remove copy ctors
+		thread_pool(const thread_pool &) = delete;
+		thread_pool & operator=(const thread_pool &) = delete;
+
+		// finishes queued tasks and joins all workers
+		~thread_pool();
+
+		// number of worker threads
+		unsigned size() const { return unsigned(m_workers.size()); }
+
+		// number of tasks taken from another worker's deque so far
+		std::size_t steals() const { return m_steals.load(); }
+
+		// queue a task, the returned future holds its result
+		template <typename Func>
+		auto submit(Func &&f) -> std::future<decltype(f())> {
+			using result_t = decltype(f());
+			auto task = std::make_shared<std::packaged_task<result_t()>>(std::forward<Func>(f));
+			std::future<result_t> result = task->get_future();
+			push([task]() { (*task)(); });
+			return result;
+		}
+
+		// calls body(first, last) over [begin, end) split into ranges of at
+		// most grain items, and blocks until every range is done. The calling
+		// thread takes ranges too, so this is safe to call from inside a task.
+		void parallel_for(std::size_t begin, std::size_t end, std::size_t grain, const std::function<void(std::size_t, std::size_t)> &body);
+	};
+
+}
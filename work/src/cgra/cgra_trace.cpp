@@ -0,0 +1,177 @@
+// std
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// project
+#include "cgra_trace.hpp"
+
+
+using namespace std;
+
+
+namespace cgra {
+
+	namespace {
+
+		struct trace_event {
+			const char *name;
+			int64_t begin; // microseconds
+			int64_t duration;
+		};
+
+		// events are written into fixed size chunks, the owning thread is the
+		// only writer and publishes each event by bumping the chunk's count,
+		// so dump() can read concurrently without locking the hot path
+		struct event_chunk {
+			static const size_t capacity = 4096;
+			array<trace_event, capacity> events;
+			atomic<size_t> count{ 0 };
+		};
+
+		struct thread_buffer {
+			int id;
+			string name;
+			mutex chunk_mutex; // guards chunks and name, taken once per chunk
+			vector<unique_ptr<event_chunk>> chunks;
+			event_chunk *current = nullptr;
+		};
+
+		// internal data
+		atomic<bool> g_enabled{ false };
+		mutex g_registry_mutex;
+		vector<shared_ptr<thread_buffer>> g_buffers; // kept after threads exit
+		const auto g_epoch = chrono::steady_clock::now();
+
+		int64_t now_us() {
+			return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - g_epoch).count();
+		}
+
+		thread_buffer & local_buffer() {
+			thread_local shared_ptr<thread_buffer> buffer;
+			if (!buffer) {
+				buffer = make_shared<thread_buffer>();
+				lock_guard<mutex> lock(g_registry_mutex);
+				buffer->id = int(g_buffers.size());
+				g_buffers.push_back(buffer);
+			}
+			return *buffer;
+		}
+
+		void record(const char *name, int64_t begin, int64_t end) {
+			thread_buffer &buffer = local_buffer();
+			event_chunk *chunk = buffer.current;
+			size_t n = chunk ? chunk->count.load(memory_order_relaxed) : event_chunk::capacity;
+			if (n == event_chunk::capacity) {
+				lock_guard<mutex> lock(buffer.chunk_mutex);
+				buffer.chunks.emplace_back(new event_chunk());
+				chunk = buffer.current = buffer.chunks.back().get();
+				n = 0;
+			}
+			chunk->events[n] = { name, begin, end - begin };
+			chunk->count.store(n + 1, memory_order_release);
+		}
+
+		void write_escaped(ostream &out, const string &s) {
+			for (char c : s) {
+				if (c == '"' || c == '\\') out << '\\' << c;
+				else if (c == '\n') out << "\\n";
+				else if ((unsigned char)c < 0x20) out << ' ';
+				else out << c;
+			}
+		}
+	}
+
+
+	namespace trace {
+
+		void setEnabled(bool enabled) {
+			g_enabled.store(enabled);
+		}
+
+
+		bool enabled() {
+			return g_enabled.load(memory_order_relaxed);
+		}
+
+
+		size_t eventCount() {
+			size_t count = 0;
+			lock_guard<mutex> lock(g_registry_mutex);
+			for (auto &buffer : g_buffers) {
+				lock_guard<mutex> buffer_lock(buffer->chunk_mutex);
+				for (auto &chunk : buffer->chunks) count += chunk->count.load(memory_order_acquire);
+			}
+			return count;
+		}
+
+
+		bool dump(const string &filename) {
+			ofstream out(filename);
+			if (!out) {
+				cerr << "Error: Could not open trace file " << filename << endl;
+				return false;
+			}
+
+			out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+			bool first = true;
+			size_t count = 0;
+			lock_guard<mutex> lock(g_registry_mutex);
+			for (auto &buffer : g_buffers) {
+				lock_guard<mutex> buffer_lock(buffer->chunk_mutex);
+
+				// thread name metadata
+				if (!buffer->name.empty()) {
+					out << (first ? "" : ",\n") << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":0,\"tid\":" << buffer->id << ",\"args\":{\"name\":\"";
+					write_escaped(out, buffer->name);
+					out << "\"}}";
+					first = false;
+				}
+
+				for (auto &chunk : buffer->chunks) {
+					size_t n = chunk->count.load(memory_order_acquire);
+					for (size_t i = 0; i < n; i++) {
+						const trace_event &e = chunk->events[i];
+						out << (first ? "" : ",\n") << "{\"ph\":\"X\",\"name\":\"";
+						write_escaped(out, e.name);
+						out << "\",\"pid\":0,\"tid\":" << buffer->id << ",\"ts\":" << e.begin << ",\"dur\":" << e.duration << "}";
+						first = false;
+					}
+					count += n;
+				}
+			}
+			out << "\n]}\n";
+
+			if (!out) {
+				cerr << "Error: Could not write trace file " << filename << endl;
+				return false;
+			}
+			cout << "Wrote " << count << " trace events to " << filename << endl;
+			return true;
+		}
+
+
+		void setThreadName(const string &name) {
+			thread_buffer &buffer = local_buffer();
+			lock_guard<mutex> lock(buffer.chunk_mutex);
+			buffer.name = name;
+		}
+
+
+		scope::scope(const char *name) : m_name(nullptr), m_begin(0) {
+			if (!g_enabled.load(memory_order_relaxed)) return;
+			m_name = name;
+			m_begin = now_us();
+		}
+
+
+		scope::~scope() {
+			if (m_name) record(m_name, m_begin, now_us());
+		}
+	}
+}
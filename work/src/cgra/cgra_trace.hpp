@@ -0,0 +1,49 @@
+#pragma once
+
+// std
+#include <cstdint>
+#include <string>
+
+
+namespace cgra {
+	namespace trace {
+
+		// start or stop recording. Events are only recorded while
+		// enabled, otherwise a trace scope costs one relaxed load
+		void setEnabled(bool enabled);
+		bool enabled();
+
+		// number of events recorded so far, across all threads
+		std::size_t eventCount();
+
+		// write every recorded event as Chrome trace event JSON, which loads
+		// in about://tracing and ui.perfetto.dev. Returns false on failure
+		bool dump(const std::string &filename);
+
+		// name the calling thread in the trace
+		void setThreadName(const std::string &name);
+
+		// records a complete event ("ph":"X") covering the enclosing block
+		// into a per-thread buffer. Recording locks once per chunk of events
+		// (to add the chunk), not once per event. name must outlive the
+		// trace (use string literals)
+		class scope {
+		private:
+			const char *m_name;
+			std::int64_t m_begin;
+
+		public:
+			explicit scope(const char *name);
+			~scope();
+
+			scope(const scope &) = delete;
+			scope & operator=(const scope &) = delete;
+		};
+	}
+}
+
+
+// convenience macro, CGRA_TRACE_SCOPE("name") traces the enclosing block
+#define CGRA_TRACE_CONCAT_IMPL(a, b) a##b
+#define CGRA_TRACE_CONCAT(a, b) CGRA_TRACE_CONCAT_IMPL(a, b)
+#define CGRA_TRACE_SCOPE(name) ::cgra::trace::scope CGRA_TRACE_CONCAT(cgra_trace_scope_, __LINE__)(name)
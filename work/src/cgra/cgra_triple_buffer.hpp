@@ -0,0 +1,53 @@
+#pragma once
+
+// std
+#include <atomic>
+
+
+namespace cgra {
+
+	// lock free single producer, single consumer hand over of the latest
+	// value. The writer fills back() and publish()es it; the reader calls
+	// update() and reads front(). Neither side ever waits for the other:
+	// the three buffers are swapped through one atomic index, so the reader
+	// always sees a whole value and values it didn't get to are skipped
+	template <typename T>
+	class triple_buffer {
+	private:
+		// set on the middle index while it holds a value the reader hasn't taken
+		static constexpr unsigned fresh_bit = 4;
+
+		T m_buffers[3];
+		unsigned m_back = 0;  // writer only
+		std::atomic<unsigned> m_middle{ 1 };
+		unsigned m_front = 2; // reader only
+
+	public:
+		triple_buffer() { }
+
+		// remove copy ctors
+		triple_buffer(const triple_buffer &) = delete;
+		triple_buffer & operator=(const triple_buffer &) = delete;
+
+		// writer: the buffer to fill in. After publish() it holds an older
+		// value (not necessarily the last one written), so write all of it
+		T & back() { return m_buffers[m_back]; }
+
+		// writer: make back() the latest value
+		void publish() {
+			m_back = m_middle.exchange(m_back | fresh_bit, std::memory_order_acq_rel) & 3;
+		}
+
+		// reader: take the latest value if there is a new one, returns
+		// true if front() changed
+		bool update() {
+			if (!(m_middle.load(std::memory_order_relaxed) & fresh_bit)) return false;
+			m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & 3;
+			return true;
+		}
+
+		// reader: the value taken by the last update()
+		const T & front() const { return m_buffers[m_front]; }
+	};
+
+}
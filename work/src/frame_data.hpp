@@ -0,0 +1,47 @@
+
+#pragma once
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "opengl.hpp"
+#include "cgra/cgra_render_queue.hpp"
+#include "cgra/cgra_shader.hpp"
+#include "soft_rasterizer.hpp"
+
+
+// camera, viewport and directional light, laid out like the std140
+// FrameData block every shader in res/shaders declares. Written once a
+// frame (per view) and bound at binding, rather than set on each program
+// as uniforms
+struct FrameData {
+	static constexpr GLuint binding = 0;
+
+	glm::mat4 projection = glm::mat4(1); // uProjectionMatrix
+	glm::vec3 lightDirection = glm::vec3(0, -1, -1); // uLightDirection, view space
+	float pad0 = 0;
+	glm::vec3 lightColor = glm::vec3(1); // uLightColor
+	float ambient = 0; // uAmbient
+	float diffuse = 0; // uDiffuse
+	float specular = 0; // uSpecular
+	float shininess = 0; // uShininess
+	float pad1 = 0;
+	glm::vec2 viewportSize = glm::vec2(1); // uViewportSize, pixels
+	float tessEdgePixels = 16; // uTessEdgePixels, for pn_triangles.glsl
+	float pad2 = 0;
+
+	FrameData() { }
+	explicit FrameData(const ShadingParams &params)
+		: projection(params.projection), lightDirection(params.lightDirection), lightColor(params.lightColor),
+		ambient(params.ambient), diffuse(params.diffuse), specular(params.specular), shininess(params.shininess) { }
+
+	// point the FrameData and ObjectData (see cgra::render_queue) blocks
+	// of every program built from now on at their binding points
+	static void setBlockBindings() {
+		cgra::shader_builder::set_uniform_block_binding("FrameData", binding);
+		cgra::shader_builder::set_uniform_block_binding("ObjectData", cgra::render_queue::object_binding);
+	}
+};
+
+static_assert(sizeof(FrameData) == 128, "FrameData must match the std140 block");
@@ -1,13 +1,37 @@
 
 // std
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
 #include <iostream>
+#include <mutex>
+#include <optional>
 #include <string>
 #include <stdexcept>
+#include <thread>
+#include <vector>
+
+// glm
+#include <glm/gtc/matrix_transform.hpp>
 
 // project
 #include "application.hpp"
+#include "batch_renderer.hpp"
 #include "opengl.hpp"
+#include "ray_caster.hpp"
+#include "soft_rasterizer.hpp"
 #include "cgra/cgra_gui.hpp"
+#include "cgra/cgra_light_clusters.hpp"
+#include "cgra/cgra_offscreen.hpp"
+#include "cgra/cgra_profiler.hpp"
+#include "cgra/cgra_shader.hpp"
+#include "cgra/cgra_trace.hpp"
+#include "cgra/cgra_triple_buffer.hpp"
 
 
 using namespace std;
@@ -20,17 +44,268 @@ namespace {
 	void scrollCallback(GLFWwindow *win, double xoffset, double yoffset);
 	void keyCallback(GLFWwindow *win, int key, int scancode, int action, int mods);
 	void charCallback(GLFWwindow *win, unsigned int c);
+	void windowRefreshCallback(GLFWwindow *win);
+	void framebufferSizeCallback(GLFWwindow *win, int width, int height);
 	void APIENTRY debugCallback(GLenum, GLenum, GLuint, GLenum, GLsizei, const GLchar*, GLvoid*);
 
 	// global static pointer to application once we create it
 	// nessesary for interfacing with the GLFW callbacks
 	Application *application_ptr = nullptr;
+
+	// the GLFW callbacks only record input, it's handled (forwarded to
+	// ImGui and the application) on the thread that draws
+	struct InputEvent {
+		enum Type { CursorPos, MouseButton, Scroll, Key, Char, Refresh, FramebufferSize } type;
+		double x = 0, y = 0; // cursor position or scroll offset
+		int a = 0, b = 0, c = 0, d = 0; // button/key, scancode, action, mods, or size, or character
+		std::uint64_t sequence = 0;
+		std::chrono::steady_clock::time_point time; // when GLFW delivered it
+		std::optional<std::string> clipboard; // read at a paste shortcut, for ImGui on the render thread
+
+		explicit InputEvent(Type type = Refresh) : type(type) { }
+	};
+
+	// events not yet handled, main thread only
+	std::vector<InputEvent> pending_events;
+	std::uint64_t next_sequence = 1;
+
+	// set while ImGui runs on the render thread, the clipboard then travels with key events
+	bool deferred_clipboard = false;
+
+	void handleEvent(const InputEvent &e);
+
+	// what the main thread hands the render thread
+	struct InputSnapshot {
+		cgra::gui::window_state window;
+		std::vector<InputEvent> events; // everything the render thread hasn't handled yet
+		bool close = false;
+	};
+
+	// frames still to draw after input, ImGui needs a couple to settle
+	// (hover highlights, click release) before the GUI stops changing
+	const int settle_frames = 3;
+	int redraw_frames = settle_frames;
+
+	// frames drawn for other reasons (the model changing, continuous
+	// rendering) draw the last GUI again instead of rebuilding it, but
+	// rebuild this often so the numbers it shows stay current
+	const chrono::milliseconds gui_refresh(250);
+
+	// GLFW 3.1 has no glfwWaitEventsTimeout, so a helper thread posts
+	// an empty event to wake glfwWaitEvents once the timeout passes
+	class EventWaker {
+	private:
+		std::thread m_thread;
+		std::mutex m_mutex;
+		std::condition_variable m_cv;
+		std::chrono::steady_clock::time_point m_deadline;
+		bool m_armed = false;
+		bool m_stop = false;
+
+		void run() {
+			std::unique_lock<std::mutex> lock(m_mutex);
+			while (!m_stop) {
+				if (!m_armed) {
+					m_cv.wait(lock);
+				}
+				else if (m_cv.wait_until(lock, m_deadline) == std::cv_status::timeout && m_armed) {
+					m_armed = false;
+					glfwPostEmptyEvent();
+				}
+			}
+		}
+
+	public:
+		EventWaker() : m_thread([this]() { run(); }) { }
+
+		~EventWaker() {
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_stop = true;
+			}
+			m_cv.notify_all();
+			m_thread.join();
+		}
+
+		// block until an event arrives or timeout seconds pass
+		void waitEvents(double timeout) {
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeout));
+				m_armed = true;
+			}
+			m_cv.notify_all();
+			glfwWaitEvents();
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_armed = false;
+			}
+			m_cv.notify_all();
+		}
+	};
+
+	// wakes the render thread when input is published. The input itself
+	// goes through a triple buffer, the lock only guards sleeping
+	class Doorbell {
+	private:
+		std::mutex m_mutex;
+		std::condition_variable m_cv;
+		bool m_rung = false;
+
+	public:
+		void ring() {
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_rung = true;
+			}
+			m_cv.notify_one();
+		}
+
+		// block until rung or timeout seconds pass
+		void wait(double timeout) {
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cv.wait_for(lock, std::chrono::duration<double>(timeout), [this]() { return m_rung; });
+			m_rung = false;
+		}
+	};
+
+	// input latency and frame pacing of the windowed loop, printed on exit
+	class FrameStats {
+	private:
+		std::vector<double> m_frameTimes; // ms between back to back presents
+		std::vector<double> m_latencies; // ms from a frame's oldest input to its present
+		std::chrono::steady_clock::time_point m_lastPresent;
+		std::chrono::steady_clock::time_point m_oldestInput;
+		bool m_haveInput = false;
+		bool m_backToBack = false;
+
+		static void summarize(const char *what, std::vector<double> values) {
+			if (values.empty()) return;
+			double mean = 0, variance = 0;
+			for (double v : values) mean += v;
+			mean /= values.size();
+			for (double v : values) variance += (v - mean) * (v - mean);
+			variance /= values.size();
+			std::sort(values.begin(), values.end());
+			cout << what << ": mean " << mean << " ms, std dev " << std::sqrt(variance) << " ms, 95th percentile ";
+			cout << values[values.size() * 95 / 100] << " ms over " << values.size() << " frames" << endl;
+		}
+
+	public:
+		void received(std::chrono::steady_clock::time_point time) {
+			if (!m_haveInput) m_oldestInput = time;
+			m_haveInput = true;
+		}
+
+		void idled() { m_backToBack = false; }
+
+		// after glfwSwapBuffers returns
+		void presented() {
+			auto now = std::chrono::steady_clock::now();
+			if (m_backToBack) m_frameTimes.push_back(std::chrono::duration<double, std::milli>(now - m_lastPresent).count());
+			if (m_haveInput) m_latencies.push_back(std::chrono::duration<double, std::milli>(now - m_oldestInput).count());
+			m_lastPresent = now;
+			m_backToBack = true;
+			m_haveInput = false;
+		}
+
+		void print() const {
+			summarize("Input to present", m_latencies);
+			summarize("Frame time", m_frameTimes);
+		}
+	};
+
+	// command line options
+	struct Options {
+		bool headless = false; // render offscreen and write an image instead of opening a window
+		std::string output = "render.png"; // headless image output
+		std::string model; // model to load at startup
+		int width = 800;
+		int height = 600;
+		int frames = 1; // headless frames to render (for benchmarking)
+		std::string batchInput; // directory of obj files to make thumbnails of
+		std::string batchOutput; // directory to write thumbnails to
+		unsigned threads = 0; // batch worker threads per stage, 0 for all cores
+		bool continuous = false; // redraw every frame even when nothing changes
+		std::string trace; // record a trace from startup and write it here on exit
+		bool software = false; // draw with the CPU rasterizer instead of OpenGL
+		bool benchRaster = false; // benchmark the CPU rasterizer across thread counts and exit
+		bool rayCast = false; // write a ray cast still to output (no GL needed)
+		bool benchRayCast = false; // benchmark the ray caster across thread counts and exit
+		RayCaster::Settings rayCastSettings;
+		std::string shaderCache = "shader_cache"; // program binary cache directory, empty to disable
+		bool syncShaders = false; // wait for shaders to build instead of drawing with a fallback
+		int lights = 0; // point lights around the model
+		int instances = 1; // copies of the model, drawn through the render queue
+		bool unsorted = false; // submit draws in the order they were queued
+		bool quadView = false; // perspective, top, front and side views
+		bool tessellate = false; // draw PN triangle patches (needs GL 4.0)
+		bool benchLights = false; // benchmark light cluster assignment across thread counts and exit
+		bool singleThread = false; // handle events and draw on the main thread
+		std::string textureCache = "texture_cache"; // compressed texture cache directory, empty to disable
+		bool uncompressedTextures = false; // upload textures as RGBA8 instead of BC1/BC3
+		bool noAtlas = false; // give every texture its own GL texture
+	};
+
+	Options parseOptions(int argc, char **argv);
+	void runRenderLoop(GLFWwindow *window, const Options &options, chrono::steady_clock::time_point launched, const cgra::gui::window_state &initial,
+		const function<void(double)> &wait, const function<bool(cgra::gui::window_state &, FrameStats &)> &takeInput);
+	void runSingleThreaded(GLFWwindow *window, const Options &options, chrono::steady_clock::time_point launched);
+	void runRenderThread(GLFWwindow *window, const Options &options, chrono::steady_clock::time_point launched);
+	int runHeadless(GLFWwindow *window, Application &application, const Options &options, chrono::steady_clock::time_point launched);
+	int runRasterBenchmark(const Options &options);
+	int runRayCast(const Options &options);
 }
 
 
 // main program
 // 
-int main() {
+// usage: base [--headless] [--output file.png] [--model file.obj] [--size WxH] [--frames N]
+//        base --batch <obj dir> <png dir> [--size WxH] [--threads N]
+//        base [--continuous] (redraw every frame instead of only on changes)
+//        base [--trace trace.json] (any mode, writes a Chrome trace on exit)
+//        base [--software] (windowed or headless, draws with the CPU rasterizer)
+//        base --bench-raster [--model file.obj] [--size WxH] [--frames N] (no GL needed)
+//        base --raycast [--output file.png] [--samples N] [--no-shadows] (no GL needed, N is 1 to 4 per axis)
+//        base --bench-raycast [--model file.obj] [--size WxH] [--samples N] [--no-shadows]
+//        base [--shader-cache dir] (program binary cache, "" to disable, default shader_cache)
+//        base [--sync-shaders] (wait for shaders to compile instead of drawing a flat fallback)
+//        base [--lights N] (N point lights with clustered shading)
+//        base [--instances N] [--unsorted] (N copies of the model, draws sorted by state unless --unsorted)
+//        base [--quad-view] (perspective, top, front and side views in one window)
+//        base [--tessellate] (curved PN triangles, finer up close, where GL 4.0 is available)
+//        base --bench-lights [--lights N] (light cluster assignment, 1024 lights by default, no GL needed)
+//        base [--single-thread] (handle events and draw on one thread instead of a render thread)
+//        base [--texture-cache dir] (compressed texture cache, "" to disable, default texture_cache)
+//        base [--uncompressed-textures] (upload textures as RGBA8 instead of BC1/BC3)
+//        base [--no-atlas] (don't pack small textures into shared atlas pages)
+//
+// headless mode creates a hidden window and renders into a framebuffer object,
+// so it runs under Mesa llvmpipe on machines without a GPU. It still needs an
+// X server for the window (GLFW 3.1 always creates one through X11, and GLEW
+// loads entry points through GLX), eg. xvfb-run base --headless on a server
+int main(int argc, char **argv) {
+
+	// for reporting the time to the first frame
+	auto launched = chrono::steady_clock::now();
+
+	Options options = parseOptions(argc, argv);
+
+	// record the whole load pipeline and the frames after it
+	cgra::trace::setThreadName("main");
+	if (!options.trace.empty()) cgra::trace::setEnabled(true);
+	struct TraceDump {
+		const std::string &file;
+		~TraceDump() { if (!file.empty()) cgra::trace::dump(file); }
+	} traceDump{ options.trace };
+
+	// the CPU rasterizer benchmark doesn't need a window at all
+	if (options.benchRaster) return runRasterBenchmark(options);
+	if (options.benchLights) {
+		cgra::light_clusters::benchmark(options.lights > 0 ? options.lights : 1024, max(options.frames, 100));
+		return EXIT_SUCCESS;
+	}
+	if (options.rayCast || options.benchRayCast) return runRayCast(options);
 
 	// initialize the GLFW library
 	if (!glfwInit()) {
@@ -54,8 +329,12 @@ int main() {
 	// remove this for possible GL performance increases
 	glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, true);
 
+	// headless rendering never shows the window
+	bool batch = !options.batchInput.empty();
+	if (options.headless || batch) glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+
 	// create a windowed mode window and its OpenGL context
-	GLFWwindow *window = glfwCreateWindow(800, 600, "Hello World!", nullptr, nullptr);
+	GLFWwindow *window = glfwCreateWindow(options.width, options.height, "Hello World!", nullptr, nullptr);
 	if (!window) {
 		cerr << "Error: Could not create GLFW window" << endl;
 		abort(); // unrecoverable error
@@ -92,10 +371,40 @@ int main() {
 		cout << "GL_ARB_debug_output not available. No worries." << endl;
 	}
 
-	// initialize ImGui
-	if (!cgra::gui::init(window)) {
-		cerr << "Error: Could not initialize ImGui" << endl;
-		abort(); // unrecoverable error
+	// reuse linked programs from earlier runs
+	cgra::shader_builder::set_cache_directory(options.shaderCache);
+	cgra::texture_loader::set_cache_directory(options.textureCache);
+
+	// render thumbnails for a whole directory and exit
+	if (batch) {
+		int written;
+		{
+			BatchRenderer renderer(window, options.width, options.height, options.threads, options.threads);
+			written = renderer.run(options.batchInput, options.batchOutput);
+		}
+		glfwTerminate();
+		return written > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	// render offscreen, write the image and exit
+	if (options.headless) {
+		int result;
+		{
+			Application application(window);
+			application.setSoftwareRendering(options.software);
+			application.setPointLights(options.lights);
+			application.setInstances(options.instances);
+			application.setSortDraws(!options.unsorted);
+			application.setQuadView(options.quadView);
+			application.setTessellation(options.tessellate);
+			if (options.tessellate && !application.tessellationSupported()) cerr << "Warning: Tessellation needs OpenGL 4.0, drawing triangles" << endl;
+			application.setTextureCompression(!options.uncompressedTextures);
+			application.setTextureAtlas(!options.noAtlas);
+			application.setAsyncShaders(false); // the image has to use the real shaders
+			result = runHeadless(window, application, options, launched);
+		}
+		glfwTerminate();
+		return result;
 	}
 
 	// attach input callbacks to window
@@ -104,89 +413,552 @@ int main() {
 	glfwSetScrollCallback(window, scrollCallback);
 	glfwSetKeyCallback(window, keyCallback);
 	glfwSetCharCallback(window, charCallback);
+	glfwSetWindowRefreshCallback(window, windowRefreshCallback);
+	glfwSetFramebufferSizeCallback(window, framebufferSizeCallback);
+
+	// draw on a thread of its own so slow event handling doesn't hold up
+	// frames, or everything on this one
+	if (options.singleThread) runSingleThreaded(window, options, launched);
+	else runRenderThread(window, options, launched);
+
+	glfwTerminate();
+}
+
+
+namespace {
+
+	Options parseOptions(int argc, char **argv) {
+		Options options;
+		for (int i = 1; i < argc; i++) {
+			string arg = argv[i];
+			bool hasValue = i + 1 < argc;
+			if (arg == "--headless") {
+				options.headless = true;
+			}
+			else if (arg == "--output" && hasValue) {
+				options.output = argv[++i];
+			}
+			else if (arg == "--model" && hasValue) {
+				options.model = argv[++i];
+			}
+			else if (arg == "--size" && hasValue) {
+				string size = argv[++i];
+				size_t x = size.find('x');
+				if (x != string::npos) {
+					options.width = max(1, atoi(size.substr(0, x).c_str()));
+					options.height = max(1, atoi(size.substr(x + 1).c_str()));
+				}
+			}
+			else if (arg == "--frames" && hasValue) {
+				options.frames = max(1, atoi(argv[++i]));
+			}
+			else if (arg == "--batch" && i + 2 < argc) {
+				options.batchInput = argv[++i];
+				options.batchOutput = argv[++i];
+			}
+			else if (arg == "--trace" && hasValue) {
+				options.trace = argv[++i];
+			}
+			else if (arg == "--continuous") {
+				options.continuous = true;
+			}
+			else if (arg == "--software") {
+				options.software = true;
+			}
+			else if (arg == "--bench-raster") {
+				options.benchRaster = true;
+			}
+			else if (arg == "--raycast") {
+				options.rayCast = true;
+			}
+			else if (arg == "--bench-raycast") {
+				options.benchRayCast = true;
+			}
+			else if (arg == "--samples" && hasValue) {
+				options.rayCastSettings.samples = max(1, atoi(argv[++i]));
+			}
+			else if (arg == "--no-shadows") {
+				options.rayCastSettings.shadows = false;
+			}
+			else if (arg == "--shader-cache" && hasValue) {
+				options.shaderCache = argv[++i];
+			}
+			else if (arg == "--lights" && hasValue) {
+				options.lights = max(0, atoi(argv[++i]));
+			}
+			else if (arg == "--instances" && hasValue) {
+				options.instances = max(1, atoi(argv[++i]));
+			}
+			else if (arg == "--unsorted") {
+				options.unsorted = true;
+			}
+			else if (arg == "--quad-view") {
+				options.quadView = true;
+			}
+			else if (arg == "--tessellate") {
+				options.tessellate = true;
+			}
+			else if (arg == "--bench-lights") {
+				options.benchLights = true;
+			}
+			else if (arg == "--sync-shaders") {
+				options.syncShaders = true;
+			}
+			else if (arg == "--single-thread") {
+				options.singleThread = true;
+			}
+			else if (arg == "--texture-cache" && hasValue) {
+				options.textureCache = argv[++i];
+			}
+			else if (arg == "--uncompressed-textures") {
+				options.uncompressedTextures = true;
+			}
+			else if (arg == "--no-atlas") {
+				options.noAtlas = true;
+			}
+			else if (arg == "--threads" && hasValue) {
+				options.threads = unsigned(max(0, atoi(argv[++i])));
+			}
+			else {
+				cerr << "Warning: Ignoring unknown argument " << arg << endl;
+			}
+		}
+		return options;
+	}
 
-	
-	// create the application object (and a global pointer to it)
-	Application application(window);
-	application_ptr = &application;
 
-	// loop until the user closes the window
-	while (!glfwWindowShouldClose(window)) {
+	// render Application::render into an offscreen framebuffer and write a PNG
+	int runHeadless(GLFWwindow *window, Application &application, const Options &options, chrono::steady_clock::time_point launched) {
+		if (!options.model.empty() && !application.loadModel(options.model)) {
+			return EXIT_FAILURE;
+		}
 
-		// main Render
-		//glEnable(GL_FRAMEBUFFER_SRGB); // use if you know about gamma correction
-		application.render();
+		// the hidden window may not get the size we asked for
+		int width, height;
+		glfwGetFramebufferSize(window, &width, &height);
+		application.framebufferSizeCallback(width, height);
+		cgra::offscreen_target target(width, height);
+		target.bind();
 
-		// GUI Render on top
-		//glDisable(GL_FRAMEBUFFER_SRGB); // use if you know about gamma correction
-		cgra::gui::newFrame();
-		application.renderGUI();
-		cgra::gui::render();
+		// let the textures stream in before timing anything
+		if (application.loadingTextures()) {
+			auto streaming = chrono::steady_clock::now();
+			int frames = 0;
+			for (; application.loadingTextures(); frames++) application.render();
+			glFinish();
+			chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - streaming;
+			const cgra::texture_loader::stats &textures = application.textureStats();
+			cout << "Streamed " << textures.complete << " texture(s) in " << elapsed.count() << " ms over " << frames << " frame(s)";
+			cout << " (" << textures.decode_ms << " ms decoding on the workers, " << textures.failed << " failed)" << endl;
+			cout << "Textures: " << textures.gpu_bytes / 1024 << " KB on the GPU, " << textures.rgba_bytes / 1024 << " KB as RGBA8";
+			cout << " (" << textures.compress_ms << " ms compressing, " << textures.cache_hits << " from the cache)" << endl;
+		}
 
-		// swap front and back buffers
-		glfwSwapBuffers(window);
+		auto start = chrono::steady_clock::now();
+		for (int i = 0; i < options.frames; i++) {
+			application.render();
+			if (i == 0) {
+				glFinish();
+				chrono::duration<double, milli> first = chrono::steady_clock::now() - launched;
+				cout << "First frame after " << first.count() << " ms" << endl;
+			}
+		}
+		glFinish();
+		chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+		cout << "Rendered " << options.frames << " frame(s) at " << width << "x" << height;
+		cout << ", " << elapsed.count() / options.frames << " ms per frame" << endl;
+		const cgra::render_queue::stats &stats = application.renderStats();
+		cout << "Render queue: " << stats.draws << " draws in " << stats.batches << " GL calls, " << stats.state_changes() << " state changes per frame";
+		cout << " (" << stats.programs << " programs, " << stats.materials << " materials, " << stats.vaos << " vertex arrays, " << stats.transforms << " transforms)" << endl;
+		cout << "Texture binds: " << application.textureBinds() << " per frame" << endl;
+		cout << "Render queue: sort " << stats.sort_ms << " ms, record " << stats.record_ms << " ms in " << stats.lists << " command list(s), replay " << stats.replay_ms << " ms" << endl;
 
-		// poll for and process events
-		glfwPollEvents();
+		bool written = target.write_png(options.output);
+		cgra::offscreen_target::unbind();
+		if (!written) return EXIT_FAILURE;
+		cout << "Wrote " << options.output << endl;
+		return EXIT_SUCCESS;
 	}
 
-	// clean up ImGui
-	cgra::gui::shutdown();
-	glfwTerminate();
-}
 
+	// the windowed loop, on whichever thread has the context. initial is
+	// the window as it was when the loop started. wait blocks
+	// until there may be new input (or a timeout), takeInput handles the
+	// input that arrived and returns false once the window is closing
+	void runRenderLoop(GLFWwindow *window, const Options &options, chrono::steady_clock::time_point launched, const cgra::gui::window_state &initial,
+		const function<void(double)> &wait, const function<bool(cgra::gui::window_state &, FrameStats &)> &takeInput)
+	{
+		// initialize ImGui
+		if (!cgra::gui::init(window)) {
+			cerr << "Error: Could not initialize ImGui" << endl;
+			abort(); // unrecoverable error
+		}
 
-namespace {
+		// initialize the frame profiler (hidden until enabled from the GUI)
+		cgra::profiler::init();
 
-	void cursorPosCallback(GLFWwindow *, double xpos, double ypos) {
-		// if not captured then foward to application
-		ImGuiIO& io = ImGui::GetIO();
-		if (io.WantCaptureMouse) return;
-		application_ptr->cursorPosCallback(xpos, ypos);
+		{
+			// create the application object (and a global pointer to it)
+			Application application(window);
+			application_ptr = &application;
+			application.setTextureCompression(!options.uncompressedTextures);
+			application.setTextureAtlas(!options.noAtlas);
+			if (!options.model.empty()) application.loadModel(options.model);
+			application.setContinuousRendering(options.continuous);
+			application.setSoftwareRendering(options.software);
+			application.setAsyncShaders(!options.syncShaders);
+			application.setPointLights(options.lights);
+			application.setInstances(options.instances);
+			application.setSortDraws(!options.unsorted);
+			application.setQuadView(options.quadView);
+			application.setTessellation(options.tessellate);
+			if (options.tessellate && !application.tessellationSupported()) cerr << "Warning: Tessellation needs OpenGL 4.0, drawing triangles" << endl;
+			bool firstFrame = true;
+			cgra::gui::window_state state = initial;
+			application.framebufferSizeCallback(state.framebuffer_width, state.framebuffer_height);
+			FrameStats stats;
+			chrono::steady_clock::time_point guiBuilt;
+
+			// loop until the user closes the window
+			while (true) {
+
+				// nothing changed, sleep until there is input (or a timeout)
+				bool idle = !application.needsRedraw() && redraw_frames <= 0;
+				if (idle) {
+					wait(0.5);
+					stats.idled();
+				}
+
+				if (!takeInput(state, stats)) break;
+
+				if (idle) {
+					// timeouts only matter to animated GUI elements
+					if (redraw_frames <= 0 && !ImGui::GetIO().WantTextInput) continue;
+					redraw_frames = max(redraw_frames, 1);
+				}
+				bool guiChanged = redraw_frames > 0; // input (or a timeout) may have changed it
+				redraw_frames--;
+				cgra::profiler::newFrame();
+
+				// main Render
+				//glEnable(GL_FRAMEBUFFER_SRGB); // use if you know about gamma correction
+				{
+					cgra::profiler::scope scope("Application::render");
+					application.render();
+				}
+
+				// GUI Render on top
+				//glDisable(GL_FRAMEBUFFER_SRGB); // use if you know about gamma correction
+				{
+					cgra::profiler::scope scope("ImGui");
+					auto now = chrono::steady_clock::now();
+					if (guiChanged || now - guiBuilt >= gui_refresh) {
+						cgra::gui::newFrame(state);
+						application.renderGUI();
+						cgra::gui::render();
+						guiBuilt = now;
+					}
+					else {
+						cgra::gui::redraw();
+					}
+				}
+
+				// swap front and back buffers
+				{
+					cgra::profiler::scope scope("glfwSwapBuffers", false);
+					glfwSwapBuffers(window);
+				}
+				cgra::profiler::endFrame();
+				stats.presented();
+
+				if (firstFrame) {
+					chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - launched;
+					cout << "First frame after " << elapsed.count() << " ms" << endl;
+					firstFrame = false;
+				}
+			}
+
+			stats.print();
+			application_ptr = nullptr;
+		}
+
+		// clean up the profiler and ImGui
+		cgra::profiler::shutdown();
+		cgra::gui::shutdown();
 	}
 
 
-	void mouseButtonCallback(GLFWwindow *win, int button, int action, int mods) {
-		// forward callback to ImGui
-		cgra::gui::mouseButtonCallback(win, button, action, mods);
+	// events are handled and frames drawn on the main thread, in turn
+	void runSingleThreaded(GLFWwindow *window, const Options &options, chrono::steady_clock::time_point launched) {
+		// wakes the event loop while idle, for things like the text cursor blinking
+		EventWaker waker;
+		runRenderLoop(window, options, launched, cgra::gui::window_state::capture(window),
+			[&](double timeout) { waker.waitEvents(timeout); },
+			[&](cgra::gui::window_state &state, FrameStats &stats) {
+				// the cursor the last GUI frame asked for, capture doesn't keep it
+				bool hideCursor = state.hide_cursor;
+				glfwSetInputMode(window, GLFW_CURSOR, hideCursor ? GLFW_CURSOR_HIDDEN : GLFW_CURSOR_NORMAL);
+				glfwPollEvents();
+				for (const InputEvent &e : pending_events) {
+					stats.received(e.time);
+					handleEvent(e);
+				}
+				pending_events.clear();
+				state = cgra::gui::window_state::capture(window);
+				state.hide_cursor = hideCursor;
+				return !glfwWindowShouldClose(window);
+			}
+		);
+	}
 
-		// if not captured then foward to application
-		ImGuiIO& io = ImGui::GetIO();
-		if (io.WantCaptureMouse) return;
-		application_ptr->mouseButtonCallback(button, action, mods);
+
+	// the context moves to a render thread, this thread only waits for
+	// events and publishes them with the window state. Neither thread
+	// blocks the other: input goes through a triple buffer and each
+	// snapshot carries every event the render thread hasn't acknowledged,
+	// so skipped snapshots lose nothing. Input is still only handled at the
+	// start of a frame, as with --single-thread, so this is not shown to
+	// lower latency or frame time variance. Compare the FrameStats printed
+	// on exit in both modes before relying on that
+	void runRenderThread(GLFWwindow *window, const Options &options, chrono::steady_clock::time_point launched) {
+		cgra::triple_buffer<InputSnapshot> input;
+		atomic<uint64_t> acknowledged{ 0 }; // last event sequence the render thread handled
+		atomic<bool> hideCursor{ false }; // asked for by the render thread's GUI, applied here
+		Doorbell doorbell;
+
+		const auto publish = [&]() {
+			uint64_t handled = acknowledged.load(memory_order_acquire);
+			pending_events.erase(remove_if(pending_events.begin(), pending_events.end(), [&](const InputEvent &e) { return e.sequence <= handled; }), pending_events.end());
+			InputSnapshot &snapshot = input.back();
+			snapshot.window = cgra::gui::window_state::capture(window);
+			snapshot.events = pending_events;
+			snapshot.close = glfwWindowShouldClose(window) != 0;
+			input.publish();
+			doorbell.ring();
+		};
+		publish();
+		const cgra::gui::window_state initial = cgra::gui::window_state::capture(window);
+		cgra::gui::useDeferredClipboard();
+		deferred_clipboard = true;
+
+		glfwMakeContextCurrent(nullptr);
+		thread renderer([&]() {
+			cgra::trace::setThreadName("render");
+			glfwMakeContextCurrent(window);
+			uint64_t handled = 0;
+			runRenderLoop(window, options, launched, initial,
+				[&](double timeout) { doorbell.wait(timeout); },
+				[&](cgra::gui::window_state &state, FrameStats &stats) {
+					// hand the cursor the last GUI frame asked for to the main thread
+					bool hide = state.hide_cursor;
+					if (hideCursor.exchange(hide, memory_order_relaxed) != hide) glfwPostEmptyEvent();
+					input.update();
+					const InputSnapshot &snapshot = input.front();
+					for (const InputEvent &e : snapshot.events) {
+						if (e.sequence <= handled) continue;
+						stats.received(e.time);
+						handleEvent(e);
+						handled = e.sequence;
+					}
+					acknowledged.store(handled, memory_order_release);
+					state = snapshot.window;
+					state.hide_cursor = hide;
+					return !snapshot.close;
+				}
+			);
+			glfwMakeContextCurrent(nullptr);
+		});
+
+		// shader reloads and the like post empty events to get a redraw,
+		// every wake up publishes so they reach the render thread too
+		while (!glfwWindowShouldClose(window)) {
+			glfwWaitEvents();
+			glfwSetInputMode(window, GLFW_CURSOR, hideCursor.load(memory_order_relaxed) ? GLFW_CURSOR_HIDDEN : GLFW_CURSOR_NORMAL);
+			string copied;
+			if (cgra::gui::takeCopiedText(copied)) glfwSetClipboardString(window, copied.c_str());
+			publish();
+		}
+		publish();
+		renderer.join();
+		glfwMakeContextCurrent(window);
 	}
 
 
-	void scrollCallback(GLFWwindow *win, double xoffset, double yoffset) {
-		// forward callback to ImGui
-		cgra::gui::scrollCallback(win, xoffset, yoffset);
+	// loads the model for the CPU renderers, no GL needed
+	bool loadMesh(const Options &options, ObjFile &model) {
+		string filename = options.model.empty() ? CGRA_SRCDIR + string("//res//assets//teapot.obj") : options.model;
+		if (!model.loadOBJ(filename)) {
+			cout << "Error: Unable to load model" << endl;
+			return false;
+		}
+		model.buildMesh();
+		return true;
+	}
+
 
-		// if not captured then foward to application
-		ImGuiIO& io = ImGui::GetIO();
-		if (io.WantCaptureMouse) return;
-		application_ptr->scrollCallback(xoffset, yoffset);
+	// the same view and lighting as Application::render with default settings
+	ShadingParams defaultShadingParams(const Options &options) {
+		ShadingParams params;
+		params.projection = glm::perspective(1.f, float(options.width) / options.height, 0.1f, 1000.f);
+		params.modelView = glm::translate(glm::mat4(1), glm::vec3(0, -5, -20));
+		params.lightDirection = glm::normalize(params.lightDirection);
+		return params;
+	}
+
+
+	// time the CPU rasterizer on the same view as Application::render
+	int runRasterBenchmark(const Options &options) {
+		ObjFile model;
+		if (!loadMesh(options, model)) return EXIT_FAILURE;
+		SoftRasterizer::benchmark(model.getMeshVertices(), defaultShadingParams(options), options.width, options.height, max(options.frames, 10));
+		return EXIT_SUCCESS;
+	}
+
+
+	// ray cast a still and write it to a PNG, or benchmark the ray caster
+	int runRayCast(const Options &options) {
+		ObjFile model;
+		if (!loadMesh(options, model)) return EXIT_FAILURE;
+		ShadingParams params = defaultShadingParams(options);
+
+		if (options.benchRayCast) {
+			RayCaster::benchmark(model.getMeshVertices(), params, options.rayCastSettings, options.width, options.height);
+			return EXIT_SUCCESS;
+		}
+
+		cgra::thread_pool pool(options.threads);
+		RayCaster caster(pool);
+		caster.setMesh(model.getMeshVertices());
+		caster.start(params, options.rayCastSettings, options.width, options.height);
+		caster.wait();
+		cout << "Ray cast " << options.width << "x" << options.height << " in " << caster.milliseconds() << " ms, ";
+		cout << caster.rays() / (caster.milliseconds() * 1000.0) << " Mrays/s" << endl;
+
+		if (!cgra::write_png(options.output, options.width, options.height, caster.image())) return EXIT_FAILURE;
+		cout << "Wrote " << options.output << endl;
+		return EXIT_SUCCESS;
+	}
+
+
+	void recordEvent(InputEvent e) {
+		e.sequence = next_sequence++;
+		e.time = chrono::steady_clock::now();
+		pending_events.push_back(e);
+	}
+
+
+	void cursorPosCallback(GLFWwindow *, double xpos, double ypos) {
+		InputEvent e{ InputEvent::CursorPos };
+		e.x = xpos;
+		e.y = ypos;
+		recordEvent(e);
+	}
+
+
+	void mouseButtonCallback(GLFWwindow *, int button, int action, int mods) {
+		InputEvent e{ InputEvent::MouseButton };
+		e.a = button;
+		e.c = action;
+		e.d = mods;
+		recordEvent(e);
+	}
+
+
+	void scrollCallback(GLFWwindow *, double xoffset, double yoffset) {
+		InputEvent e{ InputEvent::Scroll };
+		e.x = xoffset;
+		e.y = yoffset;
+		recordEvent(e);
 	}
 
 
 	void keyCallback(GLFWwindow *win, int key, int scancode, int action, int mods) {
-		// forward callback to ImGui
-		cgra::gui::keyCallback(win, key, scancode, action, mods);
+		InputEvent e{ InputEvent::Key };
+		e.a = key;
+		e.b = scancode;
+		e.c = action;
+		e.d = mods;
 
-		// if not captured then foward to application
-		ImGuiIO& io = ImGui::GetIO();
-		if (io.WantCaptureKeyboard) return;
-		application_ptr->keyCallback(key, scancode, action, mods);
+		// ImGui pastes on Ctrl+V (Cmd+V on OS X), read the clipboard here
+		// where GLFW allows it rather than every time input is published
+		if (deferred_clipboard && action == GLFW_PRESS && key == GLFW_KEY_V && (mods & (GLFW_MOD_CONTROL | GLFW_MOD_SUPER))) {
+			const char *text = glfwGetClipboardString(win);
+			e.clipboard = text ? text : "";
+		}
+		recordEvent(e);
 	}
 
 
-	void charCallback(GLFWwindow *win, unsigned int c) {
-		// forward callback to ImGui
-		cgra::gui::charCallback(win, c);
+	void charCallback(GLFWwindow *, unsigned int c) {
+		InputEvent e{ InputEvent::Char };
+		e.a = int(c);
+		recordEvent(e);
+	}
+
+
+	void windowRefreshCallback(GLFWwindow *) {
+		recordEvent(InputEvent{ InputEvent::Refresh });
+	}
+
+
+	void framebufferSizeCallback(GLFWwindow *, int width, int height) {
+		InputEvent e{ InputEvent::FramebufferSize };
+		e.a = width;
+		e.b = height;
+		recordEvent(e);
+	}
+
 
-		// if not captured then foward to application
+	// forward recorded input to ImGui and, if not captured, the application
+	void handleEvent(const InputEvent &e) {
 		ImGuiIO& io = ImGui::GetIO();
-		if (io.WantTextInput) return;
-		application_ptr->charCallback(c);
+		switch (e.type) {
+		case InputEvent::CursorPos:
+			// any input may change the GUI
+			redraw_frames = settle_frames;
+			if (io.WantCaptureMouse) return;
+			application_ptr->cursorPosCallback(e.x, e.y);
+			break;
+
+		case InputEvent::MouseButton:
+			redraw_frames = settle_frames;
+			cgra::gui::mouseButtonCallback(nullptr, e.a, e.c, e.d);
+			if (io.WantCaptureMouse) return;
+			application_ptr->mouseButtonCallback(e.a, e.c, e.d);
+			break;
+
+		case InputEvent::Scroll:
+			redraw_frames = settle_frames;
+			cgra::gui::scrollCallback(nullptr, e.x, e.y);
+			if (io.WantCaptureMouse) return;
+			application_ptr->scrollCallback(e.x, e.y);
+			break;
+
+		case InputEvent::Key:
+			redraw_frames = settle_frames;
+			if (e.clipboard) cgra::gui::setPasteText(*e.clipboard);
+			cgra::gui::keyCallback(nullptr, e.a, e.b, e.c, e.d);
+			if (io.WantCaptureKeyboard) return;
+			application_ptr->keyCallback(e.a, e.b, e.c, e.d);
+			break;
+
+		case InputEvent::Char:
+			redraw_frames = settle_frames;
+			cgra::gui::charCallback(nullptr, unsigned(e.a));
+			if (io.WantTextInput) return;
+			application_ptr->charCallback(unsigned(e.a));
+			break;
+
+		case InputEvent::Refresh:
+			// contents were damaged (uncovered, restored etc)
+			redraw_frames = max(redraw_frames, 1);
+			break;
+
+		case InputEvent::FramebufferSize:
+			redraw_frames = settle_frames;
+			application_ptr->framebufferSizeCallback(e.a, e.b);
+			break;
+		}
 	}
 
 
@@ -0,0 +1,481 @@
+// std
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <thread>
+
+// project
+#include "ray_caster.hpp"
+#include "cgra/cgra_trace.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+
+namespace {
+
+	const int binCount = 12;
+	const uint32_t maxLeafSize = 4; // always a leaf at or below this
+	const uint32_t maxSahLeafSize = 16; // leaf up to this if SAH says splitting doesn't pay
+	const int maxSahDepth = 48; // below this depth fall back to median splits
+	const int maxStackDepth = 128;
+	const vec3 clearColor = vec3(0.3f, 0.3f, 0.4f); // glClearColor in Application::render
+
+	struct BuildRef {
+		vec3 min, max, centroid;
+	};
+
+	struct Bin {
+		vec3 min = vec3(numeric_limits<float>::max());
+		vec3 max = vec3(-numeric_limits<float>::max());
+		uint32_t count = 0;
+
+		void grow(const vec3 &lo, const vec3 &hi) { min = glm::min(min, lo); max = glm::max(max, hi); }
+	};
+
+	float halfArea(const vec3 &min, const vec3 &max) {
+		vec3 e = max - min;
+		return e.x * e.y + e.y * e.z + e.z * e.x;
+	}
+
+	// top down binned SAH builder
+	struct BVHBuilder {
+		vector<TriangleBVH::Node> &nodes;
+		const vector<BuildRef> &refs;
+		vector<uint32_t> &order;
+
+		void subdivide(uint32_t nodeIndex, uint32_t first, uint32_t count, int depth) {
+			// node bounds and centroid bounds
+			vec3 lo(numeric_limits<float>::max()), hi(-numeric_limits<float>::max());
+			vec3 clo = lo, chi = hi;
+			for (uint32_t i = first; i < first + count; i++) {
+				const BuildRef &r = refs[order[i]];
+				lo = min(lo, r.min);
+				hi = max(hi, r.max);
+				clo = min(clo, r.centroid);
+				chi = max(chi, r.centroid);
+			}
+			nodes[nodeIndex].min = lo;
+			nodes[nodeIndex].max = hi;
+			nodes[nodeIndex].leftOrFirst = first;
+			nodes[nodeIndex].count = count;
+			if (count <= maxLeafSize) return;
+
+			// find the cheapest bin boundary on any axis
+			vec3 extent = chi - clo;
+			int bestAxis = -1, bestSplit = 0;
+			float bestCost = numeric_limits<float>::max();
+			for (int axis = 0; axis < 3 && depth < maxSahDepth; axis++) {
+				if (extent[axis] <= 0) continue;
+				Bin bins[binCount];
+				float scale = binCount / extent[axis];
+				for (uint32_t i = first; i < first + count; i++) {
+					const BuildRef &r = refs[order[i]];
+					int b = std::min(binCount - 1, int((r.centroid[axis] - clo[axis]) * scale));
+					bins[b].grow(r.min, r.max);
+					bins[b].count++;
+				}
+
+				// sweep from both ends
+				float leftArea[binCount - 1], rightArea[binCount - 1];
+				uint32_t leftCount[binCount - 1], rightCount[binCount - 1];
+				Bin left, right;
+				for (int i = 0; i < binCount - 1; i++) {
+					left.grow(bins[i].min, bins[i].max);
+					left.count += bins[i].count;
+					leftArea[i] = left.count ? halfArea(left.min, left.max) : 0;
+					leftCount[i] = left.count;
+					const Bin &b = bins[binCount - 1 - i];
+					right.grow(b.min, b.max);
+					right.count += b.count;
+					rightArea[binCount - 2 - i] = right.count ? halfArea(right.min, right.max) : 0;
+					rightCount[binCount - 2 - i] = right.count;
+				}
+				for (int i = 0; i < binCount - 1; i++) {
+					float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+					if (leftCount[i] && rightCount[i] && cost < bestCost) {
+						bestCost = cost;
+						bestAxis = axis;
+						bestSplit = i;
+					}
+				}
+			}
+
+			// split, or stop if a leaf is cheaper
+			uint32_t mid = first;
+			if (bestAxis >= 0) {
+				if (bestCost >= count * halfArea(lo, hi) && count <= maxSahLeafSize) return;
+				float scale = binCount / extent[bestAxis];
+				auto begin = order.begin() + first;
+				mid = uint32_t(std::partition(begin, begin + count, [&](uint32_t i) {
+					return std::min(binCount - 1, int((refs[i].centroid[bestAxis] - clo[bestAxis]) * scale)) <= bestSplit;
+				}) - order.begin());
+			}
+			if (mid == first || mid == first + count) {
+				// all centroids in one bin (or too deep), split at the median
+				int axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+				mid = first + count / 2;
+				std::nth_element(order.begin() + first, order.begin() + mid, order.begin() + first + count, [&](uint32_t a, uint32_t b) {
+					return refs[a].centroid[axis] < refs[b].centroid[axis];
+				});
+			}
+
+			uint32_t left = uint32_t(nodes.size());
+			nodes.emplace_back();
+			nodes.emplace_back();
+			nodes[nodeIndex].leftOrFirst = left;
+			nodes[nodeIndex].count = 0;
+			subdivide(left, first, mid - first, depth + 1);
+			subdivide(left + 1, mid, first + count - mid, depth + 1);
+		}
+	};
+
+	// slab test, gives the entry distance
+	inline bool intersectBox(const TriangleBVH::Node &node, const vec3 &origin, const vec3 &invDirection, float tmin, float tmax, float &tnear) {
+		vec3 t0 = (node.min - origin) * invDirection;
+		vec3 t1 = (node.max - origin) * invDirection;
+		vec3 lo = min(t0, t1), hi = max(t0, t1);
+		tnear = std::max(std::max(lo.x, lo.y), std::max(lo.z, tmin));
+		float tfar = std::min(std::min(hi.x, hi.y), std::min(hi.z, tmax));
+		return tnear <= tfar;
+	}
+
+	// Moller-Trumbore, two sided like the GL path (no face culling)
+	inline bool intersectTriangle(const TriangleBVH::Triangle &tri, const vec3 &origin, const vec3 &direction, float tmin, float tmax, float &t, float &u, float &v) {
+		vec3 p = cross(direction, tri.e2);
+		float det = dot(tri.e1, p);
+		if (std::abs(det) < 1e-12f) return false;
+		float invDet = 1.0f / det;
+		vec3 s = origin - tri.v0;
+		u = dot(s, p) * invDet;
+		if (u < 0 || u > 1) return false;
+		vec3 q = cross(s, tri.e1);
+		v = dot(direction, q) * invDet;
+		if (v < 0 || u + v > 1) return false;
+		t = dot(tri.e2, q) * invDet;
+		return t > tmin && t < tmax;
+	}
+}
+
+
+void TriangleBVH::build(const vector<Vertex> &mesh) {
+	CGRA_TRACE_SCOPE("TriangleBVH::build");
+	const uint32_t count = uint32_t(mesh.size() / 3);
+	m_nodes.clear();
+	m_triangles.clear();
+	if (count == 0) return;
+
+	vector<BuildRef> refs(count);
+	for (uint32_t i = 0; i < count; i++) {
+		const vec3 &a = mesh[i * 3].position, &b = mesh[i * 3 + 1].position, &c = mesh[i * 3 + 2].position;
+		refs[i].min = min(a, min(b, c));
+		refs[i].max = max(a, max(b, c));
+		refs[i].centroid = (refs[i].min + refs[i].max) * 0.5f;
+	}
+	vector<uint32_t> order(count);
+	iota(order.begin(), order.end(), 0);
+
+	m_nodes.reserve(size_t(count) * 2);
+	m_nodes.emplace_back();
+	BVHBuilder builder{ m_nodes, refs, order };
+	builder.subdivide(0, 0, count, 0);
+
+	// store triangles in leaf order so leaves are contiguous
+	m_triangles.resize(count);
+	for (uint32_t i = 0; i < count; i++) {
+		const Vertex *v = &mesh[order[i] * 3];
+		Triangle &tri = m_triangles[i];
+		tri.v0 = v[0].position;
+		tri.e1 = v[1].position - v[0].position;
+		tri.e2 = v[2].position - v[0].position;
+		tri.n0 = v[0].normal;
+		tri.n1 = v[1].normal;
+		tri.n2 = v[2].normal;
+	}
+}
+
+
+bool TriangleBVH::intersect(const vec3 &origin, const vec3 &direction, float tmin, Hit &hit) const {
+	if (m_nodes.empty()) return false;
+	const vec3 invDirection = 1.0f / direction;
+	float tnear;
+	if (!intersectBox(m_nodes[0], origin, invDirection, tmin, hit.t, tnear)) return false;
+
+	bool found = false;
+	uint32_t stack[maxStackDepth];
+	int top = 0;
+	uint32_t index = 0;
+	while (true) {
+		const Node &node = m_nodes[index];
+		if (node.count) {
+			for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++) {
+				float t, u, v;
+				if (intersectTriangle(m_triangles[i], origin, direction, tmin, hit.t, t, u, v)) {
+					hit = { t, u, v, i };
+					found = true;
+				}
+			}
+		}
+		else {
+			// visit the nearer child first, the other one may be culled by then
+			uint32_t left = node.leftOrFirst, right = left + 1;
+			float tleft, tright;
+			bool hitLeft = intersectBox(m_nodes[left], origin, invDirection, tmin, hit.t, tleft);
+			bool hitRight = intersectBox(m_nodes[right], origin, invDirection, tmin, hit.t, tright);
+			if (hitLeft && hitRight) {
+				if (tright < tleft) std::swap(left, right);
+				stack[top++] = right;
+				index = left;
+				continue;
+			}
+			if (hitLeft || hitRight) {
+				index = hitLeft ? left : right;
+				continue;
+			}
+		}
+		if (top == 0) break;
+		index = stack[--top];
+	}
+	return found;
+}
+
+
+bool TriangleBVH::occluded(const vec3 &origin, const vec3 &direction, float tmin, float tmax) const {
+	if (m_nodes.empty()) return false;
+	const vec3 invDirection = 1.0f / direction;
+	float tnear;
+	uint32_t stack[maxStackDepth];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const Node &node = m_nodes[stack[--top]];
+		if (!intersectBox(node, origin, invDirection, tmin, tmax, tnear)) continue;
+		if (node.count) {
+			for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++) {
+				float t, u, v;
+				if (intersectTriangle(m_triangles[i], origin, direction, tmin, tmax, t, u, v)) return true;
+			}
+		}
+		else {
+			stack[top++] = node.leftOrFirst;
+			stack[top++] = node.leftOrFirst + 1;
+		}
+	}
+	return false;
+}
+
+
+RayCaster::RayCaster(cgra::thread_pool &pool) : m_pool(&pool) { }
+
+
+RayCaster::~RayCaster() {
+	cancel();
+}
+
+
+void RayCaster::setMesh(const vector<Vertex> &mesh) {
+	cancel();
+	m_bvh.build(mesh);
+
+	// offset shadow rays by a small fraction of the mesh size
+	vec3 lo(numeric_limits<float>::max()), hi(-numeric_limits<float>::max());
+	for (const Vertex &v : mesh) {
+		lo = min(lo, v.position);
+		hi = max(hi, v.position);
+	}
+	m_epsilon = mesh.empty() ? 1e-4f : std::max(1e-6f, length(hi - lo) * 1e-5f);
+}
+
+
+void RayCaster::start(const ShadingParams &params, const Settings &settings, int width, int height) {
+	cancel();
+
+	m_width = std::max(width, 1);
+	m_height = std::max(height, 1);
+	{
+		lock_guard<mutex> lock(m_imageMutex);
+		m_image.assign(size_t(m_width) * m_height * 4, 0);
+	}
+	const int tilesX = (m_width + tileSize - 1) / tileSize;
+	const int tilesY = (m_height + tileSize - 1) / tileSize;
+	m_tileCount = tilesX * tilesY;
+	m_tilesDone = 0;
+	m_rays = 0;
+	m_elapsed = 0;
+	m_start = chrono::steady_clock::now();
+
+	// the model is usually in the middle, so do those tiles first. Workers
+	// take the newest task from their own deque, so queue the middle last
+	vector<int> tiles(m_tileCount);
+	iota(tiles.begin(), tiles.end(), 0);
+	auto distance = [&](int tile) {
+		float dx = (tile % tilesX + 0.5f) - tilesX * 0.5f;
+		float dy = (tile / tilesX + 0.5f) - tilesY * 0.5f;
+		return dx * dx + dy * dy;
+	};
+	std::sort(tiles.begin(), tiles.end(), [&](int a, int b) { return distance(a) > distance(b); });
+
+	const mat4 inverseMvp = inverse(params.projection * params.modelView);
+	{
+		lock_guard<mutex> lock(m_runningMutex);
+		m_running = m_tileCount;
+	}
+	for (int tile : tiles) {
+		m_pool->submit([this, tile, params, settings, inverseMvp]() {
+			if (!m_cancel.load(memory_order_relaxed)) {
+				renderTile(tile, params, settings, inverseMvp);
+			}
+			taskFinished();
+		});
+	}
+}
+
+
+void RayCaster::taskFinished() {
+	lock_guard<mutex> lock(m_runningMutex);
+	if (--m_running == 0) m_runningCv.notify_all();
+}
+
+
+void RayCaster::cancel() {
+	m_cancel = true;
+	wait();
+	m_cancel = false;
+}
+
+
+void RayCaster::wait() {
+	unique_lock<mutex> lock(m_runningMutex);
+	m_runningCv.wait(lock, [this]() { return m_running == 0; });
+}
+
+
+void RayCaster::renderTile(int tile, const ShadingParams &params, const Settings &settings, const mat4 &inverseMvp) {
+	CGRA_TRACE_SCOPE("RayCaster::renderTile");
+	const int tilesX = (m_width + tileSize - 1) / tileSize;
+	const int x0 = (tile % tilesX) * tileSize, y0 = (tile / tilesX) * tileSize;
+	const int x1 = std::min(m_width, x0 + tileSize), y1 = std::min(m_height, y0 + tileSize);
+	const int samples = settings.sampleCount();
+
+	// direction towards the light, in object space like the BVH
+	const mat3 normalMatrix = mat3(params.modelView);
+	const vec3 toLight = normalize(transpose(normalMatrix) * -params.lightDirection);
+
+	uint64_t rays = 0;
+	unsigned char pixels[tileSize * tileSize * 4];
+	for (int y = y0; y < y1; y++) {
+		for (int x = x0; x < x1; x++) {
+			vec3 sum(0);
+			for (int sy = 0; sy < samples; sy++) {
+				for (int sx = 0; sx < samples; sx++) {
+					// stratified sample positions inside the pixel
+					vec2 ndc = vec2(
+						(x + (sx + 0.5f) / samples) / m_width,
+						(y + (sy + 0.5f) / samples) / m_height) * 2.0f - 1.0f;
+					vec4 nearPoint = inverseMvp * vec4(ndc, -1, 1);
+					vec4 farPoint = inverseMvp * vec4(ndc, 1, 1);
+					vec3 origin = vec3(nearPoint) / nearPoint.w;
+					vec3 direction = vec3(farPoint) / farPoint.w - origin;
+
+					TriangleBVH::Hit hit;
+					hit.t = length(direction);
+					direction /= hit.t;
+					rays++;
+					if (!m_bvh.intersect(origin, direction, 0, hit)) {
+						sum += clearColor;
+						continue;
+					}
+
+					const TriangleBVH::Triangle &tri = m_bvh.triangle(hit.triangle);
+					vec3 position = origin + direction * hit.t;
+					vec3 normal = tri.n0 * (1 - hit.u - hit.v) + tri.n1 * hit.u + tri.n2 * hit.v;
+
+					// hard shadow, start the ray just off the surface on the lit side
+					float light = 1;
+					if (settings.shadows && dot(normal, toLight) > 0) {
+						vec3 faceNormal = normalize(cross(tri.e1, tri.e2));
+						vec3 offset = faceNormal * (dot(faceNormal, toLight) < 0 ? -m_epsilon : m_epsilon);
+						rays++;
+						if (m_bvh.occluded(position + offset, toLight, 0, numeric_limits<float>::max())) light = 0;
+					}
+
+					vec3 viewPosition = vec3(params.modelView * vec4(position, 1));
+					sum += clamp(shadeFragment(params, viewPosition, normalMatrix * normal, light), 0.0f, 1.0f);
+				}
+			}
+
+			vec3 color = sum / float(samples * samples);
+			unsigned char *out = &pixels[((y - y0) * tileSize + (x - x0)) * 4];
+			out[0] = (unsigned char)(color.r * 255.0f + 0.5f);
+			out[1] = (unsigned char)(color.g * 255.0f + 0.5f);
+			out[2] = (unsigned char)(color.b * 255.0f + 0.5f);
+			out[3] = 255;
+		}
+	}
+
+	{
+		lock_guard<mutex> lock(m_imageMutex);
+		for (int y = y0; y < y1; y++) {
+			const unsigned char *src = &pixels[(y - y0) * tileSize * 4];
+			std::copy(src, src + (x1 - x0) * 4, &m_image[(size_t(y) * m_width + x0) * 4]);
+		}
+	}
+	m_rays += rays;
+	if (m_tilesDone.fetch_add(1) + 1 == m_tileCount) {
+		m_elapsed = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - m_start).count();
+	}
+}
+
+
+void RayCaster::copyPixels(vector<unsigned char> &pixels) const {
+	lock_guard<mutex> lock(m_imageMutex);
+	pixels = m_image;
+}
+
+
+vector<unsigned char> RayCaster::image() const {
+	lock_guard<mutex> lock(m_imageMutex);
+	vector<unsigned char> result(m_image.size());
+	for (int y = 0; y < m_height; y++) {
+		const unsigned char *src = &m_image[size_t(m_height - 1 - y) * m_width * 4];
+		std::copy(src, src + m_width * 4, &result[size_t(y) * m_width * 4]);
+	}
+	return result;
+}
+
+
+double RayCaster::milliseconds() const {
+	if (finished()) return m_elapsed.load() / 1000.0;
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - m_start).count();
+}
+
+
+void RayCaster::benchmark(const vector<Vertex> &mesh, const ShadingParams &params, const Settings &settings, int width, int height) {
+	const unsigned hardware = std::max(1u, thread::hardware_concurrency());
+	vector<unsigned> threadCounts;
+	for (unsigned t = 1; t < hardware; t *= 2) threadCounts.push_back(t);
+	threadCounts.push_back(hardware);
+
+	cout << "Ray caster: " << mesh.size() / 3 << " triangles at " << width << "x" << height;
+	cout << ", " << settings.sampleCount() * settings.sampleCount() << " sample(s) per pixel, shadows " << (settings.shadows ? "on" : "off") << endl;
+	cout << setw(8) << "threads" << setw(12) << "ms/frame" << setw(14) << "Mrays/s" << setw(10) << "speedup" << setw(10) << "steals" << endl;
+	double baseline = 0;
+	for (unsigned threads : threadCounts) {
+		// the calling thread only waits, so exactly 'threads' threads trace
+		cgra::thread_pool pool(threads);
+		RayCaster caster(pool);
+		caster.setMesh(mesh);
+		caster.start(params, settings, width, height);
+		caster.wait();
+
+		double ms = caster.milliseconds();
+		if (baseline == 0) baseline = ms;
+		double raysPerSecond = caster.rays() / (ms / 1000.0);
+		cout << setw(8) << threads << setw(12) << fixed << setprecision(3) << ms << setw(14) << raysPerSecond / 1e6;
+		cout << setw(9) << baseline / ms << "x" << setw(10) << pool.steals() << endl;
+	}
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+// std
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "soft_rasterizer.hpp"
+#include "cgra/cgra_thread_pool.hpp"
+#include "objfile.h"
+
+
+// Bounding volume hierarchy over a triangle soup (three vertices per
+// triangle), built with binned SAH. Nodes are 32 bytes, children of an
+// interior node are adjacent and leaves hold up to 4 triangles.
+class TriangleBVH {
+public:
+	struct Node {
+		glm::vec3 min;
+		std::uint32_t leftOrFirst; // left child index, or first triangle for leaves
+		glm::vec3 max;
+		std::uint32_t count; // triangles in a leaf, 0 for interior nodes
+	};
+
+	// triangle in BVH order, edges precomputed for Moller-Trumbore
+	struct Triangle {
+		glm::vec3 v0, e1, e2;
+		glm::vec3 n0, n1, n2;
+	};
+
+	struct Hit {
+		float t;
+		float u, v; // barycentric weights of vertex 1 and 2
+		std::uint32_t triangle;
+	};
+
+private:
+	std::vector<Node> m_nodes;
+	std::vector<Triangle> m_triangles;
+
+public:
+	TriangleBVH() { }
+
+	// rebuild from the mesh, the mesh isn't referenced afterwards
+	void build(const std::vector<Vertex> &mesh);
+
+	bool empty() const { return m_triangles.empty(); }
+	std::size_t triangleCount() const { return m_triangles.size(); }
+	std::size_t nodeCount() const { return m_nodes.size(); }
+	const Triangle & triangle(std::uint32_t i) const { return m_triangles[i]; }
+
+	// closest hit along origin + t * direction for t in (tmin, hit.t),
+	// hit.t should start at the furthest distance of interest
+	bool intersect(const glm::vec3 &origin, const glm::vec3 &direction, float tmin, Hit &hit) const;
+
+	// true if anything is hit for t in (tmin, tmax), stops at the first hit
+	bool occluded(const glm::vec3 &origin, const glm::vec3 &direction, float tmin, float tmax) const;
+};
+
+
+// CPU ray caster for reference images and high quality stills. Casts
+// primary rays through the BVH with the same lighting as the GL shaders
+// (see ShadingParams) plus optional hard shadows from the directional
+// light. Tiles are queued on the thread pool as separate tasks and copied
+// into the image as they finish, so a frame fills in progressively while
+// the pool's work stealing keeps every core busy on uneven tiles.
+class RayCaster {
+public:
+	static constexpr int tileSize = 16;
+
+	struct Settings {
+		static constexpr int maxSamples = 4;
+
+		bool shadows = true;
+		int samples = 1; // samples per pixel along each axis (samples^2 in total)
+
+		// samples clamped to 1..maxSamples, what is actually cast
+		int sampleCount() const { return glm::clamp(samples, 1, maxSamples); }
+	};
+
+private:
+	cgra::thread_pool *m_pool;
+	TriangleBVH m_bvh;
+	float m_epsilon = 1e-4f; // shadow ray offset, scaled to the mesh
+
+	// current image, RGBA8 bottom row first like OpenGL
+	int m_width = 0;
+	int m_height = 0;
+	std::vector<unsigned char> m_image;
+	mutable std::mutex m_imageMutex;
+
+	// tiles of the current render
+	std::atomic<bool> m_cancel{ false };
+	std::atomic<int> m_tilesDone{ 0 };
+	int m_tileCount = 0;
+	int m_running = 0; // tasks still queued or running
+	std::mutex m_runningMutex;
+	std::condition_variable m_runningCv;
+
+	// stats
+	std::atomic<std::uint64_t> m_rays{ 0 };
+	std::chrono::steady_clock::time_point m_start;
+	std::atomic<std::int64_t> m_elapsed{ 0 }; // microseconds, set by the last tile
+
+	void renderTile(int tile, const ShadingParams &params, const Settings &settings, const glm::mat4 &inverseMvp);
+	void taskFinished();
+
+public:
+	explicit RayCaster(cgra::thread_pool &pool);
+	~RayCaster();
+
+	RayCaster(const RayCaster &) = delete;
+	RayCaster & operator=(const RayCaster &) = delete;
+
+	// build the BVH for a new mesh, cancels any render in progress
+	void setMesh(const std::vector<Vertex> &mesh);
+	const TriangleBVH & bvh() const { return m_bvh; }
+
+	// clear the image and queue every tile, returns straight away
+	void start(const ShadingParams &params, const Settings &settings, int width, int height);
+
+	// stop queued tiles and wait for running ones
+	void cancel();
+
+	// block until the current render is finished
+	void wait();
+
+	// progress of the current render
+	int tilesDone() const { return m_tilesDone.load(); }
+	int tileCount() const { return m_tileCount; }
+	bool finished() const { return tilesDone() == m_tileCount; }
+
+	int width() const { return m_width; }
+	int height() const { return m_height; }
+
+	// copy of the image so far, bottom row first, for uploading to GL
+	void copyPixels(std::vector<unsigned char> &pixels) const;
+
+	// tightly packed RGBA8 pixels, top row first, ready for write_png
+	std::vector<unsigned char> image() const;
+
+	// rays cast and time taken so far by the current render
+	std::uint64_t rays() const { return m_rays.load(); }
+	double milliseconds() const;
+
+	// renders the mesh with 1, 2, 4 ... hardware threads and prints
+	// rays per second for each thread count
+	static void benchmark(const std::vector<Vertex> &mesh, const ShadingParams &params, const Settings &settings, int width, int height);
+};
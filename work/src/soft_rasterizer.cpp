@@ -0,0 +1,357 @@
+// std
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+// sse2 (enabled by default on x86-64, and with -msse2 on gcc/clang)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SOFT_RASTERIZER_SSE2
+#include <emmintrin.h>
+#endif
+
+// project
+#include "soft_rasterizer.hpp"
+#include "cgra/cgra_trace.hpp"
+
+
+using namespace std;
+using namespace glm;
+
+
+namespace {
+
+	const uint32_t emptyId = 0xFFFFFFFFu;
+	const size_t trianglesPerBatch = 2048;
+	const size_t maxBatches = 256; // batch index lives in the top 8 bits of an id
+
+	// vertex after the vertex shader, everything needed for clipping
+	struct ClipVertex {
+		vec4 clip;
+		vec3 position;
+		vec3 normal;
+	};
+
+	ClipVertex lerpVertex(const ClipVertex &a, const ClipVertex &b, float t) {
+		return { mix(a.clip, b.clip, t), mix(a.position, b.position, t), mix(a.normal, b.normal, t) };
+	}
+
+	// clip a triangle against the near plane (z >= -w), giving up to 4 vertices
+	int clipNear(const ClipVertex in[3], ClipVertex out[4]) {
+		int count = 0;
+		for (int i = 0; i < 3; i++) {
+			const ClipVertex &a = in[i], &b = in[(i + 1) % 3];
+			float da = a.clip.z + a.clip.w, db = b.clip.z + b.clip.w;
+			if (da >= 0) out[count++] = a;
+			if ((da >= 0) != (db >= 0)) out[count++] = lerpVertex(a, b, da / (da - db));
+		}
+		return count;
+	}
+}
+
+
+vec3 shadeFragment(const ShadingParams &params, const vec3 &viewPosition, const vec3 &viewNormal, float light) {
+	vec3 normal = normalize(viewNormal);
+	vec3 lightDir = normalize(-params.lightDirection);
+
+	if (!params.phong) {
+		// default_frag.glsl
+		float lambert = std::max(dot(normal, lightDir), 0.0f) * light;
+		return mix(params.color / 4.0f, params.color, lambert);
+	}
+
+	// phong_frag.glsl
+	vec3 viewDir = normalize(-viewPosition);
+	vec3 ambient = params.ambient * params.lightColor;
+	float diff = std::max(dot(normal, lightDir), 0.0f);
+	vec3 diffuse = params.diffuse * diff * light * params.lightColor;
+	vec3 reflectDir = reflect(-lightDir, normal);
+	float spec = pow(std::max(dot(viewDir, reflectDir), 0.0f), params.shininess);
+	vec3 specular = params.specular * spec * light * params.lightColor;
+	return (ambient + diffuse + specular) * params.color;
+}
+
+
+SoftRasterizer::SoftRasterizer(cgra::thread_pool &pool) : m_pool(&pool) { }
+
+
+void SoftRasterizer::resize(int width, int height) {
+	if (width == m_width && height == m_height) return;
+	m_width = std::max(width, 1);
+	m_height = std::max(height, 1);
+	m_tilesX = (m_width + tileSize - 1) / tileSize;
+	m_tilesY = (m_height + tileSize - 1) / tileSize;
+	m_stride = m_tilesX * tileSize;
+	m_paddedHeight = m_tilesY * tileSize;
+	size_t pixels = size_t(m_stride) * m_paddedHeight;
+	m_depth.resize(pixels);
+	m_triangleIds.resize(pixels);
+	m_bary1.resize(pixels);
+	m_bary2.resize(pixels);
+	m_color.resize(pixels * 4);
+}
+
+
+void SoftRasterizer::render(const vector<Vertex> &mesh, const ShadingParams &params) {
+	CGRA_TRACE_SCOPE("SoftRasterizer::render");
+	auto start = chrono::steady_clock::now();
+	const size_t triangleCount = mesh.size() / 3;
+	const size_t tileCount = size_t(m_tilesX) * m_tilesY;
+
+	// transform, clip, set up and bin, one batch of triangles per task
+	size_t batchSize = std::max(trianglesPerBatch, (triangleCount + maxBatches - 1) / maxBatches);
+	size_t batchCount = (triangleCount + batchSize - 1) / batchSize;
+	m_triangles.resize(batchCount);
+	m_bins.resize(batchCount);
+	m_pool->parallel_for(0, batchCount, 1, [&](size_t first, size_t last) {
+		for (size_t b = first; b < last; b++) {
+			setupBatch(b, mesh, b * batchSize, std::min(triangleCount, (b + 1) * batchSize), params);
+		}
+	});
+
+	// each tile is owned by one task, so no locking
+	m_pool->parallel_for(0, tileCount, 1, [&](size_t first, size_t last) {
+		for (size_t tile = first; tile < last; tile++) {
+			rasterizeTile(int(tile));
+			shadeTile(int(tile), params);
+		}
+	});
+
+	m_triangleCount = triangleCount;
+	m_milliseconds = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+
+void SoftRasterizer::setupBatch(size_t batch, const vector<Vertex> &mesh, size_t first, size_t last, const ShadingParams &params) {
+	const mat4 &mv = params.modelView;
+	const mat4 mvp = params.projection * mv;
+	const size_t tileCount = size_t(m_tilesX) * m_tilesY;
+
+	auto &triangles = m_triangles[batch];
+	auto &bins = m_bins[batch];
+	triangles.clear();
+	bins.resize(tileCount);
+	for (auto &bin : bins) bin.clear();
+
+	for (size_t t = first; t < last; t++) {
+		// vertex shader
+		ClipVertex in[3];
+		for (int i = 0; i < 3; i++) {
+			const Vertex &v = mesh[t * 3 + i];
+			in[i].clip = mvp * vec4(v.position, 1);
+			in[i].position = vec3(mv * vec4(v.position, 1));
+			in[i].normal = normalize(vec3(mv * vec4(v.normal, 0)));
+		}
+
+		ClipVertex clipped[4];
+		int count = clipNear(in, clipped);
+
+		// fan triangulate what is left of the triangle
+		for (int k = 1; k + 1 < count; k++) {
+			const ClipVertex *v[3] = { &clipped[0], &clipped[k], &clipped[k + 1] };
+			SetupTriangle tri;
+			vec3 p[3];
+			for (int i = 0; i < 3; i++) {
+				tri.invW[i] = 1.0f / v[i]->clip.w;
+				vec3 ndc = vec3(v[i]->clip) * tri.invW[i];
+				p[i] = vec3((ndc.x * 0.5f + 0.5f) * m_width, (ndc.y * 0.5f + 0.5f) * m_height, ndc.z * 0.5f + 0.5f);
+				tri.z[i] = p[i].z;
+				tri.position[i] = v[i]->position;
+				tri.normal[i] = v[i]->normal;
+			}
+
+			// counter-clockwise winding so inside is positive, no face culling
+			// (the GL path doesn't enable GL_CULL_FACE either)
+			float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[1].y - p[0].y) * (p[2].x - p[0].x);
+			if (std::abs(area) < 1e-12f) continue;
+			if (area < 0) {
+				std::swap(p[1], p[2]);
+				std::swap(tri.z[1], tri.z[2]);
+				std::swap(tri.invW[1], tri.invW[2]);
+				std::swap(tri.position[1], tri.position[2]);
+				std::swap(tri.normal[1], tri.normal[2]);
+				area = -area;
+			}
+
+			// pixel centers (i + 0.5) inside the bounds
+			tri.xmin = std::max(0, int(std::ceil(std::min({ p[0].x, p[1].x, p[2].x }) - 0.5f)));
+			tri.xmax = std::min(m_width - 1, int(std::floor(std::max({ p[0].x, p[1].x, p[2].x }) - 0.5f)));
+			tri.ymin = std::max(0, int(std::ceil(std::min({ p[0].y, p[1].y, p[2].y }) - 0.5f)));
+			tri.ymax = std::min(m_height - 1, int(std::floor(std::max({ p[0].y, p[1].y, p[2].y }) - 0.5f)));
+			if (tri.xmin > tri.xmax || tri.ymin > tri.ymax) continue;
+
+			// edge k is opposite vertex k, divided by the area it is barycentric k
+			const float inv = 1.0f / area;
+			for (int e = 0; e < 3; e++) {
+				const vec3 &pi = p[(e + 1) % 3], &pj = p[(e + 2) % 3];
+				tri.a[e] = -(pj.y - pi.y) * inv;
+				tri.b[e] = (pj.x - pi.x) * inv;
+				tri.c[e] = -(tri.a[e] * pi.x + tri.b[e] * pi.y);
+			}
+
+			uint32_t index = uint32_t(triangles.size());
+			triangles.push_back(tri);
+			for (int ty = tri.ymin / tileSize; ty <= tri.ymax / tileSize; ty++) {
+				for (int tx = tri.xmin / tileSize; tx <= tri.xmax / tileSize; tx++) {
+					bins[ty * m_tilesX + tx].push_back(index);
+				}
+			}
+		}
+	}
+}
+
+
+void SoftRasterizer::rasterizeTile(int tile) {
+	const int tx0 = (tile % m_tilesX) * tileSize;
+	const int ty0 = (tile / m_tilesX) * tileSize;
+
+	// clear this tile
+	for (int y = ty0; y < ty0 + tileSize; y++) {
+		size_t row = size_t(y) * m_stride + tx0;
+		std::fill_n(&m_depth[row], tileSize, 1.0f);
+		std::fill_n(&m_triangleIds[row], tileSize, emptyId);
+	}
+
+	// batches in submission order, so equal depths resolve like the GPU
+	for (size_t batch = 0; batch < m_bins.size(); batch++) {
+		for (uint32_t index : m_bins[batch][tile]) {
+			const SetupTriangle &tri = m_triangles[batch][index];
+			const uint32_t id = uint32_t(batch << 24) | index;
+			const int x0 = std::max(tri.xmin, tx0), x1 = std::min(tri.xmax, tx0 + tileSize - 1);
+			const int y0 = std::max(tri.ymin, ty0), y1 = std::min(tri.ymax, ty0 + tileSize - 1);
+
+			for (int y = y0; y <= y1; y++) {
+				const float py = float(y) + 0.5f;
+				const size_t row = size_t(y) * m_stride;
+#ifdef SOFT_RASTERIZER_SSE2
+				const __m128 zero = _mm_setzero_ps();
+				const __m128 one = _mm_set1_ps(1.0f);
+				const __m128 lane = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+				const __m128i ids = _mm_set1_epi32(int(id));
+				__m128 a[3], eRow[3], z[3];
+				for (int k = 0; k < 3; k++) {
+					a[k] = _mm_set1_ps(tri.a[k]);
+					eRow[k] = _mm_set1_ps(tri.b[k] * py + tri.c[k]);
+					z[k] = _mm_set1_ps(tri.z[k]);
+				}
+
+				// tiles are a multiple of 4 wide, so groups never cross a tile
+				for (int x = tx0 + ((x0 - tx0) & ~3); x <= x1; x += 4) {
+					const __m128 px = _mm_add_ps(_mm_set1_ps(float(x)), lane);
+					const __m128 e0 = _mm_add_ps(_mm_mul_ps(a[0], px), eRow[0]);
+					const __m128 e1 = _mm_add_ps(_mm_mul_ps(a[1], px), eRow[1]);
+					const __m128 e2 = _mm_add_ps(_mm_mul_ps(a[2], px), eRow[2]);
+					__m128 mask = _mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_and_ps(_mm_cmpge_ps(e1, zero), _mm_cmpge_ps(e2, zero)));
+					if (_mm_movemask_ps(mask) == 0) continue;
+
+					// depth test (GL_LESS) and far plane
+					const __m128 depth = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e0, z[0]), _mm_mul_ps(e1, z[1])), _mm_mul_ps(e2, z[2]));
+					const __m128 old = _mm_loadu_ps(&m_depth[row + x]);
+					mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmplt_ps(depth, old), _mm_cmple_ps(depth, one)));
+					if (_mm_movemask_ps(mask) == 0) continue;
+
+					const __m128i maski = _mm_castps_si128(mask);
+					_mm_storeu_ps(&m_depth[row + x], _mm_or_ps(_mm_and_ps(mask, depth), _mm_andnot_ps(mask, old)));
+					__m128i oldIds = _mm_loadu_si128((const __m128i *)&m_triangleIds[row + x]);
+					_mm_storeu_si128((__m128i *)&m_triangleIds[row + x], _mm_or_si128(_mm_and_si128(maski, ids), _mm_andnot_si128(maski, oldIds)));
+					__m128 oldB1 = _mm_loadu_ps(&m_bary1[row + x]);
+					_mm_storeu_ps(&m_bary1[row + x], _mm_or_ps(_mm_and_ps(mask, e1), _mm_andnot_ps(mask, oldB1)));
+					__m128 oldB2 = _mm_loadu_ps(&m_bary2[row + x]);
+					_mm_storeu_ps(&m_bary2[row + x], _mm_or_ps(_mm_and_ps(mask, e2), _mm_andnot_ps(mask, oldB2)));
+				}
+#else
+				for (int x = x0; x <= x1; x++) {
+					const float px = float(x) + 0.5f;
+					float e[3];
+					for (int k = 0; k < 3; k++) e[k] = tri.a[k] * px + tri.b[k] * py + tri.c[k];
+					if (e[0] < 0 || e[1] < 0 || e[2] < 0) continue;
+					float depth = e[0] * tri.z[0] + e[1] * tri.z[1] + e[2] * tri.z[2];
+					if (depth >= m_depth[row + x] || depth > 1.0f) continue;
+					m_depth[row + x] = depth;
+					m_triangleIds[row + x] = id;
+					m_bary1[row + x] = e[1];
+					m_bary2[row + x] = e[2];
+				}
+#endif
+			}
+		}
+	}
+}
+
+
+void SoftRasterizer::shadeTile(int tile, const ShadingParams &params) {
+	const int tx0 = (tile % m_tilesX) * tileSize;
+	const int ty0 = (tile / m_tilesX) * tileSize;
+	const unsigned char clear[4] = { 77, 77, 102, 255 }; // glClearColor(0.3, 0.3, 0.4, 1)
+
+	for (int y = ty0; y < ty0 + tileSize; y++) {
+		for (int x = tx0; x < tx0 + tileSize; x++) {
+			const size_t i = size_t(y) * m_stride + x;
+			unsigned char *out = &m_color[i * 4];
+			const uint32_t id = m_triangleIds[i];
+			if (id == emptyId) {
+				std::copy(clear, clear + 4, out);
+				continue;
+			}
+
+			// perspective correct barycentrics
+			const SetupTriangle &tri = m_triangles[id >> 24][id & 0xFFFFFF];
+			float l[3] = { 1.0f - m_bary1[i] - m_bary2[i], m_bary1[i], m_bary2[i] };
+			float sum = 0;
+			for (int k = 0; k < 3; k++) {
+				l[k] *= tri.invW[k];
+				sum += l[k];
+			}
+			vec3 position(0), normal(0);
+			for (int k = 0; k < 3; k++) {
+				position += tri.position[k] * (l[k] / sum);
+				normal += tri.normal[k] * (l[k] / sum);
+			}
+
+			vec3 color = clamp(shadeFragment(params, position, normal), 0.0f, 1.0f);
+			out[0] = (unsigned char)(color.r * 255.0f + 0.5f);
+			out[1] = (unsigned char)(color.g * 255.0f + 0.5f);
+			out[2] = (unsigned char)(color.b * 255.0f + 0.5f);
+			out[3] = 255;
+		}
+	}
+}
+
+
+vector<unsigned char> SoftRasterizer::image() const {
+	vector<unsigned char> result(size_t(m_width) * m_height * 4);
+	for (int y = 0; y < m_height; y++) {
+		const unsigned char *src = &m_color[(size_t(m_height - 1 - y) * m_stride) * 4];
+		std::copy(src, src + m_width * 4, &result[size_t(y) * m_width * 4]);
+	}
+	return result;
+}
+
+
+void SoftRasterizer::benchmark(const vector<Vertex> &mesh, const ShadingParams &params, int width, int height, int frames) {
+	const unsigned hardware = std::max(1u, thread::hardware_concurrency());
+	vector<unsigned> threadCounts;
+	for (unsigned t = 1; t < hardware; t *= 2) threadCounts.push_back(t);
+	threadCounts.push_back(hardware);
+
+	cout << "Software rasterizer: " << mesh.size() / 3 << " triangles at " << width << "x" << height << ", " << frames << " frames" << endl;
+	cout << setw(8) << "threads" << setw(12) << "ms/frame" << setw(14) << "Mtris/s" << setw(10) << "speedup" << endl;
+	double baseline = 0;
+	for (unsigned threads : threadCounts) {
+		// render from inside the pool so exactly 'threads' threads do the work
+		cgra::thread_pool pool(threads);
+		SoftRasterizer rasterizer(pool);
+		rasterizer.resize(width, height);
+		double ms = pool.submit([&]() {
+			rasterizer.render(mesh, params); // warm up
+			auto start = chrono::steady_clock::now();
+			for (int i = 0; i < frames; i++) rasterizer.render(mesh, params);
+			return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / frames;
+		}).get();
+		if (baseline == 0) baseline = ms;
+		double trisPerSecond = (mesh.size() / 3) / (ms / 1000.0);
+		cout << setw(8) << threads << setw(12) << fixed << setprecision(3) << ms << setw(14) << trisPerSecond / 1e6 << setw(9) << baseline / ms << "x" << endl;
+	}
+}
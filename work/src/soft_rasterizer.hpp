@@ -0,0 +1,109 @@
+#pragma once
+
+// std
+#include <cstdint>
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "cgra/cgra_thread_pool.hpp"
+#include "objfile.h"
+
+
+// lighting inputs shared by the CPU renderers, mirrors the uniforms
+// of default_frag.glsl (Lambert) and phong_frag.glsl (Phong)
+struct ShadingParams {
+	glm::mat4 projection = glm::mat4(1);
+	glm::mat4 modelView = glm::mat4(1);
+	glm::vec3 color = glm::vec3(1); // uColor
+	glm::vec3 lightDirection = glm::vec3(0, -1, -1); // uLightDirection, view space
+	bool phong = false; // phong_frag.glsl instead of default_frag.glsl
+	glm::vec3 lightColor = glm::vec3(1); // uLightColor
+	float ambient = 0.2f; // uAmbient
+	float diffuse = 0.8f; // uDiffuse
+	float specular = 0.5f; // uSpecular
+	float shininess = 32.0f; // uShininess
+};
+
+// evaluates default_frag.glsl or phong_frag.glsl for one fragment, light
+// scales the diffuse and specular terms (0 for a fragment in shadow)
+glm::vec3 shadeFragment(const ShadingParams &params, const glm::vec3 &viewPosition, const glm::vec3 &viewNormal, float light = 1.0f);
+
+
+// Multithreaded tiled software rasterizer for ObjFile meshes, for machines
+// without a usable GPU. Triangles are transformed and near-clipped in
+// parallel, binned into 32x32 pixel tiles, then each tile is rasterized
+// (SSE2 edge functions, 4 pixels at a time) into a visibility buffer of
+// triangle ids and barycentrics and shaded once per pixel, with no overdraw.
+class SoftRasterizer {
+public:
+	static constexpr int tileSize = 32;
+
+	// triangle after clipping and setup, edge functions are normalized
+	// so they give barycentric weights directly
+	struct SetupTriangle {
+		float a[3], b[3], c[3]; // edge function k is barycentric weight k
+		float z[3]; // depth at each vertex, [0,1]
+		float invW[3]; // for perspective correct interpolation
+		glm::vec3 position[3]; // view space
+		glm::vec3 normal[3]; // view space
+		int xmin, ymin, xmax, ymax; // pixel bounds, inclusive
+	};
+
+private:
+	cgra::thread_pool *m_pool;
+	int m_width = 0; // requested size
+	int m_height = 0;
+	int m_stride = 0; // padded to whole tiles
+	int m_paddedHeight = 0;
+	int m_tilesX = 0;
+	int m_tilesY = 0;
+
+	// visibility buffer, row major over the padded size
+	std::vector<float> m_depth;
+	std::vector<std::uint32_t> m_triangleIds; // batch << 24 | index, ~0 for empty
+	std::vector<float> m_bary1, m_bary2;
+
+	// RGBA8 output, bottom row first like OpenGL
+	std::vector<unsigned char> m_color;
+
+	// per batch setup triangles and per tile bins
+	std::vector<std::vector<SetupTriangle>> m_triangles;
+	std::vector<std::vector<std::vector<std::uint32_t>>> m_bins;
+
+	// last frame stats
+	std::size_t m_triangleCount = 0;
+	double m_milliseconds = 0;
+
+	void setupBatch(std::size_t batch, const std::vector<Vertex> &mesh, std::size_t first, std::size_t last, const ShadingParams &params);
+	void rasterizeTile(int tile);
+	void shadeTile(int tile, const ShadingParams &params);
+
+public:
+	explicit SoftRasterizer(cgra::thread_pool &pool);
+
+	// set the framebuffer size
+	void resize(int width, int height);
+	int width() const { return m_width; }
+	int height() const { return m_height; }
+
+	// clear and render a triangle soup (three vertices per triangle)
+	void render(const std::vector<Vertex> &mesh, const ShadingParams &params);
+
+	// RGBA8 pixels, bottom row first, each row stride() pixels apart
+	const std::vector<unsigned char> & pixels() const { return m_color; }
+	int stride() const { return m_stride; }
+
+	// tightly packed RGBA8 pixels, top row first, ready for write_png
+	std::vector<unsigned char> image() const;
+
+	// stats for the last render()
+	std::size_t triangleCount() const { return m_triangleCount; }
+	double milliseconds() const { return m_milliseconds; }
+
+	// renders the mesh with 1, 2, 4 ... hardware threads and prints
+	// triangles per second for each thread count
+	static void benchmark(const std::vector<Vertex> &mesh, const ShadingParams &params, int width, int height, int frames);
+};